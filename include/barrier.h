@@ -0,0 +1,87 @@
+#ifndef BARRIER_H
+#define BARRIER_H
+
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+
+#define BARRIER_REPORT_INTERVAL 300
+
+// Accesses that have to be made available before a later access.
+#define BARRIER_WRITE_ACCESS_MASK                                              \
+  (VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |       \
+   VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |                                    \
+   VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |                            \
+   VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT |               \
+   VK_ACCESS_2_MEMORY_WRITE_BIT)
+
+typedef struct BarrierBatch BarrierBatch;
+
+// Last known use of one mip level / array layer. writeStage/writeAccess is
+// the last write or layout transition; readStage/readAccess is what already
+// has a dependency on it, so later reads only wait when they are not covered.
+typedef struct {
+  VkImageLayout layout;
+  VkPipelineStageFlags2 writeStage;
+  VkAccessFlags2 writeAccess;
+  VkPipelineStageFlags2 readStage;
+  VkAccessFlags2 readAccess;
+  const BarrierBatch *pendingBatch;
+  uint32_t pendingGeneration;
+  uint32_t pendingIndex;
+} SubresourceState;
+
+typedef struct {
+  VkImage image;
+  VkImageAspectFlags aspect;
+  uint32_t mipLevels;
+  uint32_t layers;
+  SubresourceState *states;
+} TrackedImage;
+
+// Accumulates image transitions and emits them as a single
+// vkCmdPipelineBarrier2 on flush. Source stage and access come from the
+// tracked state, so each barrier only waits for the work that actually
+// touched the subresource.
+struct BarrierBatch {
+  VkImageMemoryBarrier2 *barriers;
+  uint32_t count;
+  uint32_t cap;
+  uint32_t generation;
+  uint32_t frameBarriers;
+  uint32_t frameFlushes;
+  uint32_t reportFrames;
+  uint64_t reportBarriers;
+};
+
+void trackImage(TrackedImage *tracked, VkImage image, VkImageAspectFlags aspect,
+                uint32_t mipLevels, uint32_t layers);
+
+void untrackImage(TrackedImage *tracked);
+
+// Records a state reached through synchronization the tracker does not see,
+// e.g. a queue family ownership acquire. NONE stage/access means nothing is
+// left to wait for.
+void setImageState(TrackedImage *tracked, uint32_t baseMip, uint32_t levelCount,
+                   VkImageLayout layout, VkPipelineStageFlags2 stage,
+                   VkAccessFlags2 access);
+
+// Requests mips [baseMip, baseMip + levelCount) of every layer to be in layout
+// for the given use. A read in the same layout emits nothing when an earlier
+// barrier already made the last write visible to its stage and access.
+void barrierImage(BarrierBatch *batch, TrackedImage *tracked, uint32_t baseMip,
+                  uint32_t levelCount, VkImageLayout layout,
+                  VkPipelineStageFlags2 stage, VkAccessFlags2 access);
+
+// Queues a barrier computed elsewhere, e.g. by the render graph.
+void barrierAdd(BarrierBatch *batch, const VkImageMemoryBarrier2 *barrier);
+
+// Records the accumulated barriers into cmd. Must be called before recording
+// commands that depend on them.
+void barrierFlush(BarrierBatch *batch, VkCommandBuffer cmd);
+
+// Resets the per-frame counter, returns the number of barriers issued.
+uint32_t barrierEndFrame(BarrierBatch *batch);
+
+void barrierBatchDestroy(BarrierBatch *batch);
+
+#endif // !BARRIER_H
@@ -0,0 +1,66 @@
+#ifndef BINDLESS_H
+#define BINDLESS_H
+
+#include "frame_pacer.h"
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+
+#define BINDLESS_MAX_TEXTURES 4096
+#define BINDLESS_MAX_SAMPLERS 16
+
+// A material packs a texture slot in the low bits and a sampler slot above.
+#define BINDLESS_SAMPLER_SHIFT 24
+#define BINDLESS_TEXTURE_MASK ((1u << BINDLESS_SAMPLER_SHIFT) - 1)
+
+// One update-after-bind descriptor set holding partially bound arrays of
+// sampled images (binding 0) and samplers (binding 1), bound once per frame.
+// Shaders index it with slots taken from per-instance data, so switching
+// materials never rebinds descriptors.
+//
+// Slots come from free lists. A released slot may still be sampled by frames
+// in flight, so it is parked on its frame slot and only reused after that
+// slot has retired again.
+typedef struct {
+  VkDescriptorSetLayout layout;
+  VkDescriptorPool pool;
+  VkDescriptorSet set;
+  uint32_t textureCount;
+  uint32_t samplerCount;
+  uint32_t freeTextures[BINDLESS_MAX_TEXTURES];
+  uint32_t freeTextureCount;
+  uint32_t freeSamplers[BINDLESS_MAX_SAMPLERS];
+  uint32_t freeSamplerCount;
+  uint32_t retiredTextures[FRAME_PACER_MAX_DEPTH][BINDLESS_MAX_TEXTURES];
+  uint32_t retiredTextureCount[FRAME_PACER_MAX_DEPTH];
+  uint32_t retiredSamplers[FRAME_PACER_MAX_DEPTH][BINDLESS_MAX_SAMPLERS];
+  uint32_t retiredSamplerCount[FRAME_PACER_MAX_DEPTH];
+} BindlessTable;
+
+void bindlessInit(BindlessTable *table, VkDevice device);
+
+// Writes view into a free slot and returns it. layout is the layout the image
+// is in whenever shaders sample it.
+uint32_t bindlessAddTexture(BindlessTable *table, VkDevice device,
+                            VkImageView view, VkImageLayout layout);
+
+uint32_t bindlessAddSampler(BindlessTable *table, VkDevice device,
+                            VkSampler sampler);
+
+// Frees the slot once frame slot `slot` has retired; the caller keeps the
+// view alive until then.
+void bindlessReleaseTexture(BindlessTable *table, uint32_t index,
+                            uint32_t slot);
+
+void bindlessReleaseSampler(BindlessTable *table, uint32_t index,
+                            uint32_t slot);
+
+// Returns slots released by the slot's previous frame to the free lists; call
+// after the slot's frame has retired.
+void bindlessCollect(BindlessTable *table, uint32_t slot);
+
+// Value for InstanceData::materialIndex.
+uint32_t bindlessMaterial(uint32_t texture, uint32_t sampler);
+
+void bindlessDestroy(BindlessTable *table, VkDevice device);
+
+#endif // !BINDLESS_H
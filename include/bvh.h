@@ -0,0 +1,86 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "cglm/types.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BVH_BINS 16
+
+// Leaves stop splitting at this size even if SAH would allow more.
+#define BVH_MAX_LEAF 8
+
+// Cost of visiting a node relative to testing one primitive.
+#define BVH_TRAVERSAL_COST 1.0f
+
+// Builds below this many primitives stay on the calling thread.
+#define BVH_PARALLEL_THRESHOLD 100000
+
+#define BVH_BUILD_THREADS 8
+
+// A refit tree whose SAH cost grew past this factor is rebuilt.
+#define BVH_REBUILD_FACTOR 1.5f
+
+// Traversal stack kept on the C stack; deeper trees use a heap stack sized
+// from Bvh.depth.
+#define BVH_STACK_SIZE 64
+
+// 32 bytes, so a sibling pair shares a 64-byte cache line. Interior nodes
+// have count 0 and children at leftFirst and leftFirst + 1; leaves own
+// prims[leftFirst .. leftFirst + count).
+typedef struct {
+  vec3 min;
+  uint32_t leftFirst;
+  vec3 max;
+  uint32_t count;
+} BvhNode;
+
+// Flattened tree over primitive AABBs. The root is node 0; node 1 is unused
+// so sibling pairs start on even indices. Children are always allocated after
+// their parent, so a reverse sweep visits children first.
+typedef struct {
+  BvhNode *nodes;
+  uint32_t nodeCount;
+  uint32_t *prims;
+  uint32_t primCount;
+  // edges from the root to the deepest leaf
+  uint32_t depth;
+  float buildCost;
+  float cost;
+} Bvh;
+
+// Exact test for primitive prim; on a hit closer than *t, updates *t.
+typedef bool (*BvhRayFn)(uint32_t prim, vec3 origin, vec3 dir, float *t,
+                         void *userData);
+
+// boxes holds count AABBs in cglm's min/max layout: box i is &boxes[2 * i].
+void bvhBuild(Bvh *bvh, vec3 *boxes, uint32_t count);
+
+// Scene instances never move and culling runs on the GPU, so refit, update
+// and frustum culling are only exercised by --bvh-bench.
+
+// Recomputes bounds bottom-up after primitives moved. Returns the SAH cost
+// relative to the cost right after the last build.
+float bvhRefit(Bvh *bvh, vec3 *boxes);
+
+// Refits, and rebuilds once the refit tree has degraded past
+// BVH_REBUILD_FACTOR. Returns true on rebuild.
+bool bvhUpdate(Bvh *bvh, vec3 *boxes);
+
+// Writes indices of primitives whose boxes intersect the frustum to visible,
+// which must hold primCount entries. Returns the number written.
+uint32_t bvhCullFrustum(const Bvh *bvh, vec3 *boxes, vec4 planes[6],
+                        uint32_t *visible);
+
+// Closest primitive along the ray within maxDist, or UINT32_MAX. dir must be
+// normalized for t to be a distance.
+uint32_t bvhRayCast(const Bvh *bvh, vec3 origin, vec3 dir, float maxDist,
+                    BvhRayFn hit, void *userData, float *t);
+
+void bvhDestroy(Bvh *bvh);
+
+// Builds, refits, culls and casts rays against count random boxes and prints
+// the timings.
+void bvhBenchmark(uint32_t count);
+
+#endif // !BVH_H
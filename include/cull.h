@@ -0,0 +1,44 @@
+#ifndef CULL_H
+#define CULL_H
+
+#include "cglm/types.h"
+#include <stdint.h>
+
+// Boxes tested per SIMD iteration: 8 with AVX, 4 with SSE2, 1 otherwise.
+#if defined(__AVX__)
+#define CULL_SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64)
+#define CULL_SIMD_WIDTH 4
+#else
+#define CULL_SIMD_WIDTH 1
+#endif
+
+// Axis-aligned boxes in structure-of-arrays layout, stored as center and
+// half-extent so a plane test is two dot products per box.
+typedef struct {
+  float *centerX;
+  float *centerY;
+  float *centerZ;
+  float *extentX;
+  float *extentY;
+  float *extentZ;
+  uint32_t count;
+  uint32_t capacity;
+} CullBoxes;
+
+void cullBoxesInit(CullBoxes *boxes, uint32_t capacity);
+
+// box is in cglm's min/max layout. Returns the box index.
+uint32_t cullBoxesAdd(CullBoxes *boxes, vec3 box[2]);
+
+// Writes the indices of boxes intersecting the frustum of viewProj to visible,
+// which must hold boxes->count entries. Returns the number written.
+uint32_t cullFrustum(const CullBoxes *boxes, mat4 viewProj, uint32_t *visible);
+
+void cullBoxesDestroy(CullBoxes *boxes);
+
+// Culls count random boxes, checks the result against glm_aabb_frustum and
+// prints nanoseconds per box for both.
+void cullBenchmark(uint32_t count);
+
+#endif // !CULL_H
@@ -1,4 +1,55 @@
 #ifndef DEVICE_H
 #define DEVICE_H
 
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_QUEUE_FAMILIES 3
+
+// Families used for each kind of work. transfer and compute fall back to the
+// graphics family when the device has no separate one.
+typedef struct {
+  uint32_t graphics;
+  uint32_t transfer;
+  uint32_t compute;
+} QueueFamilies;
+
+QueueFamilies findQueueFamilies(VkPhysicalDevice physicalDevice,
+                                VkSurfaceKHR surface);
+
+bool deviceSupportsExtension(VkPhysicalDevice physicalDevice,
+                             const char *name);
+
+// One create info per distinct family, returns the number written.
+uint32_t getQueueCreateInfos(const QueueFamilies *families,
+                             const float *priority,
+                             VkDeviceQueueCreateInfo *infos);
+
+// Records the release (on srcFamily) or acquire (on dstFamily) half of a queue
+// family ownership transfer. No-op when both families are the same.
+void cmdReleaseBuffer(VkCommandBuffer cmd, VkBuffer buffer, uint32_t srcFamily,
+                      uint32_t dstFamily, VkAccessFlags2 srcAccess,
+                      VkPipelineStageFlags2 srcStage);
+
+void cmdReleaseImage(VkCommandBuffer cmd, VkImage image,
+                     VkImageSubresourceRange range, VkImageLayout layout,
+                     uint32_t srcFamily, uint32_t dstFamily,
+                     VkAccessFlags2 srcAccess, VkPipelineStageFlags2 srcStage);
+
+// The acquire's first scope is dstStage, where the submit's semaphore wait
+// blocks, which chains it after the release on the other queue.
+VkBufferMemoryBarrier2 bufferAcquireBarrier(VkBuffer buffer, uint32_t srcFamily,
+                                            uint32_t dstFamily,
+                                            VkAccessFlags2 dstAccess,
+                                            VkPipelineStageFlags2 dstStage);
+
+VkImageMemoryBarrier2 imageAcquireBarrier(VkImage image,
+                                          VkImageSubresourceRange range,
+                                          VkImageLayout layout,
+                                          uint32_t srcFamily,
+                                          uint32_t dstFamily,
+                                          VkAccessFlags2 dstAccess,
+                                          VkPipelineStageFlags2 dstStage);
+
 #endif // !DEVICE_H
@@ -0,0 +1,41 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The render scale moves in steps of 1 / DYNRES_LEVELS of the swapchain
+// extent, so tiny timing changes do not churn it.
+#define DYNRES_LEVELS 20
+
+#define DYNRES_MIN_LEVEL 10
+
+// Scale only grows while GPU time is below this fraction of the budget.
+#define DYNRES_HEADROOM 0.85f
+
+// Frames to wait after a change; results lag by the frames in flight.
+#define DYNRES_SETTLE_FRAMES 8
+
+// Weight of each new sample in the smoothed GPU time.
+#define DYNRES_SMOOTHING 0.2f
+
+// Picks the render scale from measured GPU frame time against a budget.
+// Over budget it drops straight to the level whose pixel count fits, since
+// GPU time roughly follows pixel count; under it, it grows one level at a
+// time.
+typedef struct {
+  float budgetMs;
+  uint32_t level;
+  float smoothedMs;
+  uint32_t settle;
+  bool primed;
+} DynamicResolution;
+
+void dynResInit(DynamicResolution *dr, float budgetMs);
+
+// Feeds one frame's GPU time. Returns true and logs when the scale changed.
+bool dynResUpdate(DynamicResolution *dr, float gpuMs);
+
+float dynResScale(const DynamicResolution *dr);
+
+#endif // !DYNAMIC_RESOLUTION_H
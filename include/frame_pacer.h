@@ -0,0 +1,54 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+
+// Upper bound for the frames-in-flight depth. Per-frame resources are
+// allocated for this many slots so the depth can change without reallocation.
+#define FRAME_PACER_MAX_DEPTH 4
+
+// Blocking on the timeline for longer than this means the GPU was behind.
+#define FRAME_PACER_WAIT_EPSILON_NS 100000ull
+
+#define FRAME_PACER_REPORT_INTERVAL 300
+
+typedef enum {
+  FRAME_BOUND_CPU,
+  FRAME_BOUND_GPU,
+} FrameBound;
+
+// Frame pacing on a single timeline semaphore: frame N signals value N + 1 on
+// submit, and the CPU waits for value N + 1 - depth before recording frame N.
+typedef struct {
+  VkSemaphore timeline;
+  uint32_t depth;
+  uint64_t frameIndex;
+  uint64_t frameStartNs;
+  uint64_t waitNs;
+  uint64_t frameNs;
+  FrameBound bound;
+  uint32_t reportFrames;
+  uint32_t reportGpuBound;
+  uint64_t reportWaitNs;
+  uint64_t reportFrameNs;
+} FramePacer;
+
+void framePacerInit(FramePacer *pacer, VkDevice device, uint32_t depth);
+
+void framePacerSetDepth(FramePacer *pacer, uint32_t depth);
+
+// Blocks until the frame about to be recorded is allowed to start and returns
+// the per-frame resource slot it should use.
+uint32_t framePacerBeginFrame(FramePacer *pacer, VkDevice device);
+
+// Timeline value the current frame's submit has to signal.
+uint64_t framePacerSignalValue(const FramePacer *pacer);
+
+void framePacerEndFrame(FramePacer *pacer);
+
+void framePacerWaitIdle(const FramePacer *pacer, VkDevice device);
+
+void framePacerDestroy(FramePacer *pacer, VkDevice device);
+
+#endif // !FRAME_PACER_H
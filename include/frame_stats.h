@@ -0,0 +1,58 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define FRAME_STATS_WINDOW 1024
+
+// A frame longer than this multiple of the rolling average is a hitch.
+#define FRAME_STATS_HITCH_FACTOR 2.0
+
+#define FRAME_STATS_REPORT_NS 5000000000ull
+
+// Wall-clock frame timing on the monotonic timer.
+typedef struct {
+  uint64_t startNs;
+  uint64_t lastNs;
+  uint64_t frame;
+  double deltaSeconds;
+  double elapsedSeconds;
+} FrameClock;
+
+typedef struct {
+  double min;
+  double avg;
+  double p50;
+  double p95;
+  double p99;
+  double max;
+} FrameStatsSummary;
+
+// Rolling window of frame times in milliseconds, summarized to stdout and
+// optionally appended to a CSV file every FRAME_STATS_REPORT_NS.
+typedef struct {
+  double samples[FRAME_STATS_WINDOW];
+  uint32_t count;
+  uint32_t next;
+  double sum;
+  uint64_t frames;
+  uint32_t hitches;
+  uint64_t totalHitches;
+  uint64_t lastReportNs;
+  FILE *csv;
+} FrameStats;
+
+void frameClockInit(FrameClock *clock);
+
+void frameClockTick(FrameClock *clock);
+
+void frameStatsInit(FrameStats *stats, const char *csvPath);
+
+void frameStatsRecord(FrameStats *stats, const FrameClock *clock);
+
+FrameStatsSummary frameStatsSummarize(const FrameStats *stats);
+
+void frameStatsDestroy(FrameStats *stats);
+
+#endif // !FRAME_STATS_H
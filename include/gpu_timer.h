@@ -0,0 +1,42 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include "frame_pacer.h"
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GPU_TIMER_REPORT_INTERVAL 300
+
+// GPU time of a span of each frame from a pair of timestamps per frame slot.
+// Like PipelineStats, results are read once the slot has retired. Samples are
+// averaged under a label until the label changes.
+typedef struct {
+  VkQueryPool pool;
+  float period;
+  bool issued[FRAME_PACER_MAX_DEPTH];
+  const char *label;
+  float lastMs;
+  uint64_t sumNs;
+  uint64_t samples;
+} GpuTimer;
+
+// period is VkPhysicalDeviceLimits::timestampPeriod.
+void gpuTimerInit(GpuTimer *timer, VkDevice device, float period);
+
+// Starts averaging afresh, e.g. after switching render modes.
+void gpuTimerSetLabel(GpuTimer *timer, const char *label);
+
+// Reads the slot's previous timestamps into lastMs; returns false when the
+// slot had none.
+bool gpuTimerCollect(GpuTimer *timer, VkDevice device, uint32_t slot);
+
+// Resets the slot's queries and writes the start timestamp; must be recorded
+// outside a render pass.
+void gpuTimerBegin(GpuTimer *timer, VkCommandBuffer cmd, uint32_t slot);
+
+void gpuTimerEnd(GpuTimer *timer, VkCommandBuffer cmd, uint32_t slot);
+
+void gpuTimerDestroy(GpuTimer *timer, VkDevice device);
+
+#endif // !GPU_TIMER_H
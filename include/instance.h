@@ -2,7 +2,10 @@
 #define INSTANCE_H
 
 #include "vulkan/vulkan.h"
+#include <stdbool.h>
 
-void createInstance(VkInstance *instance);
+// windowed enables the surface extensions GLFW needs; headless instances
+// enable none.
+void createInstance(VkInstance *instance, bool windowed);
 
 #endif // !INSTANCE_H
@@ -0,0 +1,69 @@
+#ifndef INSTANCES_H
+#define INSTANCES_H
+
+#include "cglm/types.h"
+#include "frame_pacer.h"
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+
+#define INSTANCE_INVALID UINT32_MAX
+
+// Mirrors InstanceData in shaders/cull.comp and shaders/tri.vert (std430).
+typedef struct {
+  mat4 model;
+  vec4 sphere;
+  uint32_t indexCount;
+  uint32_t firstIndex;
+  int32_t vertexOffset;
+  // texture and sampler slots in the bindless table, see bindlessMaterial
+  uint32_t materialIndex;
+} InstanceData;
+
+// Per-instance data kept densely packed in [0, count) so one dispatch and one
+// draw cover every instance. Removing an instance moves the last one into the
+// hole; handles go through an indirection table and stay valid across moves.
+//
+// Each frame slot owns a host-visible copy of the storage buffer. Changes are
+// tracked as a dirty range per slot and copied in instanceBufferSync once the
+// slot's previous frame has retired, so in-flight frames never see a write.
+//
+// capacity is fixed at init: the slot buffers, and the indirect draw and cull
+// buffers sized from it, are never reallocated. Adds and removes are free
+// below it; an add past it fails.
+typedef struct {
+  InstanceData *data;
+  uint32_t *denseToHandle;
+  uint32_t *handleToDense;
+  uint32_t *freeHandles;
+  uint32_t freeCount;
+  uint32_t handleCount;
+  uint32_t count;
+  uint32_t capacity;
+  VkBuffer buffers[FRAME_PACER_MAX_DEPTH];
+  VkDeviceMemory memory[FRAME_PACER_MAX_DEPTH];
+  InstanceData *mapped[FRAME_PACER_MAX_DEPTH];
+  uint32_t dirtyBegin[FRAME_PACER_MAX_DEPTH];
+  uint32_t dirtyEnd[FRAME_PACER_MAX_DEPTH];
+} InstanceBuffer;
+
+void instanceBufferInit(InstanceBuffer *instances, VkDevice device,
+                        VkPhysicalDevice physicalDevice, uint32_t capacity);
+
+// Returns the new instance's handle, or INSTANCE_INVALID when the buffer is
+// at capacity.
+uint32_t instanceAdd(InstanceBuffer *instances, const InstanceData *data);
+
+void instanceRemove(InstanceBuffer *instances, uint32_t handle);
+
+// Returned pointer is valid until the next add or remove.
+InstanceData *instanceGet(InstanceBuffer *instances, uint32_t handle);
+
+// Marks the instance as changed after writing through instanceGet.
+void instanceTouch(InstanceBuffer *instances, uint32_t handle);
+
+// Copies the slot's dirty range; call after the slot's frame has retired.
+void instanceBufferSync(InstanceBuffer *instances, uint32_t slot);
+
+void instanceBufferDestroy(InstanceBuffer *instances, VkDevice device);
+
+#endif // !INSTANCES_H
@@ -0,0 +1,49 @@
+#ifndef PIPELINE_CACHE_H
+#define PIPELINE_CACHE_H
+
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+
+#define PIPELINE_CACHE_PATH "pipeline_cache.bin"
+
+// A VkPipelineCache persisted between runs. The file is only used when its
+// header matches this device's vendor, device ID and cache UUID, and is
+// replaced atomically on save so a crash never leaves a torn cache behind.
+//
+// Pipelines created through it are timed, and creation feedback tells
+// whether the driver found each one in the cache. Creation may run on several
+// threads at once; the counters are guarded by lock.
+typedef struct {
+  VkPipelineCache cache;
+  const char *path;
+  // valid data was loaded from disk
+  bool warm;
+  uint32_t hits;
+  uint32_t misses;
+  uint64_t createNs;
+  mtx_t lock;
+} PipelineCache;
+
+void pipelineCacheInit(PipelineCache *cache, VkDevice device,
+                       VkPhysicalDevice physicalDevice, const char *path);
+
+VkResult pipelineCacheCreateGraphics(PipelineCache *cache, VkDevice device,
+                                     const VkGraphicsPipelineCreateInfo *info,
+                                     VkPipeline *pipeline);
+
+VkResult pipelineCacheCreateCompute(PipelineCache *cache, VkDevice device,
+                                    const VkComputePipelineCreateInfo *info,
+                                    VkPipeline *pipeline);
+
+// Prints hits, misses and the time spent creating pipelines so far, summed
+// over threads.
+void pipelineCacheReport(PipelineCache *cache);
+
+// Writes the cache to a temporary file and renames it over path.
+void pipelineCacheSave(PipelineCache *cache, VkDevice device);
+
+void pipelineCacheDestroy(PipelineCache *cache, VkDevice device);
+
+#endif // !PIPELINE_CACHE_H
@@ -0,0 +1,103 @@
+#ifndef PIPELINE_LIBRARY_H
+#define PIPELINE_LIBRARY_H
+
+#include "frame_pacer.h"
+#include "vulkan/vulkan.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+
+#define PIPELINE_LIBRARY_THREADS 4
+#define PIPELINE_LIBRARY_MAX_VARIANTS 64
+
+// Creates the pipeline described by key, or returns VK_NULL_HANDLE on
+// failure. Runs on a worker thread, so it may only read state that stays
+// fixed while variants compile.
+typedef VkPipeline (*PipelineBuildFn)(uint32_t key, void *userData);
+
+typedef bool (*PipelineKeyFilterFn)(uint32_t key, void *userData);
+
+// A variant that is compiling or compiled. pipeline is valid once ready is
+// set; futures never move, so callers may keep pointers to them.
+//
+// A rebuild compiles into replacement while pipeline stays in use; the
+// remaining fields belong to the thread that calls pipelineLibrarySwap.
+typedef struct {
+  uint32_t key;
+  VkPipeline pipeline;
+  atomic_bool ready;
+  VkPipeline replacement;
+  atomic_bool replaced;
+  bool rebuilding;
+  // asked to rebuild while a build was still running
+  bool stale;
+} PipelineFuture;
+
+// Compiles pipeline variants on a pool of worker threads in the order they
+// were requested. Workers share the caller's pipeline cache, which Vulkan
+// synchronizes internally.
+//
+// Rebuilt pipelines are swapped in between frames. The pipeline they replace
+// may still be bound by frames in flight, so it is parked on the frame slot
+// and destroyed once that slot has retired again.
+typedef struct {
+  PipelineBuildFn build;
+  void *userData;
+  PipelineFuture futures[PIPELINE_LIBRARY_MAX_VARIANTS];
+  uint32_t futureCount;
+  // ring of future indices waiting for a worker; each future has at most
+  // one build queued or running
+  uint32_t queue[PIPELINE_LIBRARY_MAX_VARIANTS];
+  uint32_t queueHead;
+  uint32_t queueCount;
+  uint32_t doneCount;
+  bool stopping;
+  mtx_t lock;
+  cnd_t queued;
+  cnd_t done;
+  thrd_t threads[PIPELINE_LIBRARY_THREADS];
+  uint64_t startNs;
+  VkPipeline retired[FRAME_PACER_MAX_DEPTH][PIPELINE_LIBRARY_MAX_VARIANTS];
+  uint32_t retiredCount[FRAME_PACER_MAX_DEPTH];
+} PipelineLibrary;
+
+void pipelineLibraryInit(PipelineLibrary *library, PipelineBuildFn build,
+                         void *userData);
+
+// Queues key unless it was requested before; returns its future either way.
+PipelineFuture *pipelineLibraryRequest(PipelineLibrary *library, uint32_t key);
+
+// The future for key, or NULL if it was never requested.
+PipelineFuture *pipelineLibraryFind(PipelineLibrary *library, uint32_t key);
+
+// The variant's pipeline, or fallback while it is compiling or if future is
+// NULL. Never blocks.
+VkPipeline pipelineLibraryGet(const PipelineFuture *future,
+                              VkPipeline fallback);
+
+// Blocks until the variant has compiled.
+VkPipeline pipelineLibraryWait(PipelineLibrary *library,
+                               PipelineFuture *future);
+
+// Marks every variant whose key passes filter for recompilation, e.g. after
+// one of its shaders changed, and returns how many matched. Rebuilds are
+// queued by the next pipelineLibrarySwap.
+uint32_t pipelineLibraryRebuild(PipelineLibrary *library,
+                                PipelineKeyFilterFn filter, void *userData);
+
+// Swaps in rebuilt pipelines, retiring the old ones to the slot, and queues
+// pending rebuilds. A failed rebuild keeps the old pipeline. Call between
+// frames, before recording into the slot.
+void pipelineLibrarySwap(PipelineLibrary *library, uint32_t slot);
+
+// Destroys pipelines retired by the slot's previous frame; call after the
+// slot's frame has retired.
+void pipelineLibraryCollect(PipelineLibrary *library, VkDevice device,
+                            uint32_t slot);
+
+// Joins the workers once queued builds finish, then destroys every
+// pipeline.
+void pipelineLibraryDestroy(PipelineLibrary *library, VkDevice device);
+
+#endif // !PIPELINE_LIBRARY_H
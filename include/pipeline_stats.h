@@ -0,0 +1,47 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include "frame_pacer.h"
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Render modes compared side by side, e.g. with and without a depth prepass.
+#define PIPELINE_STATS_VARIANTS 2
+
+#define PIPELINE_STATS_REPORT_INTERVAL 300
+
+// Vertex and fragment shader invocations per frame, from one pipeline
+// statistics query per frame slot. Results are read back once the pacer has
+// retired the slot, so reading never stalls, and averaged per variant.
+typedef struct {
+  VkQueryPool pool;
+  bool issued[FRAME_PACER_MAX_DEPTH];
+  uint32_t slotVariant[FRAME_PACER_MAX_DEPTH];
+  const char *names[PIPELINE_STATS_VARIANTS];
+  uint64_t vertexSum[PIPELINE_STATS_VARIANTS];
+  uint64_t fragmentSum[PIPELINE_STATS_VARIANTS];
+  uint64_t samples[PIPELINE_STATS_VARIANTS];
+  uint64_t frames;
+} PipelineStats;
+
+void pipelineStatsInit(PipelineStats *stats, VkDevice device,
+                       const char *names[PIPELINE_STATS_VARIANTS]);
+
+// Reads the slot's previous query; call after the slot's frame has retired.
+void pipelineStatsCollect(PipelineStats *stats, VkDevice device,
+                          uint32_t slot);
+
+// Resets the slot's query; must be recorded outside a render pass.
+void pipelineStatsReset(PipelineStats *stats, VkCommandBuffer cmd,
+                        uint32_t slot);
+
+void pipelineStatsBegin(PipelineStats *stats, VkCommandBuffer cmd,
+                        uint32_t slot, uint32_t variant);
+
+void pipelineStatsEnd(PipelineStats *stats, VkCommandBuffer cmd,
+                      uint32_t slot);
+
+void pipelineStatsDestroy(PipelineStats *stats, VkDevice device);
+
+#endif // !PIPELINE_STATS_H
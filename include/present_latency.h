@@ -0,0 +1,89 @@
+#ifndef PRESENT_LATENCY_H
+#define PRESENT_LATENCY_H
+
+#include "vulkan/vulkan.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+
+// Frames tracked at once; a frame is dropped from the measurement when more
+// are outstanding.
+#define PRESENT_LATENCY_MAX_PENDING 8
+
+#define PRESENT_LATENCY_REPORT_INTERVAL 300
+
+// VK_PRESENT_MODE_IMMEDIATE_KHR through VK_PRESENT_MODE_FIFO_RELAXED_KHR.
+#define PRESENT_LATENCY_MODES 4
+
+// Longest single wait of the waiter thread, so it notices resets and
+// shutdown.
+#define PRESENT_LATENCY_WAIT_TIMEOUT_NS 100000000ull
+
+// Longest wait for a present while holding the swapchain, which also holds
+// off the next vkQueuePresentKHR.
+#define PRESENT_LATENCY_PRESENT_SLICE_NS 1000000ull
+
+// Time from the start of a frame on the CPU until it reached the display,
+// averaged per present mode. A waiter thread blocks on each tracked frame in
+// turn and timestamps it when the wait returns. With VK_KHR_present_wait the
+// end is when the present with the frame's id completed; without it, when
+// the frame's GPU work retired on the frame timeline, which leaves out the
+// time spent queued in the presentation engine.
+//
+// vkWaitForPresentKHR needs the swapchain externally synchronized, so presents
+// go through presentLatencyPresent and the waiter only waits for a present in
+// short slices, after the frame's GPU work has retired.
+typedef struct {
+  PFN_vkWaitForPresentKHR waitForPresent;
+  VkDevice device;
+  VkSemaphore timeline;
+  VkSwapchainKHR swapchains[PRESENT_LATENCY_MAX_PENDING];
+  uint64_t ids[PRESENT_LATENCY_MAX_PENDING];
+  uint64_t startNs[PRESENT_LATENCY_MAX_PENDING];
+  VkPresentModeKHR modes[PRESENT_LATENCY_MAX_PENDING];
+  uint32_t head;
+  uint32_t count;
+  // bumped by presentLatencyReset so the waiter drops what it was timing
+  uint32_t generation;
+  uint64_t sumNs[PRESENT_LATENCY_MODES];
+  uint64_t maxNs[PRESENT_LATENCY_MODES];
+  uint64_t samples[PRESENT_LATENCY_MODES];
+  uint32_t reportSamples;
+  thrd_t thread;
+  // guards the queue and the stats
+  mtx_t lock;
+  cnd_t work;
+  // held around every use of a swapchain on either thread
+  mtx_t swapchainLock;
+  atomic_bool presenting;
+  bool stopping;
+} PresentLatency;
+
+const char *presentModeName(VkPresentModeKHR mode);
+
+// presentWait is whether VK_KHR_present_id and VK_KHR_present_wait were
+// enabled on device. Present ids are values signaled on timeline.
+void presentLatencyInit(PresentLatency *latency, VkDevice device,
+                        VkSemaphore timeline, bool presentWait);
+
+// vkQueuePresentKHR, serialized with the waiter's use of the swapchain.
+VkResult presentLatencyPresent(PresentLatency *latency, VkQueue queue,
+                               const VkPresentInfoKHR *presentInfo);
+
+// Tracks the frame started at startNs whose present to swapchain carries id,
+// which is also the value it signals on the frame timeline.
+void presentLatencyTrack(PresentLatency *latency, VkSwapchainKHR swapchain,
+                         uint64_t id, uint64_t startNs, VkPresentModeKHR mode);
+
+// Forgets every tracked frame. Must be called before the swapchain they were
+// presented to is retired or destroyed; returns once the waiter no longer
+// uses it.
+void presentLatencyReset(PresentLatency *latency);
+
+// Stops the waiter thread.
+void presentLatencyDestroy(PresentLatency *latency);
+
+void presentLatencyReport(PresentLatency *latency);
+
+#endif // !PRESENT_LATENCY_H
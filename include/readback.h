@@ -0,0 +1,94 @@
+#ifndef READBACK_H
+#define READBACK_H
+
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <threads.h>
+
+// Host buffers frames are copied into. Deeper than the frames in flight so
+// encoding can lag the GPU by a few frames before frames are dropped.
+#define READBACK_RING_DEPTH 8
+
+#define READBACK_WORKERS 4
+
+// Frame rate written to Y4M headers.
+#define READBACK_Y4M_FPS 60
+
+// Chosen from the capture path's extension: .y4m and .png, anything else is
+// headerless rgb24.
+typedef enum {
+  READBACK_RAW,
+  READBACK_Y4M,
+  READBACK_PNG,
+} ReadbackFormat;
+
+typedef enum {
+  READBACK_FREE,
+  READBACK_COPYING,
+  READBACK_ENCODING,
+} ReadbackState;
+
+typedef struct {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  const uint8_t *mapped;
+  ReadbackState state;
+  // timeline value of the frame that copied into the buffer
+  uint64_t value;
+  uint64_t frame;
+  uint8_t *rows;
+  uint8_t *encoded;
+} ReadbackEntry;
+
+// Continuous capture of BGRA8 frames without stalling the frame loop. Each
+// captured frame is copied into the next free ring buffer at the end of its
+// command buffer; readbackPoll checks the frame timeline without waiting and
+// hands finished copies to a worker pool that converts and writes them. Raw
+// and Y4M frames are appended to one stream in frame order, PNG frames go to
+// numbered files. A frame is dropped rather than waited for when the whole
+// ring is busy.
+typedef struct {
+  ReadbackEntry ring[READBACK_RING_DEPTH];
+  uint32_t next;
+  uint32_t oldest;
+  uint32_t copying;
+  bool coherent;
+  uint32_t width;
+  uint32_t height;
+  ReadbackFormat format;
+  const char *path;
+  FILE *file;
+  uint64_t frames;
+  uint64_t written;
+  uint64_t dropped;
+  uint64_t encodeNs;
+  thrd_t workers[READBACK_WORKERS];
+  mtx_t lock;
+  cnd_t work;
+  cnd_t turn;
+  uint32_t queue[READBACK_RING_DEPTH];
+  uint32_t queueHead;
+  uint32_t queueCount;
+  bool stopping;
+} Readback;
+
+void readbackInit(Readback *rb, VkDevice device,
+                  VkPhysicalDevice physicalDevice, VkExtent2D extent,
+                  const char *path);
+
+// Records a copy of image, in TRANSFER_SRC_OPTIMAL, into a free ring buffer.
+// value is the timeline value the frame's submit signals. Returns false when
+// the frame was dropped.
+bool readbackRecord(Readback *rb, VkCommandBuffer cmd, VkImage image,
+                    uint64_t value);
+
+// Queues every copy whose frame has passed on timeline for encoding. Never
+// blocks.
+void readbackPoll(Readback *rb, VkDevice device, VkSemaphore timeline);
+
+// The device must be idle. Writes out the remaining frames first.
+void readbackDestroy(Readback *rb, VkDevice device, VkSemaphore timeline);
+
+#endif // !READBACK_H
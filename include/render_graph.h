@@ -0,0 +1,174 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include "barrier.h"
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define RG_MAX_PASSES 32
+#define RG_MAX_RESOURCES 32
+#define RG_MAX_PASS_ACCESSES 8
+#define RG_MAX_LAYERS 4
+
+// How a pass touches an image. Layout, stages and access masks are derived
+// from it, so passes never spell out barriers themselves.
+typedef enum {
+  RG_USAGE_COLOR_ATTACHMENT,
+  RG_USAGE_DEPTH_ATTACHMENT,
+  RG_USAGE_DEPTH_READ,
+  RG_USAGE_SAMPLED,
+  RG_USAGE_STORAGE_READ,
+  RG_USAGE_STORAGE_WRITE,
+  RG_USAGE_TRANSFER_SRC,
+  RG_USAGE_TRANSFER_DST,
+  RG_USAGE_PRESENT,
+} RgUsage;
+
+typedef struct {
+  uint32_t resource;
+  RgUsage usage;
+  bool read;
+  bool write;
+} RgAccess;
+
+typedef struct {
+  uint32_t resource;
+  VkImageLayout oldLayout;
+  VkImageLayout newLayout;
+  VkPipelineStageFlags2 srcStage;
+  VkPipelineStageFlags2 dstStage;
+  VkAccessFlags2 srcAccess;
+  VkAccessFlags2 dstAccess;
+} RgBarrier;
+
+typedef struct RenderGraph RenderGraph;
+
+typedef void (*RgExecuteFn)(VkCommandBuffer cmd, const RenderGraph *graph,
+                            void *userData);
+
+typedef struct {
+  const char *name;
+  bool compute;
+  bool sideEffects;
+  RgExecuteFn execute;
+  void *userData;
+  RgAccess accesses[RG_MAX_PASS_ACCESSES];
+  uint32_t accessCount;
+  bool culled;
+  RgBarrier barriers[RG_MAX_PASS_ACCESSES];
+  uint32_t barrierCount;
+} RgPass;
+
+typedef struct {
+  const char *name;
+  VkFormat format;
+  VkExtent2D extent;
+  VkSampleCountFlagBits samples;
+  VkImageAspectFlags aspect;
+  VkImageUsageFlags usage;
+  uint32_t layers;
+  bool imported;
+  VkImageLayout importLayout;
+  VkPipelineStageFlags2 importStage;
+  bool output;
+  RgUsage outputUsage;
+  VkImage image;
+  VkImageView view;
+  // single layers of a layered image, for passes that draw one at a time
+  VkImageView layerViews[RG_MAX_LAYERS];
+  int32_t firstPass;
+  int32_t lastPass;
+  RgUsage lastUsage;
+  bool lastCompute;
+  int32_t slot;
+  int32_t aliasPrev;
+  VkDeviceSize size;
+} RgResource;
+
+// Memory shared by transient images whose lifetimes do not overlap.
+typedef struct {
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  uint32_t typeBits;
+  int32_t lastPass;
+  int32_t lastResource;
+  int32_t firstResource;
+} RgMemorySlot;
+
+struct RenderGraph {
+  RgPass passes[RG_MAX_PASSES];
+  uint32_t passCount;
+  RgResource resources[RG_MAX_RESOURCES];
+  uint32_t resourceCount;
+  RgMemorySlot slots[RG_MAX_RESOURCES];
+  uint32_t slotCount;
+  RgBarrier finalBarriers[RG_MAX_RESOURCES];
+  uint32_t finalBarrierCount;
+  bool compiled;
+};
+
+void rgInit(RenderGraph *graph);
+
+// Transient image owned and allocated by the graph.
+uint32_t rgCreateImage(RenderGraph *graph, const char *name, VkFormat format,
+                       VkExtent2D extent, VkSampleCountFlagBits samples,
+                       VkImageAspectFlags aspect);
+
+// Makes a transient image an array of layers, viewed as a 2D array by
+// rgView. Barriers always cover every layer.
+void rgSetLayers(RenderGraph *graph, uint32_t resource, uint32_t layers);
+
+// Image owned elsewhere, bound with rgSetImage before every execute. Each
+// frame it starts in layout, last used at stage.
+uint32_t rgImportImage(RenderGraph *graph, const char *name, VkFormat format,
+                       VkExtent2D extent, VkImageAspectFlags aspect,
+                       VkImageLayout layout, VkPipelineStageFlags2 stage);
+
+void rgSetImage(RenderGraph *graph, uint32_t resource, VkImage image,
+                VkImageView view);
+
+// Marks a resource as consumed outside the graph; passes contributing to it
+// survive culling and it ends the frame in the layout for usage.
+void rgSetOutput(RenderGraph *graph, uint32_t resource, RgUsage usage);
+
+// compute only selects the shader stages barriers use; every pass records
+// into the same command buffer on the graphics queue.
+uint32_t rgAddPass(RenderGraph *graph, const char *name, bool compute,
+                   RgExecuteFn execute, void *userData);
+
+// Keeps the pass alive even if none of its image writes are consumed, e.g.
+// passes that only write buffers.
+void rgSetSideEffects(RenderGraph *graph, uint32_t pass);
+
+void rgRead(RenderGraph *graph, uint32_t pass, uint32_t resource,
+            RgUsage usage);
+
+void rgWrite(RenderGraph *graph, uint32_t pass, uint32_t resource,
+             RgUsage usage);
+
+// Culls passes, computes lifetimes, aliases and allocates transient images
+// and plans the barriers for every pass.
+void rgCompile(RenderGraph *graph, VkDevice device,
+               VkPhysicalDevice physicalDevice);
+
+void rgExecute(const RenderGraph *graph, VkCommandBuffer cmd,
+               BarrierBatch *barriers);
+
+VkImageView rgView(const RenderGraph *graph, uint32_t resource);
+
+// One layer of a layered image; the image's only view otherwise.
+VkImageView rgLayerView(const RenderGraph *graph, uint32_t resource,
+                        uint32_t layer);
+
+VkImage rgImage(const RenderGraph *graph, uint32_t resource);
+
+// Device memory backing the transient images, after aliasing.
+VkDeviceSize rgMemorySize(const RenderGraph *graph);
+
+void rgDump(const RenderGraph *graph, FILE *out);
+
+void rgDestroy(RenderGraph *graph, VkDevice device);
+
+#endif // !RENDER_GRAPH_H
@@ -0,0 +1,44 @@
+#ifndef SHADER_WATCH_H
+#define SHADER_WATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+#define SHADER_WATCH_MAX_PENDING 32
+#define SHADER_WATCH_NAME_SIZE 64
+
+// Wait this long after a change before compiling, so editors that write a
+// file in several steps trigger one compile.
+#define SHADER_WATCH_SETTLE_MS 100
+
+// Watches a shader source directory with inotify and recompiles changed
+// shaders to SPIR-V on a background thread with glslc, or the compiler
+// named by $GLSLC. Output goes to a temporary file that is renamed over the
+// old .spv only on success, so a failed compile leaves the last good binary
+// in place.
+typedef struct {
+  const char *sourceDir;
+  const char *outputDir;
+  const char *compiler;
+  int fd;
+  thrd_t thread;
+  mtx_t lock;
+  bool stopping;
+  // file names compiled successfully and not yet polled
+  char compiled[SHADER_WATCH_MAX_PENDING][SHADER_WATCH_NAME_SIZE];
+  uint32_t compiledCount;
+} ShaderWatcher;
+
+// Returns false where inotify is unavailable.
+bool shaderWatchInit(ShaderWatcher *watcher, const char *sourceDir,
+                     const char *outputDir);
+
+// Copies the name of a shader whose SPIR-V was rebuilt, e.g. "tri.frag",
+// into name. Returns false once there are none. Never blocks.
+bool shaderWatchPoll(ShaderWatcher *watcher, char *name, size_t size);
+
+void shaderWatchDestroy(ShaderWatcher *watcher);
+
+#endif // !SHADER_WATCH_H
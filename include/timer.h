@@ -0,0 +1,10 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// Monotonic high-resolution timestamp in nanoseconds. Only differences between
+// two values are meaningful.
+uint64_t timerNowNs();
+
+#endif // !TIMER_H
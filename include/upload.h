@@ -0,0 +1,68 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include "device.h"
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+
+typedef struct {
+  VkCommandBuffer cmd;
+  VkBuffer staging;
+  VkDeviceMemory stagingMemory;
+  uint64_t value;
+} PendingUpload;
+
+// Asynchronous uploads on the transfer queue. Each submit signals a timeline
+// value; resources released to the graphics family are acquired by the next
+// graphics command buffer passed to uploaderFlushAcquires, whose submit has to
+// wait for the returned value. Staging memory is freed once its value retires.
+typedef struct {
+  QueueFamilies families;
+  VkQueue queue;
+  VkCommandPool pool;
+  VkSemaphore timeline;
+  uint64_t submitted;
+  uint64_t acquireValue;
+  VkPipelineStageFlags2 acquireStages;
+  VkBufferMemoryBarrier2 *bufferAcquires;
+  uint32_t bufferAcquireCount;
+  uint32_t bufferAcquireCap;
+  VkImageMemoryBarrier2 *imageAcquires;
+  uint32_t imageAcquireCount;
+  uint32_t imageAcquireCap;
+  PendingUpload *pending;
+  uint32_t pendingCount;
+  uint32_t pendingCap;
+} Uploader;
+
+void uploaderInit(Uploader *uploader, VkDevice device,
+                  const QueueFamilies *families, VkQueue transferQueue);
+
+VkCommandBuffer uploaderBegin(Uploader *uploader, VkDevice device);
+
+// Hands buffer over to the graphics family once the upload completes.
+void uploaderReleaseBuffer(Uploader *uploader, VkCommandBuffer cmd,
+                           VkBuffer buffer, VkAccessFlags2 dstAccess,
+                           VkPipelineStageFlags2 dstStage);
+
+void uploaderReleaseImage(Uploader *uploader, VkCommandBuffer cmd,
+                          VkImage image, VkImageSubresourceRange range,
+                          VkImageLayout layout, VkAccessFlags2 dstAccess,
+                          VkPipelineStageFlags2 dstStage);
+
+// Submits cmd and takes ownership of the staging buffer.
+void uploaderSubmit(Uploader *uploader, VkCommandBuffer cmd, VkBuffer staging,
+                    VkDeviceMemory stagingMemory);
+
+// Records outstanding acquire barriers into a graphics command buffer.
+// Returns the timeline value the submit must wait for (0 if none) and the
+// stages to wait at.
+uint64_t uploaderFlushAcquires(Uploader *uploader, VkCommandBuffer cmd,
+                               VkPipelineStageFlags2 *waitStages);
+
+// Frees staging buffers and command buffers of retired uploads.
+void uploaderCollect(Uploader *uploader, VkDevice device);
+
+void uploaderDestroy(Uploader *uploader, VkDevice device);
+
+#endif // !UPLOAD_H
@@ -0,0 +1,36 @@
+#version 450
+#extension GL_EXT_multiview : require
+
+// Must match the position math in tri.vert exactly, so the main pass can
+// test depth with EQUAL against what this pass wrote.
+invariant gl_Position;
+
+const uint MAX_VIEWS = 4;
+
+layout(binding = 0) uniform Views {
+  mat4 viewProj[MAX_VIEWS];
+} views;
+
+layout(push_constant) uniform Draw {
+  uint viewBase;
+} draw;
+
+struct InstanceData {
+  mat4 model;
+  vec4 sphere;
+  uint indexCount;
+  uint firstIndex;
+  int vertexOffset;
+  uint materialIndex;
+};
+
+layout(std430, binding = 2) readonly buffer Objects {
+  InstanceData objects[];
+};
+
+layout(location = 0) in vec3 inPosition;
+
+void main() {
+  vec4 world = objects[gl_InstanceIndex].model * vec4(inPosition, 1.0);
+  gl_Position = views.viewProj[draw.viewBase + gl_ViewIndex] * world;
+}
@@ -1,12 +1,97 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout(binding = 1) uniform sampler2D texSampler;
+// Set per pipeline variant; branches on them fold away when the driver
+// compiles the variant. Matches SceneSpecialization in src/main.c.
+layout(constant_id = 0) const bool TEXTURED = true;
+layout(constant_id = 1) const bool ALPHA_TEST = false;
+
+// Matches BINDLESS_SAMPLER_SHIFT in include/bindless.h.
+const uint SAMPLER_SHIFT = 24;
+const uint TEXTURE_MASK = (1u << SAMPLER_SHIFT) - 1u;
+
+const float ALPHA_CUTOFF = 0.5;
+
+// MULTIVIEW_MAX_VIEWS and CLUSTER_MAX_LIGHTS in main.c
+const uint MAX_VIEWS = 4;
+const uint MAX_CLUSTER_LIGHTS = 127;
+
+struct Light {
+  vec4 sphere;
+  vec4 color;
+};
+
+// filled by shaders/light_bin.comp earlier in the frame
+layout(binding = 3) uniform Clusters {
+  mat4 view[MAX_VIEWS];
+  mat4 invProj;
+  uvec4 grid;
+  vec4 slices;
+  float ambient;
+} clusters;
+
+layout(std430, binding = 4) readonly buffer Lights {
+  Light lights[];
+};
+
+layout(std430, binding = 5) readonly buffer ClusterLights {
+  uint clusterLights[];
+};
+
+// the bindless table: partially bound, indexed by material
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler samplers[];
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragMaterial;
+layout(location = 3) in vec3 fragPosition;
+layout(location = 4) flat in uint fragView;
 
 layout(location = 0) out vec4 outColor;
 
+// Sums the lights binned into this pixel's cluster, so the cost follows
+// the lights reaching the pixel rather than the lights in the scene.
+vec3 lighting(vec3 normal) {
+  uvec3 grid = clusters.grid.xyz;
+  vec3 eye = (clusters.view[fragView] * vec4(fragPosition, 1.0)).xyz;
+  vec2 screen = gl_FragCoord.xy / clusters.slices.xy;
+  uvec2 tile = min(uvec2(screen * vec2(grid.xy)), grid.xy - 1u);
+  float near = clusters.slices.z;
+  float slice = log(-eye.z / near) / log(clusters.slices.w / near);
+  uint z = uint(clamp(slice * float(grid.z), 0.0, float(grid.z - 1u)));
+  uint cluster = tile.x + grid.x * (tile.y + grid.y * z);
+  uint base = (fragView * grid.x * grid.y * grid.z + cluster) *
+              (MAX_CLUSTER_LIGHTS + 1);
+  vec3 total = vec3(clusters.ambient);
+  uint count = clusterLights[base];
+  for (uint i = 0; i < count; i++) {
+    Light light = lights[clusterLights[base + 1 + i]];
+    vec3 toLight = light.sphere.xyz - fragPosition;
+    float dist = length(toLight);
+    float falloff = clamp(1.0 - dist / light.sphere.w, 0.0, 1.0);
+    total += light.color.rgb * falloff * falloff *
+             abs(dot(normal, toLight / max(dist, 1e-4)));
+  }
+  return total;
+}
+
 void main() {
-  outColor = texture(texSampler, fragTexCoord);
+  // the models carry no normals, so faces are lit from either side; taken
+  // before any discard, while the derivatives are still defined
+  vec3 normal = normalize(cross(dFdx(fragPosition), dFdy(fragPosition)));
+  if (!TEXTURED) {
+    outColor = vec4(vec3(0.8) * lighting(normal), 1.0);
+    return;
+  }
+  uint textureIndex = fragMaterial & TEXTURE_MASK;
+  uint samplerIndex = fragMaterial >> SAMPLER_SHIFT;
+  // neighbouring pixels of one draw may belong to different instances
+  outColor = texture(sampler2D(textures[nonuniformEXT(textureIndex)],
+                               samplers[nonuniformEXT(samplerIndex)]),
+                     fragTexCoord);
+  if (ALPHA_TEST && outColor.a < ALPHA_CUTOFF) {
+    discard;
+  }
+  outColor.rgb *= lighting(normal);
 }
@@ -1,10 +1,35 @@
 #version 450
+#extension GL_EXT_multiview : require
 
-layout(binding = 0) uniform UniformBufferObject {
+// bit-identical to depth.vert for the EQUAL test after a depth prepass
+invariant gl_Position;
+
+// MULTIVIEW_MAX_VIEWS in main.c
+const uint MAX_VIEWS = 4;
+
+// proj * view * model of every view, premultiplied on the CPU once per frame
+layout(binding = 0) uniform Views {
+  mat4 viewProj[MAX_VIEWS];
+} views;
+
+// a multiview pass draws all views at once from viewBase 0; passes drawing
+// one view at a time select it here
+layout(push_constant) uniform Draw {
+  uint viewBase;
+} draw;
+
+struct InstanceData {
   mat4 model;
-  mat4 view;
-  mat4 proj;
-} ubo;
+  vec4 sphere;
+  uint indexCount;
+  uint firstIndex;
+  int vertexOffset;
+  uint materialIndex;
+};
+
+layout(std430, binding = 2) readonly buffer Objects {
+  InstanceData objects[];
+};
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 colors;
@@ -12,9 +37,17 @@ layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragMaterial;
+layout(location = 3) out vec3 fragPosition;
+layout(location = 4) flat out uint fragView;
 
 void main() {
-  gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+  vec4 world = objects[gl_InstanceIndex].model * vec4(inPosition, 1.0);
+  gl_Position = views.viewProj[draw.viewBase + gl_ViewIndex] * world;
   fragColor = colors;
   fragTexCoord = inTexCoord;
+  fragMaterial = objects[gl_InstanceIndex].materialIndex;
+  // scene space, where the lights are placed
+  fragPosition = world.xyz;
+  fragView = draw.viewBase + gl_ViewIndex;
 }
@@ -0,0 +1,221 @@
+#include "barrier.h"
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void trackImage(TrackedImage *tracked, VkImage image, VkImageAspectFlags aspect,
+                uint32_t mipLevels, uint32_t layers) {
+  tracked->image = image;
+  tracked->aspect = aspect;
+  tracked->mipLevels = mipLevels;
+  tracked->layers = layers;
+  tracked->states = calloc(mipLevels * layers, sizeof(SubresourceState));
+  if (tracked->states == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  for (uint32_t i = 0; i < mipLevels * layers; i++) {
+    tracked->states[i].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  }
+}
+
+void untrackImage(TrackedImage *tracked) {
+  free(tracked->states);
+  tracked->states = NULL;
+}
+
+void setImageState(TrackedImage *tracked, uint32_t baseMip, uint32_t levelCount,
+                   VkImageLayout layout, VkPipelineStageFlags2 stage,
+                   VkAccessFlags2 access) {
+  for (uint32_t layer = 0; layer < tracked->layers; layer++) {
+    for (uint32_t mip = baseMip; mip < baseMip + levelCount; mip++) {
+      SubresourceState *state =
+          &tracked->states[layer * tracked->mipLevels + mip];
+      // a write must be waited for; a read is already visible to itself
+      bool write = access & BARRIER_WRITE_ACCESS_MASK;
+      state->layout = layout;
+      state->writeStage = stage;
+      state->writeAccess = access & BARRIER_WRITE_ACCESS_MASK;
+      state->readStage = write ? VK_PIPELINE_STAGE_2_NONE : stage;
+      state->readAccess = write ? VK_ACCESS_2_NONE : access;
+      state->pendingBatch = NULL;
+    }
+  }
+}
+
+static VkImageMemoryBarrier2 *pushBarrier(BarrierBatch *batch) {
+  if (batch->count == batch->cap) {
+    batch->cap = batch->cap == 0 ? 16 : batch->cap * 2;
+    VkImageMemoryBarrier2 *resized =
+        realloc(batch->barriers, sizeof(VkImageMemoryBarrier2) * batch->cap);
+    if (resized == NULL) {
+      printf("realloc failed\n");
+      exit(1);
+    }
+    batch->barriers = resized;
+  }
+  return &batch->barriers[batch->count++];
+}
+
+// Updates state for the commands after barrier. A write or a layout
+// transition is what later uses wait for; a plain read barrier only widens
+// the scope that already sees the last write.
+static void settle(SubresourceState *state,
+                   const VkImageMemoryBarrier2 *barrier) {
+  state->layout = barrier->newLayout;
+  if (barrier->dstAccessMask & BARRIER_WRITE_ACCESS_MASK) {
+    state->writeStage = barrier->dstStageMask;
+    state->writeAccess = barrier->dstAccessMask & BARRIER_WRITE_ACCESS_MASK;
+    state->readStage = VK_PIPELINE_STAGE_2_NONE;
+    state->readAccess = VK_ACCESS_2_NONE;
+  } else if (barrier->oldLayout != barrier->newLayout) {
+    state->writeStage = barrier->dstStageMask;
+    state->writeAccess = VK_ACCESS_2_NONE;
+    state->readStage = barrier->dstStageMask;
+    state->readAccess = barrier->dstAccessMask;
+  } else {
+    state->readStage |= barrier->dstStageMask;
+    state->readAccess |= barrier->dstAccessMask;
+  }
+}
+
+void barrierImage(BarrierBatch *batch, TrackedImage *tracked, uint32_t baseMip,
+                  uint32_t levelCount, VkImageLayout layout,
+                  VkPipelineStageFlags2 stage, VkAccessFlags2 access) {
+  for (uint32_t layer = 0; layer < tracked->layers; layer++) {
+    for (uint32_t mip = baseMip; mip < baseMip + levelCount; mip++) {
+      SubresourceState *state =
+          &tracked->states[layer * tracked->mipLevels + mip];
+      bool write = access & BARRIER_WRITE_ACCESS_MASK;
+      if (state->pendingBatch == batch &&
+          state->pendingGeneration == batch->generation) {
+        // nothing was recorded since the pending transition, widen it to
+        // cover this use as well
+        VkImageMemoryBarrier2 *pending = &batch->barriers[state->pendingIndex];
+        if (write || layout != state->layout) {
+          pending->srcStageMask |= state->readStage;
+        }
+        pending->newLayout = layout;
+        pending->dstStageMask |= stage;
+        pending->dstAccessMask |= access;
+        settle(state, pending);
+        continue;
+      }
+      if (state->layout == layout && !write) {
+        // no write outstanding, or an earlier barrier from the last write
+        // already covers this stage and access
+        if (state->writeStage == VK_PIPELINE_STAGE_2_NONE ||
+            ((stage & ~state->readStage) == 0 &&
+             (access & ~state->readAccess) == 0)) {
+          state->readStage |= stage;
+          state->readAccess |= access;
+          continue;
+        }
+      } else if (state->layout == layout &&
+                 state->writeStage == VK_PIPELINE_STAGE_2_NONE &&
+                 state->readStage == VK_PIPELINE_STAGE_2_NONE) {
+        // first write with nothing before it
+        state->writeStage = stage;
+        state->writeAccess = access & BARRIER_WRITE_ACCESS_MASK;
+        continue;
+      }
+      VkImageMemoryBarrier2 *barrier = pushBarrier(batch);
+      // writes also wait for the reads since the last write
+      *barrier = (VkImageMemoryBarrier2){
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+          .srcStageMask =
+              state->writeStage | (write || state->layout != layout
+                                       ? state->readStage
+                                       : VK_PIPELINE_STAGE_2_NONE),
+          .srcAccessMask = state->writeAccess,
+          .dstStageMask = stage,
+          .dstAccessMask = access,
+          .oldLayout = state->layout,
+          .newLayout = layout,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = tracked->image,
+          .subresourceRange =
+              {
+                  .aspectMask = tracked->aspect,
+                  .baseMipLevel = mip,
+                  .levelCount = 1,
+                  .baseArrayLayer = layer,
+                  .layerCount = 1,
+              },
+      };
+      settle(state, barrier);
+      state->pendingBatch = batch;
+      state->pendingGeneration = batch->generation;
+      state->pendingIndex = batch->count - 1;
+    }
+  }
+}
+
+void barrierAdd(BarrierBatch *batch, const VkImageMemoryBarrier2 *barrier) {
+  *pushBarrier(batch) = *barrier;
+}
+
+static int canMerge(const VkImageMemoryBarrier2 *a,
+                    const VkImageMemoryBarrier2 *b) {
+  return a->image == b->image && a->oldLayout == b->oldLayout &&
+         a->newLayout == b->newLayout && a->srcStageMask == b->srcStageMask &&
+         a->srcAccessMask == b->srcAccessMask &&
+         a->dstStageMask == b->dstStageMask &&
+         a->dstAccessMask == b->dstAccessMask &&
+         a->subresourceRange.aspectMask == b->subresourceRange.aspectMask &&
+         a->subresourceRange.baseArrayLayer ==
+             b->subresourceRange.baseArrayLayer &&
+         a->subresourceRange.baseMipLevel + a->subresourceRange.levelCount ==
+             b->subresourceRange.baseMipLevel;
+}
+
+void barrierFlush(BarrierBatch *batch, VkCommandBuffer cmd) {
+  if (batch->count == 0) {
+    return;
+  }
+  // adjacent mips with identical transitions collapse into one range
+  uint32_t merged = 0;
+  for (uint32_t i = 0; i < batch->count; i++) {
+    if (merged > 0 &&
+        canMerge(&batch->barriers[merged - 1], &batch->barriers[i])) {
+      batch->barriers[merged - 1].subresourceRange.levelCount +=
+          batch->barriers[i].subresourceRange.levelCount;
+      continue;
+    }
+    batch->barriers[merged++] = batch->barriers[i];
+  }
+  VkDependencyInfo dependencyInfo = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = merged,
+      .pImageMemoryBarriers = batch->barriers,
+  };
+  vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+  batch->frameBarriers += merged;
+  batch->frameFlushes++;
+  batch->count = 0;
+  batch->generation++;
+}
+
+uint32_t barrierEndFrame(BarrierBatch *batch) {
+  uint32_t issued = batch->frameBarriers;
+  batch->reportFrames++;
+  batch->reportBarriers += issued;
+  if (batch->reportFrames == BARRIER_REPORT_INTERVAL) {
+    printf("barriers: %u last frame in %u flushes, avg %.1f per frame\n",
+           issued, batch->frameFlushes,
+           (double)batch->reportBarriers / batch->reportFrames);
+    batch->reportFrames = 0;
+    batch->reportBarriers = 0;
+  }
+  batch->frameBarriers = 0;
+  batch->frameFlushes = 0;
+  return issued;
+}
+
+void barrierBatchDestroy(BarrierBatch *batch) {
+  free(batch->barriers);
+  *batch = (BarrierBatch){0};
+}
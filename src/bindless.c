@@ -0,0 +1,166 @@
+#include "bindless.h"
+#include "frame_pacer.h"
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BINDLESS_BINDING_FLAGS                                                 \
+  (VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |                                 \
+   VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |                               \
+   VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT)
+
+void bindlessInit(BindlessTable *table, VkDevice device) {
+  *table = (BindlessTable){0};
+  VkDescriptorSetLayoutBinding bindings[] = {
+      {
+          .binding = 0,
+          .descriptorCount = BINDLESS_MAX_TEXTURES,
+          .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+          .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+      },
+      {
+          .binding = 1,
+          .descriptorCount = BINDLESS_MAX_SAMPLERS,
+          .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+          .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+      },
+  };
+  VkDescriptorBindingFlags flags[] = {BINDLESS_BINDING_FLAGS,
+                                      BINDLESS_BINDING_FLAGS};
+  VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+      .bindingCount = 2,
+      .pBindingFlags = flags,
+  };
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .pNext = &flagsInfo,
+      .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+      .bindingCount = 2,
+      .pBindings = bindings,
+  };
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, NULL, &table->layout) !=
+      VK_SUCCESS) {
+    printf("failed to create bindless descriptor set layout\n");
+    exit(1);
+  }
+  VkDescriptorPoolSize poolSizes[] = {
+      {
+          .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+          .descriptorCount = BINDLESS_MAX_TEXTURES,
+      },
+      {
+          .type = VK_DESCRIPTOR_TYPE_SAMPLER,
+          .descriptorCount = BINDLESS_MAX_SAMPLERS,
+      },
+  };
+  VkDescriptorPoolCreateInfo poolInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+      .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+      .poolSizeCount = 2,
+      .pPoolSizes = poolSizes,
+      .maxSets = 1,
+  };
+  if (vkCreateDescriptorPool(device, &poolInfo, NULL, &table->pool) !=
+      VK_SUCCESS) {
+    printf("failed to create bindless descriptor pool\n");
+    exit(1);
+  }
+  VkDescriptorSetAllocateInfo allocInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = table->pool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &table->layout,
+  };
+  if (vkAllocateDescriptorSets(device, &allocInfo, &table->set) !=
+      VK_SUCCESS) {
+    printf("failed to allocate bindless descriptor set\n");
+    exit(1);
+  }
+}
+
+static void writeSlot(BindlessTable *table, VkDevice device, uint32_t binding,
+                      uint32_t index, VkDescriptorType type,
+                      const VkDescriptorImageInfo *imageInfo) {
+  VkWriteDescriptorSet write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = table->set,
+      .dstBinding = binding,
+      .dstArrayElement = index,
+      .descriptorType = type,
+      .descriptorCount = 1,
+      .pImageInfo = imageInfo,
+  };
+  vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+}
+
+uint32_t bindlessAddTexture(BindlessTable *table, VkDevice device,
+                            VkImageView view, VkImageLayout layout) {
+  uint32_t index;
+  if (table->freeTextureCount > 0) {
+    index = table->freeTextures[--table->freeTextureCount];
+  } else if (table->textureCount < BINDLESS_MAX_TEXTURES) {
+    index = table->textureCount++;
+  } else {
+    printf("bindless: out of texture slots\n");
+    exit(1);
+  }
+  VkDescriptorImageInfo info = {
+      .imageView = view,
+      .imageLayout = layout,
+  };
+  writeSlot(table, device, 0, index, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, &info);
+  return index;
+}
+
+uint32_t bindlessAddSampler(BindlessTable *table, VkDevice device,
+                            VkSampler sampler) {
+  uint32_t index;
+  if (table->freeSamplerCount > 0) {
+    index = table->freeSamplers[--table->freeSamplerCount];
+  } else if (table->samplerCount < BINDLESS_MAX_SAMPLERS) {
+    index = table->samplerCount++;
+  } else {
+    printf("bindless: out of sampler slots\n");
+    exit(1);
+  }
+  VkDescriptorImageInfo info = {
+      .sampler = sampler,
+  };
+  writeSlot(table, device, 1, index, VK_DESCRIPTOR_TYPE_SAMPLER, &info);
+  return index;
+}
+
+void bindlessReleaseTexture(BindlessTable *table, uint32_t index,
+                            uint32_t slot) {
+  table->retiredTextures[slot][table->retiredTextureCount[slot]++] = index;
+}
+
+void bindlessReleaseSampler(BindlessTable *table, uint32_t index,
+                            uint32_t slot) {
+  table->retiredSamplers[slot][table->retiredSamplerCount[slot]++] = index;
+}
+
+void bindlessCollect(BindlessTable *table, uint32_t slot) {
+  for (uint32_t i = 0; i < table->retiredTextureCount[slot]; i++) {
+    table->freeTextures[table->freeTextureCount++] =
+        table->retiredTextures[slot][i];
+  }
+  table->retiredTextureCount[slot] = 0;
+  for (uint32_t i = 0; i < table->retiredSamplerCount[slot]; i++) {
+    table->freeSamplers[table->freeSamplerCount++] =
+        table->retiredSamplers[slot][i];
+  }
+  table->retiredSamplerCount[slot] = 0;
+}
+
+uint32_t bindlessMaterial(uint32_t texture, uint32_t sampler) {
+  return (sampler << BINDLESS_SAMPLER_SHIFT) |
+         (texture & BINDLESS_TEXTURE_MASK);
+}
+
+void bindlessDestroy(BindlessTable *table, VkDevice device) {
+  vkDestroyDescriptorPool(device, table->pool, NULL);
+  vkDestroyDescriptorSetLayout(device, table->layout, NULL);
+}
@@ -0,0 +1,621 @@
+#include "bvh.h"
+#include "cglm/box.h"
+#include "cglm/cam.h"
+#include "cglm/frustum.h"
+#include "cglm/mat4.h"
+#include "cglm/ray.h"
+#include "cglm/types.h"
+#include "cglm/vec3.h"
+#include "timer.h"
+#include <float.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#define BVH_BENCH_RAYS 10000
+
+#define BVH_BENCH_CHECKED_RAYS 100
+
+_Static_assert(sizeof(BvhNode) == 32, "BvhNode must stay 32 bytes");
+
+typedef struct {
+  vec3 min;
+  vec3 max;
+  uint32_t count;
+} BvhBin;
+
+typedef struct {
+  Bvh *bvh;
+  vec3 *boxes;
+  vec3 *centroids;
+  atomic_uint nodeCount;
+  // subtrees deferred to worker threads by the serial top of the build
+  uint32_t *tasks;
+  uint32_t taskCount;
+  atomic_uint nextTask;
+} BvhBuild;
+
+static void emptyBox(vec3 min, vec3 max) {
+  glm_vec3_broadcast(FLT_MAX, min);
+  glm_vec3_broadcast(-FLT_MAX, max);
+}
+
+static void growBox(vec3 min, vec3 max, vec3 otherMin, vec3 otherMax) {
+  glm_vec3_minv(min, otherMin, min);
+  glm_vec3_maxv(max, otherMax, max);
+}
+
+static float boxArea(vec3 min, vec3 max) {
+  vec3 e;
+  glm_vec3_sub(max, min, e);
+  if (e[0] < 0.0f) {
+    return 0.0f;
+  }
+  return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+}
+
+static void nodeBounds(BvhBuild *build, BvhNode *node, vec3 centroidMin,
+                       vec3 centroidMax) {
+  emptyBox(node->min, node->max);
+  emptyBox(centroidMin, centroidMax);
+  for (uint32_t i = 0; i < node->count; i++) {
+    uint32_t prim = build->bvh->prims[node->leftFirst + i];
+    growBox(node->min, node->max, build->boxes[prim * 2],
+            build->boxes[prim * 2 + 1]);
+    growBox(centroidMin, centroidMax, build->centroids[prim],
+            build->centroids[prim]);
+  }
+}
+
+static uint32_t binIndex(float centroid, float min, float scale) {
+  uint32_t bin = (uint32_t)((centroid - min) * scale);
+  return bin < BVH_BINS - 1 ? bin : BVH_BINS - 1;
+}
+
+// Subtrees smaller than taskThreshold are queued for the workers instead of
+// being built here; 0 builds the whole subtree on this thread.
+static void subdivide(BvhBuild *build, uint32_t nodeIndex,
+                      uint32_t taskThreshold) {
+  Bvh *bvh = build->bvh;
+  BvhNode *node = &bvh->nodes[nodeIndex];
+  vec3 centroidMin, centroidMax;
+  nodeBounds(build, node, centroidMin, centroidMax);
+  if (node->count <= 1) {
+    return;
+  }
+
+  int bestAxis = -1;
+  uint32_t bestSplit = 0;
+  float bestCost = FLT_MAX;
+  for (int axis = 0; axis < 3; axis++) {
+    float extent = centroidMax[axis] - centroidMin[axis];
+    if (extent <= 0.0f) {
+      continue;
+    }
+    BvhBin bins[BVH_BINS];
+    for (int b = 0; b < BVH_BINS; b++) {
+      emptyBox(bins[b].min, bins[b].max);
+      bins[b].count = 0;
+    }
+    float scale = BVH_BINS / extent;
+    for (uint32_t i = 0; i < node->count; i++) {
+      uint32_t prim = bvh->prims[node->leftFirst + i];
+      BvhBin *bin = &bins[binIndex(build->centroids[prim][axis],
+                                   centroidMin[axis], scale)];
+      growBox(bin->min, bin->max, build->boxes[prim * 2],
+              build->boxes[prim * 2 + 1]);
+      bin->count++;
+    }
+    // sweep from both ends; split s puts bins [0, s] on the left
+    float leftArea[BVH_BINS - 1];
+    uint32_t leftCount[BVH_BINS - 1];
+    vec3 min, max;
+    emptyBox(min, max);
+    uint32_t count = 0;
+    for (int s = 0; s < BVH_BINS - 1; s++) {
+      growBox(min, max, bins[s].min, bins[s].max);
+      count += bins[s].count;
+      leftArea[s] = boxArea(min, max);
+      leftCount[s] = count;
+    }
+    emptyBox(min, max);
+    count = 0;
+    for (int s = BVH_BINS - 2; s >= 0; s--) {
+      growBox(min, max, bins[s + 1].min, bins[s + 1].max);
+      count += bins[s + 1].count;
+      if (leftCount[s] == 0 || count == 0) {
+        continue;
+      }
+      float cost = leftCount[s] * leftArea[s] + count * boxArea(min, max);
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = (uint32_t)s;
+      }
+    }
+  }
+
+  float nodeArea = boxArea(node->min, node->max);
+  float leafCost = node->count * nodeArea;
+  uint32_t first = node->leftFirst;
+  uint32_t mid;
+  if (bestAxis < 0) {
+    // all centroids coincide, so any split is as good as another
+    if (node->count <= BVH_MAX_LEAF) {
+      return;
+    }
+    mid = first + node->count / 2;
+  } else {
+    if (BVH_TRAVERSAL_COST * nodeArea + bestCost >= leafCost &&
+        node->count <= BVH_MAX_LEAF) {
+      return;
+    }
+    float scale = BVH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+    uint32_t i = first;
+    uint32_t j = first + node->count;
+    while (i < j) {
+      uint32_t prim = bvh->prims[i];
+      if (binIndex(build->centroids[prim][bestAxis], centroidMin[bestAxis],
+                   scale) <= bestSplit) {
+        i++;
+      } else {
+        bvh->prims[i] = bvh->prims[--j];
+        bvh->prims[j] = prim;
+      }
+    }
+    mid = i;
+  }
+
+  uint32_t left = atomic_fetch_add(&build->nodeCount, 2);
+  bvh->nodes[left] = (BvhNode){.leftFirst = first, .count = mid - first};
+  bvh->nodes[left + 1] =
+      (BvhNode){.leftFirst = mid, .count = first + node->count - mid};
+  node->leftFirst = left;
+  node->count = 0;
+  for (uint32_t child = left; child <= left + 1; child++) {
+    if (bvh->nodes[child].count < taskThreshold) {
+      build->tasks[build->taskCount++] = child;
+    } else {
+      subdivide(build, child, taskThreshold);
+    }
+  }
+}
+
+static int buildWorker(void *arg) {
+  BvhBuild *build = arg;
+  for (;;) {
+    uint32_t task = atomic_fetch_add(&build->nextTask, 1);
+    if (task >= build->taskCount) {
+      return 0;
+    }
+    subdivide(build, build->tasks[task], 0);
+  }
+}
+
+// Children follow their parent, so one forward sweep sees every parent's
+// depth before its children's.
+static uint32_t treeDepth(const Bvh *bvh) {
+  uint32_t *depths = malloc(sizeof(uint32_t) * bvh->nodeCount);
+  if (depths == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  uint32_t deepest = 0;
+  depths[0] = 0;
+  for (uint32_t i = 0; i < bvh->nodeCount; i++) {
+    const BvhNode *node = &bvh->nodes[i];
+    if (i == 1 || node->count > 0) {
+      continue;
+    }
+    depths[node->leftFirst] = depths[i] + 1;
+    depths[node->leftFirst + 1] = depths[i] + 1;
+    if (depths[i] + 1 > deepest) {
+      deepest = depths[i] + 1;
+    }
+  }
+  free(depths);
+  return deepest;
+}
+
+// Traversal pushes both children and pops one, so at most one sibling per
+// level waits on the stack besides the two just pushed.
+static uint32_t *traversalStack(const Bvh *bvh, uint32_t *local) {
+  if (bvh->depth + 2 <= BVH_STACK_SIZE) {
+    return local;
+  }
+  uint32_t *stack = malloc(sizeof(uint32_t) * (bvh->depth + 2));
+  if (stack == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  return stack;
+}
+
+static float sahCost(const Bvh *bvh) {
+  float rootArea = boxArea(bvh->nodes[0].min, bvh->nodes[0].max);
+  if (rootArea <= 0.0f) {
+    return 0.0f;
+  }
+  float cost = 0.0f;
+  for (uint32_t i = 0; i < bvh->nodeCount; i++) {
+    if (i == 1) {
+      continue;
+    }
+    BvhNode *node = &bvh->nodes[i];
+    float area = boxArea(node->min, node->max);
+    cost += node->count > 0 ? area * node->count : area * BVH_TRAVERSAL_COST;
+  }
+  return cost / rootArea;
+}
+
+void bvhBuild(Bvh *bvh, vec3 *boxes, uint32_t count) {
+  *bvh = (Bvh){
+      .nodes = malloc(sizeof(BvhNode) * 2 * (count > 0 ? count : 1)),
+      .prims = malloc(sizeof(uint32_t) * (count > 0 ? count : 1)),
+      .primCount = count,
+  };
+  BvhBuild build = {
+      .bvh = bvh,
+      .boxes = boxes,
+      .centroids = malloc(sizeof(vec3) * (count > 0 ? count : 1)),
+  };
+  if (bvh->nodes == NULL || bvh->prims == NULL || build.centroids == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  if (count == 0) {
+    free(build.centroids);
+    return;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    bvh->prims[i] = i;
+    glm_aabb_center(&boxes[i * 2], build.centroids[i]);
+  }
+  bvh->nodes[0] = (BvhNode){.leftFirst = 0, .count = count};
+  bvh->nodes[1] = (BvhNode){0};
+  atomic_init(&build.nodeCount, 2);
+  atomic_init(&build.nextTask, 0);
+
+  if (count < BVH_PARALLEL_THRESHOLD) {
+    subdivide(&build, 0, 0);
+  } else {
+    // split serially until subtrees are small enough to balance across
+    // threads, then let every thread, including this one, drain the queue
+    uint32_t threshold = count / (BVH_BUILD_THREADS * 8);
+    // deferred subtrees are disjoint and non-empty, so there are at most
+    // count of them however unevenly the splits land
+    build.tasks = malloc(sizeof(uint32_t) * count);
+    if (build.tasks == NULL) {
+      printf("malloc failed\n");
+      exit(1);
+    }
+    subdivide(&build, 0, threshold);
+    thrd_t threads[BVH_BUILD_THREADS - 1];
+    for (int i = 0; i < BVH_BUILD_THREADS - 1; i++) {
+      if (thrd_create(&threads[i], buildWorker, &build) != thrd_success) {
+        printf("failed to create bvh build thread\n");
+        exit(1);
+      }
+    }
+    buildWorker(&build);
+    for (int i = 0; i < BVH_BUILD_THREADS - 1; i++) {
+      thrd_join(threads[i], NULL);
+    }
+    free(build.tasks);
+  }
+  bvh->nodeCount = atomic_load(&build.nodeCount);
+  bvh->depth = treeDepth(bvh);
+  free(build.centroids);
+  bvh->buildCost = sahCost(bvh);
+  bvh->cost = bvh->buildCost;
+}
+
+float bvhRefit(Bvh *bvh, vec3 *boxes) {
+  if (bvh->primCount == 0) {
+    return 1.0f;
+  }
+  for (uint32_t i = bvh->nodeCount; i-- > 0;) {
+    if (i == 1) {
+      continue;
+    }
+    BvhNode *node = &bvh->nodes[i];
+    emptyBox(node->min, node->max);
+    if (node->count > 0) {
+      for (uint32_t p = 0; p < node->count; p++) {
+        uint32_t prim = bvh->prims[node->leftFirst + p];
+        growBox(node->min, node->max, boxes[prim * 2], boxes[prim * 2 + 1]);
+      }
+    } else {
+      BvhNode *left = &bvh->nodes[node->leftFirst];
+      growBox(node->min, node->max, left[0].min, left[0].max);
+      growBox(node->min, node->max, left[1].min, left[1].max);
+    }
+  }
+  bvh->cost = sahCost(bvh);
+  return bvh->buildCost > 0.0f ? bvh->cost / bvh->buildCost : 1.0f;
+}
+
+bool bvhUpdate(Bvh *bvh, vec3 *boxes) {
+  if (bvhRefit(bvh, boxes) <= BVH_REBUILD_FACTOR) {
+    return false;
+  }
+  uint32_t count = bvh->primCount;
+  bvhDestroy(bvh);
+  bvhBuild(bvh, boxes, count);
+  return true;
+}
+
+uint32_t bvhCullFrustum(const Bvh *bvh, vec3 *boxes, vec4 planes[6],
+                        uint32_t *visible) {
+  if (bvh->primCount == 0) {
+    return 0;
+  }
+  uint32_t count = 0;
+  uint32_t localStack[BVH_STACK_SIZE];
+  uint32_t *stack = traversalStack(bvh, localStack);
+  // planes the node is already known to be inside of are dropped from the
+  // mask, so fully visible subtrees are emitted without further tests
+  uint8_t localMasks[BVH_STACK_SIZE];
+  uint8_t *masks = localMasks;
+  if (stack != localStack) {
+    masks = malloc(bvh->depth + 2);
+    if (masks == NULL) {
+      printf("malloc failed\n");
+      exit(1);
+    }
+  }
+  uint32_t top = 0;
+  stack[top] = 0;
+  masks[top++] = 0x3f;
+  while (top > 0) {
+    top--;
+    BvhNode *node = &bvh->nodes[stack[top]];
+    uint8_t mask = masks[top];
+    bool outside = false;
+    for (int p = 0; p < 6 && !outside; p++) {
+      if (!(mask & (1 << p))) {
+        continue;
+      }
+      float far = planes[p][3];
+      float near = planes[p][3];
+      for (int a = 0; a < 3; a++) {
+        float n = planes[p][a];
+        far += n > 0.0f ? n * node->max[a] : n * node->min[a];
+        near += n > 0.0f ? n * node->min[a] : n * node->max[a];
+      }
+      outside = far < 0.0f;
+      if (near >= 0.0f) {
+        mask &= ~(1 << p);
+      }
+    }
+    if (outside) {
+      continue;
+    }
+    if (node->count > 0) {
+      for (uint32_t i = 0; i < node->count; i++) {
+        uint32_t prim = bvh->prims[node->leftFirst + i];
+        if (mask == 0 || glm_aabb_frustum(&boxes[prim * 2], planes)) {
+          visible[count++] = prim;
+        }
+      }
+      continue;
+    }
+    stack[top] = node->leftFirst;
+    masks[top++] = mask;
+    stack[top] = node->leftFirst + 1;
+    masks[top++] = mask;
+  }
+  if (stack != localStack) {
+    free(stack);
+    free(masks);
+  }
+  return count;
+}
+
+// Entry distance of the ray into the node's box, or FLT_MAX on a miss.
+static float rayBox(const BvhNode *node, vec3 origin, vec3 invDir,
+                    float maxT) {
+  float tmin = 0.0f;
+  float tmax = maxT;
+  for (int a = 0; a < 3; a++) {
+    float t1 = (node->min[a] - origin[a]) * invDir[a];
+    float t2 = (node->max[a] - origin[a]) * invDir[a];
+    tmin = fmaxf(tmin, fminf(t1, t2));
+    tmax = fminf(tmax, fmaxf(t1, t2));
+  }
+  return tmin <= tmax ? tmin : FLT_MAX;
+}
+
+uint32_t bvhRayCast(const Bvh *bvh, vec3 origin, vec3 dir, float maxDist,
+                    BvhRayFn hit, void *userData, float *t) {
+  float best = maxDist;
+  uint32_t bestPrim = UINT32_MAX;
+  if (bvh->primCount == 0) {
+    return bestPrim;
+  }
+  vec3 invDir = {1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]};
+  uint32_t localStack[BVH_STACK_SIZE];
+  uint32_t *stack = traversalStack(bvh, localStack);
+  uint32_t top = 0;
+  if (rayBox(&bvh->nodes[0], origin, invDir, best) != FLT_MAX) {
+    stack[top++] = 0;
+  }
+  while (top > 0) {
+    BvhNode *node = &bvh->nodes[stack[--top]];
+    // best may have shrunk since the node was pushed
+    if (rayBox(node, origin, invDir, best) == FLT_MAX) {
+      continue;
+    }
+    if (node->count > 0) {
+      for (uint32_t i = 0; i < node->count; i++) {
+        uint32_t prim = bvh->prims[node->leftFirst + i];
+        float primT = best;
+        if (hit(prim, origin, dir, &primT, userData) && primT < best) {
+          best = primT;
+          bestPrim = prim;
+        }
+      }
+      continue;
+    }
+    uint32_t near = node->leftFirst;
+    uint32_t far = node->leftFirst + 1;
+    float nearT = rayBox(&bvh->nodes[near], origin, invDir, best);
+    float farT = rayBox(&bvh->nodes[far], origin, invDir, best);
+    if (farT < nearT) {
+      uint32_t swap = near;
+      near = far;
+      far = swap;
+      float swapT = nearT;
+      nearT = farT;
+      farT = swapT;
+    }
+    // the nearer child is popped first
+    if (farT != FLT_MAX) {
+      stack[top++] = far;
+    }
+    if (nearT != FLT_MAX) {
+      stack[top++] = near;
+    }
+  }
+  if (stack != localStack) {
+    free(stack);
+  }
+  if (t != NULL) {
+    *t = best;
+  }
+  return bestPrim;
+}
+
+void bvhDestroy(Bvh *bvh) {
+  free(bvh->nodes);
+  free(bvh->prims);
+  *bvh = (Bvh){0};
+}
+
+static float randomRange(float min, float max) {
+  return min + (max - min) * ((float)rand() / (float)RAND_MAX);
+}
+
+// Benchmark primitives are the spheres inscribed in their boxes.
+static bool raySphereHit(uint32_t prim, vec3 origin, vec3 dir, float *t,
+                         void *userData) {
+  vec3 *boxes = userData;
+  vec4 sphere;
+  glm_aabb_center(&boxes[prim * 2], sphere);
+  sphere[3] = (boxes[prim * 2 + 1][0] - boxes[prim * 2][0]) * 0.5f;
+  float t1, t2;
+  if (!glm_ray_sphere(origin, dir, sphere, &t1, &t2)) {
+    return false;
+  }
+  float entry = t1 >= 0.0f ? t1 : t2;
+  if (entry < 0.0f || entry >= *t) {
+    return false;
+  }
+  *t = entry;
+  return true;
+}
+
+static void randomSphereBox(vec3 box[2], float spread) {
+  float radius = randomRange(0.1f, 2.0f);
+  for (int a = 0; a < 3; a++) {
+    float center = randomRange(-spread, spread);
+    box[0][a] = center - radius;
+    box[1][a] = center + radius;
+  }
+}
+
+static void randomRay(vec3 origin, vec3 dir) {
+  glm_vec3_zero(origin);
+  vec3 d = {randomRange(-1.0f, 1.0f), randomRange(-1.0f, 1.0f),
+            randomRange(-1.0f, 1.0f)};
+  glm_vec3_normalize_to(d, dir);
+}
+
+void bvhBenchmark(uint32_t count) {
+  vec3 *boxes = malloc(sizeof(vec3) * 2 * count);
+  uint32_t *visible = malloc(sizeof(uint32_t) * count);
+  if (boxes == NULL || visible == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  srand(1);
+  for (uint32_t i = 0; i < count; i++) {
+    randomSphereBox(&boxes[i * 2], 500.0f);
+  }
+
+  Bvh bvh;
+  uint64_t start = timerNowNs();
+  bvhBuild(&bvh, boxes, count);
+  uint64_t buildNs = timerNowNs() - start;
+  printf("bvh: %u prims, %u nodes, built in %.2f ms on %d threads, "
+         "SAH cost %.2f\n",
+         count, bvh.nodeCount, buildNs / 1e6,
+         count < BVH_PARALLEL_THRESHOLD ? 1 : BVH_BUILD_THREADS,
+         bvh.buildCost);
+
+  for (uint32_t i = 0; i < count; i++) {
+    vec3 jitter = {randomRange(-1.0f, 1.0f), randomRange(-1.0f, 1.0f),
+                   randomRange(-1.0f, 1.0f)};
+    glm_vec3_add(boxes[i * 2], jitter, boxes[i * 2]);
+    glm_vec3_add(boxes[i * 2 + 1], jitter, boxes[i * 2 + 1]);
+  }
+  start = timerNowNs();
+  float degradation = bvhRefit(&bvh, boxes);
+  printf("bvh: refit in %.2f ms, cost %.2fx of build\n",
+         (timerNowNs() - start) / 1e6, degradation);
+
+  mat4 view, proj, viewProj;
+  glm_lookat((vec3){0.0f, 0.0f, 0.0f}, (vec3){1.0f, 0.3f, 0.2f},
+             (vec3){0.0f, 0.0f, 1.0f}, view);
+  glm_perspective(glm_rad(60.0f), 16.0f / 9.0f, 0.1f, 400.0f, proj);
+  glm_mat4_mul(proj, view, viewProj);
+  vec4 planes[6];
+  glm_frustum_planes(viewProj, planes);
+  start = timerNowNs();
+  uint32_t visibleCount = bvhCullFrustum(&bvh, boxes, planes, visible);
+  uint64_t cullNs = timerNowNs() - start;
+  start = timerNowNs();
+  uint32_t linearCount = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    linearCount += glm_aabb_frustum(&boxes[i * 2], planes);
+  }
+  uint64_t linearNs = timerNowNs() - start;
+  printf("bvh: culled to %u visible in %.3f ms, linear %u in %.3f ms\n",
+         visibleCount, cullNs / 1e6, linearCount, linearNs / 1e6);
+
+  uint32_t mismatches = 0;
+  for (int r = 0; r < BVH_BENCH_CHECKED_RAYS; r++) {
+    vec3 origin, dir;
+    randomRay(origin, dir);
+    uint32_t prim = bvhRayCast(&bvh, origin, dir, FLT_MAX, raySphereHit,
+                               boxes, NULL);
+    float best = FLT_MAX;
+    uint32_t linearPrim = UINT32_MAX;
+    for (uint32_t i = 0; i < count; i++) {
+      if (raySphereHit(i, origin, dir, &best, boxes)) {
+        linearPrim = i;
+      }
+    }
+    mismatches += prim != linearPrim;
+  }
+  uint32_t hits = 0;
+  start = timerNowNs();
+  for (int r = 0; r < BVH_BENCH_RAYS; r++) {
+    vec3 origin, dir;
+    randomRay(origin, dir);
+    hits += bvhRayCast(&bvh, origin, dir, FLT_MAX, raySphereHit, boxes,
+                       NULL) != UINT32_MAX;
+  }
+  uint64_t rayNs = timerNowNs() - start;
+  printf("bvh: %d rays, %u hits, %.2f us/ray, %u of %d differ from linear\n",
+         BVH_BENCH_RAYS, hits, rayNs / 1e3 / BVH_BENCH_RAYS, mismatches,
+         BVH_BENCH_CHECKED_RAYS);
+
+  bvhDestroy(&bvh);
+  free(boxes);
+  free(visible);
+}
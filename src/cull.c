@@ -0,0 +1,233 @@
+#include "cull.h"
+#include "cglm/box.h"
+#include "cglm/cam.h"
+#include "cglm/frustum.h"
+#include "cglm/mat4.h"
+#include "cglm/types.h"
+#include "timer.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if CULL_SIMD_WIDTH == 8
+#include <immintrin.h>
+#elif CULL_SIMD_WIDTH == 4
+#include <emmintrin.h>
+#endif
+
+#define CULL_BENCH_ITERATIONS 20
+
+void cullBoxesInit(CullBoxes *boxes, uint32_t capacity) {
+  *boxes = (CullBoxes){
+      .capacity = capacity,
+      .centerX = malloc(sizeof(float) * capacity),
+      .centerY = malloc(sizeof(float) * capacity),
+      .centerZ = malloc(sizeof(float) * capacity),
+      .extentX = malloc(sizeof(float) * capacity),
+      .extentY = malloc(sizeof(float) * capacity),
+      .extentZ = malloc(sizeof(float) * capacity),
+  };
+  if (boxes->centerX == NULL || boxes->centerY == NULL ||
+      boxes->centerZ == NULL || boxes->extentX == NULL ||
+      boxes->extentY == NULL || boxes->extentZ == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+}
+
+uint32_t cullBoxesAdd(CullBoxes *boxes, vec3 box[2]) {
+  if (boxes->count == boxes->capacity) {
+    printf("cull box capacity of %u exceeded\n", boxes->capacity);
+    exit(1);
+  }
+  uint32_t i = boxes->count++;
+  boxes->centerX[i] = (box[0][0] + box[1][0]) * 0.5f;
+  boxes->centerY[i] = (box[0][1] + box[1][1]) * 0.5f;
+  boxes->centerZ[i] = (box[0][2] + box[1][2]) * 0.5f;
+  boxes->extentX[i] = (box[1][0] - box[0][0]) * 0.5f;
+  boxes->extentY[i] = (box[1][1] - box[0][1]) * 0.5f;
+  boxes->extentZ[i] = (box[1][2] - box[0][2]) * 0.5f;
+  return i;
+}
+
+// A box is outside a plane when its center lies further behind it than the
+// box's extent projected onto the plane normal.
+static uint32_t cullRange(const CullBoxes *boxes, vec4 planes[6],
+                          uint32_t begin, uint32_t *visible, uint32_t count) {
+  for (uint32_t i = begin; i < boxes->count; i++) {
+    uint32_t inside = 1;
+    for (int p = 0; p < 6; p++) {
+      float dist = planes[p][0] * boxes->centerX[i] +
+                   planes[p][1] * boxes->centerY[i] +
+                   planes[p][2] * boxes->centerZ[i] + planes[p][3];
+      float radius = fabsf(planes[p][0]) * boxes->extentX[i] +
+                     fabsf(planes[p][1]) * boxes->extentY[i] +
+                     fabsf(planes[p][2]) * boxes->extentZ[i];
+      inside &= dist + radius >= 0.0f;
+    }
+    visible[count] = i;
+    count += inside;
+  }
+  return count;
+}
+
+uint32_t cullFrustum(const CullBoxes *boxes, mat4 viewProj, uint32_t *visible) {
+  vec4 planes[6];
+  glm_frustum_planes(viewProj, planes);
+  uint32_t count = 0;
+  uint32_t i = 0;
+#if CULL_SIMD_WIDTH == 8
+  __m256 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+  for (int p = 0; p < 6; p++) {
+    nx[p] = _mm256_set1_ps(planes[p][0]);
+    ny[p] = _mm256_set1_ps(planes[p][1]);
+    nz[p] = _mm256_set1_ps(planes[p][2]);
+    nw[p] = _mm256_set1_ps(planes[p][3]);
+    ax[p] = _mm256_set1_ps(fabsf(planes[p][0]));
+    ay[p] = _mm256_set1_ps(fabsf(planes[p][1]));
+    az[p] = _mm256_set1_ps(fabsf(planes[p][2]));
+  }
+  __m256 zero = _mm256_setzero_ps();
+  for (; i + 8 <= boxes->count; i += 8) {
+    __m256 cx = _mm256_loadu_ps(boxes->centerX + i);
+    __m256 cy = _mm256_loadu_ps(boxes->centerY + i);
+    __m256 cz = _mm256_loadu_ps(boxes->centerZ + i);
+    __m256 ex = _mm256_loadu_ps(boxes->extentX + i);
+    __m256 ey = _mm256_loadu_ps(boxes->extentY + i);
+    __m256 ez = _mm256_loadu_ps(boxes->extentZ + i);
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      __m256 dist = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(nx[p], cx), _mm256_mul_ps(ny[p], cy)),
+          _mm256_add_ps(_mm256_mul_ps(nz[p], cz), nw[p]));
+      __m256 radius = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(ax[p], ex), _mm256_mul_ps(ay[p], ey)),
+          _mm256_mul_ps(az[p], ez));
+      inside = _mm256_and_ps(
+          inside,
+          _mm256_cmp_ps(_mm256_add_ps(dist, radius), zero, _CMP_GE_OQ));
+    }
+    uint32_t mask = (uint32_t)_mm256_movemask_ps(inside);
+    // branchless compaction: always write, only advance on visible
+    for (uint32_t b = 0; b < 8; b++) {
+      visible[count] = i + b;
+      count += (mask >> b) & 1;
+    }
+  }
+#elif CULL_SIMD_WIDTH == 4
+  __m128 nx[6], ny[6], nz[6], nw[6], ax[6], ay[6], az[6];
+  for (int p = 0; p < 6; p++) {
+    nx[p] = _mm_set1_ps(planes[p][0]);
+    ny[p] = _mm_set1_ps(planes[p][1]);
+    nz[p] = _mm_set1_ps(planes[p][2]);
+    nw[p] = _mm_set1_ps(planes[p][3]);
+    ax[p] = _mm_set1_ps(fabsf(planes[p][0]));
+    ay[p] = _mm_set1_ps(fabsf(planes[p][1]));
+    az[p] = _mm_set1_ps(fabsf(planes[p][2]));
+  }
+  __m128 zero = _mm_setzero_ps();
+  for (; i + 4 <= boxes->count; i += 4) {
+    __m128 cx = _mm_loadu_ps(boxes->centerX + i);
+    __m128 cy = _mm_loadu_ps(boxes->centerY + i);
+    __m128 cz = _mm_loadu_ps(boxes->centerZ + i);
+    __m128 ex = _mm_loadu_ps(boxes->extentX + i);
+    __m128 ey = _mm_loadu_ps(boxes->extentY + i);
+    __m128 ez = _mm_loadu_ps(boxes->extentZ + i);
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      __m128 dist =
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)),
+                     _mm_add_ps(_mm_mul_ps(nz[p], cz), nw[p]));
+      __m128 radius =
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)),
+                     _mm_mul_ps(az[p], ez));
+      inside =
+          _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, radius), zero));
+    }
+    uint32_t mask = (uint32_t)_mm_movemask_ps(inside);
+    for (uint32_t b = 0; b < 4; b++) {
+      visible[count] = i + b;
+      count += (mask >> b) & 1;
+    }
+  }
+#endif
+  // scalar tail, or everything without SIMD
+  return cullRange(boxes, planes, i, visible, count);
+}
+
+void cullBoxesDestroy(CullBoxes *boxes) {
+  free(boxes->centerX);
+  free(boxes->centerY);
+  free(boxes->centerZ);
+  free(boxes->extentX);
+  free(boxes->extentY);
+  free(boxes->extentZ);
+}
+
+static float randomRange(float min, float max) {
+  return min + (max - min) * ((float)rand() / (float)RAND_MAX);
+}
+
+void cullBenchmark(uint32_t count) {
+  CullBoxes boxes;
+  cullBoxesInit(&boxes, count);
+  vec3 *reference = malloc(sizeof(vec3) * 2 * count);
+  uint32_t *visible = malloc(sizeof(uint32_t) * count);
+  if (reference == NULL || visible == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  srand(1);
+  for (uint32_t i = 0; i < count; i++) {
+    vec3 *box = &reference[i * 2];
+    for (int a = 0; a < 3; a++) {
+      float center = randomRange(-500.0f, 500.0f);
+      float extent = randomRange(0.1f, 2.0f);
+      box[0][a] = center - extent;
+      box[1][a] = center + extent;
+    }
+    cullBoxesAdd(&boxes, box);
+  }
+  mat4 view, proj, viewProj;
+  glm_lookat((vec3){0.0f, 0.0f, 0.0f}, (vec3){1.0f, 0.3f, 0.2f},
+             (vec3){0.0f, 0.0f, 1.0f}, view);
+  glm_perspective(glm_rad(60.0f), 16.0f / 9.0f, 0.1f, 400.0f, proj);
+  glm_mat4_mul(proj, view, viewProj);
+
+  uint32_t visibleCount = 0;
+  uint64_t best = UINT64_MAX;
+  for (int it = 0; it < CULL_BENCH_ITERATIONS; it++) {
+    uint64_t start = timerNowNs();
+    visibleCount = cullFrustum(&boxes, viewProj, visible);
+    uint64_t elapsed = timerNowNs() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+
+  vec4 planes[6];
+  glm_frustum_planes(viewProj, planes);
+  uint32_t referenceCount = 0;
+  uint64_t referenceBest = UINT64_MAX;
+  for (int it = 0; it < CULL_BENCH_ITERATIONS; it++) {
+    uint64_t start = timerNowNs();
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      n += glm_aabb_frustum(&reference[i * 2], planes);
+    }
+    uint64_t elapsed = timerNowNs() - start;
+    referenceBest = elapsed < referenceBest ? elapsed : referenceBest;
+    referenceCount = n;
+  }
+
+  printf("cull: %u boxes, %u visible, width %d: %.3f ns/box\n", count,
+         visibleCount, CULL_SIMD_WIDTH, (double)best / count);
+  printf("cull: glm_aabb_frustum: %u visible: %.3f ns/box (%.2fx)\n",
+         referenceCount, (double)referenceBest / count,
+         (double)referenceBest / (double)best);
+  if (visibleCount != referenceCount) {
+    printf("cull: visible count differs from glm_aabb_frustum\n");
+  }
+  free(reference);
+  free(visible);
+  cullBoxesDestroy(&boxes);
+}
@@ -0,0 +1,195 @@
+#include "device.h"
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+QueueFamilies findQueueFamilies(VkPhysicalDevice physicalDevice,
+                                VkSurfaceKHR surface) {
+  uint32_t count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &count, NULL);
+  VkQueueFamilyProperties props[count];
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &count, props);
+  QueueFamilies families = {UINT32_MAX, UINT32_MAX, UINT32_MAX};
+  uint32_t transferScore = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    VkQueueFlags flags = props[i].queueFlags;
+    VkBool32 present = VK_FALSE;
+    if (surface != VK_NULL_HANDLE) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface,
+                                           &present);
+    } else {
+      present = VK_TRUE;
+    }
+    if (families.graphics == UINT32_MAX && (flags & VK_QUEUE_GRAPHICS_BIT) &&
+        present) {
+      families.graphics = i;
+    }
+    // prefer a pure DMA family, then anything that is not graphics
+    if (!(flags & VK_QUEUE_GRAPHICS_BIT) &&
+        (flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      uint32_t score = (flags & VK_QUEUE_COMPUTE_BIT) ? 1 : 2;
+      if (score > transferScore) {
+        transferScore = score;
+        families.transfer = i;
+      }
+    }
+    // the first compute family without graphics runs alongside it
+    if (families.compute == UINT32_MAX && !(flags & VK_QUEUE_GRAPHICS_BIT) &&
+        (flags & VK_QUEUE_COMPUTE_BIT)) {
+      families.compute = i;
+    }
+  }
+  if (families.graphics == UINT32_MAX) {
+    printf("no graphics queue family with present support\n");
+    exit(1);
+  }
+  if (families.transfer == UINT32_MAX) {
+    families.transfer = families.graphics;
+  }
+  if (families.compute == UINT32_MAX) {
+    families.compute = families.graphics;
+  }
+  printf("queue families: graphics %u, transfer %u, compute %u\n",
+         families.graphics, families.transfer, families.compute);
+  return families;
+}
+
+bool deviceSupportsExtension(VkPhysicalDevice physicalDevice,
+                             const char *name) {
+  uint32_t count = 0;
+  vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &count, NULL);
+  VkExtensionProperties props[count + 1];
+  vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &count, props);
+  for (uint32_t i = 0; i < count; i++) {
+    if (strcmp(props[i].extensionName, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t getQueueCreateInfos(const QueueFamilies *families,
+                             const float *priority,
+                             VkDeviceQueueCreateInfo *infos) {
+  uint32_t wanted[] = {families->graphics, families->transfer,
+                       families->compute};
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < MAX_QUEUE_FAMILIES; i++) {
+    uint32_t seen = 0;
+    for (uint32_t j = 0; j < count; j++) {
+      if (infos[j].queueFamilyIndex == wanted[i]) {
+        seen = 1;
+      }
+    }
+    if (seen) {
+      continue;
+    }
+    infos[count++] = (VkDeviceQueueCreateInfo){
+        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+        .queueFamilyIndex = wanted[i],
+        .queueCount = 1,
+        .pQueuePriorities = priority,
+    };
+  }
+  return count;
+}
+
+void cmdReleaseBuffer(VkCommandBuffer cmd, VkBuffer buffer, uint32_t srcFamily,
+                      uint32_t dstFamily, VkAccessFlags2 srcAccess,
+                      VkPipelineStageFlags2 srcStage) {
+  if (srcFamily == dstFamily) {
+    return;
+  }
+  // the release has no second scope, the semaphore signal covers it
+  VkBufferMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+      .srcStageMask = srcStage,
+      .srcAccessMask = srcAccess,
+      .dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+      .dstAccessMask = VK_ACCESS_2_NONE,
+      .srcQueueFamilyIndex = srcFamily,
+      .dstQueueFamilyIndex = dstFamily,
+      .buffer = buffer,
+      .offset = 0,
+      .size = VK_WHOLE_SIZE,
+  };
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .bufferMemoryBarrierCount = 1,
+      .pBufferMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(cmd, &dependency);
+}
+
+void cmdReleaseImage(VkCommandBuffer cmd, VkImage image,
+                     VkImageSubresourceRange range, VkImageLayout layout,
+                     uint32_t srcFamily, uint32_t dstFamily,
+                     VkAccessFlags2 srcAccess, VkPipelineStageFlags2 srcStage) {
+  if (srcFamily == dstFamily) {
+    return;
+  }
+  VkImageMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = srcStage,
+      .srcAccessMask = srcAccess,
+      .dstStageMask = VK_PIPELINE_STAGE_2_NONE,
+      .dstAccessMask = VK_ACCESS_2_NONE,
+      .oldLayout = layout,
+      .newLayout = layout,
+      .srcQueueFamilyIndex = srcFamily,
+      .dstQueueFamilyIndex = dstFamily,
+      .image = image,
+      .subresourceRange = range,
+  };
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = 1,
+      .pImageMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(cmd, &dependency);
+}
+
+VkBufferMemoryBarrier2 bufferAcquireBarrier(VkBuffer buffer, uint32_t srcFamily,
+                                            uint32_t dstFamily,
+                                            VkAccessFlags2 dstAccess,
+                                            VkPipelineStageFlags2 dstStage) {
+  VkBufferMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+      .srcStageMask = dstStage,
+      .srcAccessMask = VK_ACCESS_2_NONE,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+      .srcQueueFamilyIndex = srcFamily,
+      .dstQueueFamilyIndex = dstFamily,
+      .buffer = buffer,
+      .offset = 0,
+      .size = VK_WHOLE_SIZE,
+  };
+  return barrier;
+}
+
+VkImageMemoryBarrier2 imageAcquireBarrier(VkImage image,
+                                          VkImageSubresourceRange range,
+                                          VkImageLayout layout,
+                                          uint32_t srcFamily,
+                                          uint32_t dstFamily,
+                                          VkAccessFlags2 dstAccess,
+                                          VkPipelineStageFlags2 dstStage) {
+  VkImageMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = dstStage,
+      .srcAccessMask = VK_ACCESS_2_NONE,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+      .oldLayout = layout,
+      .newLayout = layout,
+      .srcQueueFamilyIndex = srcFamily,
+      .dstQueueFamilyIndex = dstFamily,
+      .image = image,
+      .subresourceRange = range,
+  };
+  return barrier;
+}
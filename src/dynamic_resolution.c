@@ -0,0 +1,56 @@
+#include "dynamic_resolution.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+void dynResInit(DynamicResolution *dr, float budgetMs) {
+  *dr = (DynamicResolution){
+      .budgetMs = budgetMs,
+      .level = DYNRES_LEVELS,
+  };
+}
+
+float dynResScale(const DynamicResolution *dr) {
+  return (float)dr->level / DYNRES_LEVELS;
+}
+
+bool dynResUpdate(DynamicResolution *dr, float gpuMs) {
+  if (!dr->primed) {
+    dr->smoothedMs = gpuMs;
+    dr->primed = true;
+  } else {
+    dr->smoothedMs += DYNRES_SMOOTHING * (gpuMs - dr->smoothedMs);
+  }
+  if (dr->settle > 0) {
+    dr->settle--;
+    return false;
+  }
+  float scale = dynResScale(dr);
+  uint32_t level = dr->level;
+  if (dr->smoothedMs > dr->budgetMs) {
+    float fit = scale * sqrtf(dr->budgetMs / dr->smoothedMs);
+    level = (uint32_t)floorf(fit * DYNRES_LEVELS);
+    if (level >= dr->level) {
+      level = dr->level - 1;
+    }
+  } else if (dr->smoothedMs < dr->budgetMs * DYNRES_HEADROOM) {
+    level = dr->level + 1;
+  }
+  if (level < DYNRES_MIN_LEVEL) {
+    level = DYNRES_MIN_LEVEL;
+  }
+  if (level > DYNRES_LEVELS) {
+    level = DYNRES_LEVELS;
+  }
+  if (level == dr->level) {
+    return false;
+  }
+  float next = (float)level / DYNRES_LEVELS;
+  printf("dynamic resolution: %.2f -> %.2f (gpu %.2f ms, budget %.2f ms)\n",
+         scale, next, dr->smoothedMs, dr->budgetMs);
+  // the estimate so far was measured at the old pixel count
+  dr->smoothedMs *= (next * next) / (scale * scale);
+  dr->level = level;
+  dr->settle = DYNRES_SETTLE_FRAMES;
+  return true;
+}
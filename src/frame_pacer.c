@@ -0,0 +1,120 @@
+#include "frame_pacer.h"
+#include "timer.h"
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static uint32_t clampDepth(uint32_t depth) {
+  if (depth < 1) {
+    return 1;
+  }
+  if (depth > FRAME_PACER_MAX_DEPTH) {
+    return FRAME_PACER_MAX_DEPTH;
+  }
+  return depth;
+}
+
+void framePacerInit(FramePacer *pacer, VkDevice device, uint32_t depth) {
+  *pacer = (FramePacer){
+      .depth = clampDepth(depth),
+      .bound = FRAME_BOUND_CPU,
+  };
+  VkSemaphoreTypeCreateInfo typeInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+      .initialValue = 0,
+  };
+  VkSemaphoreCreateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &typeInfo,
+  };
+  if (vkCreateSemaphore(device, &info, NULL, &pacer->timeline) != VK_SUCCESS) {
+    printf("failed to create timeline semaphore\n");
+    exit(1);
+  }
+  printf("frames in flight: %u\n", pacer->depth);
+}
+
+void framePacerSetDepth(FramePacer *pacer, uint32_t depth) {
+  depth = clampDepth(depth);
+  if (depth != pacer->depth) {
+    printf("frames in flight: %u -> %u\n", pacer->depth, depth);
+    pacer->depth = depth;
+  }
+}
+
+static void waitForValue(const FramePacer *pacer, VkDevice device,
+                         uint64_t value) {
+  VkSemaphoreWaitInfo waitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .semaphoreCount = 1,
+      .pSemaphores = &pacer->timeline,
+      .pValues = &value,
+  };
+  if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+    printf("timeline wait failed\n");
+    exit(1);
+  }
+}
+
+uint32_t framePacerBeginFrame(FramePacer *pacer, VkDevice device) {
+  uint64_t now = timerNowNs();
+  if (pacer->frameStartNs != 0) {
+    pacer->frameNs = now - pacer->frameStartNs;
+  }
+  pacer->frameStartNs = now;
+  pacer->waitNs = 0;
+  // frame N may start once frame N - depth has retired, i.e. the timeline
+  // reached N - depth + 1
+  if (pacer->frameIndex >= pacer->depth) {
+    uint64_t value = pacer->frameIndex - pacer->depth + 1;
+    uint64_t completed = 0;
+    vkGetSemaphoreCounterValue(device, pacer->timeline, &completed);
+    if (completed < value) {
+      waitForValue(pacer, device, value);
+      pacer->waitNs = timerNowNs() - now;
+    }
+  }
+  pacer->bound = pacer->waitNs > FRAME_PACER_WAIT_EPSILON_NS ? FRAME_BOUND_GPU
+                                                             : FRAME_BOUND_CPU;
+  // slots cycle over the maximum depth, so the slot's previous user (frame
+  // N - FRAME_PACER_MAX_DEPTH) has always retired by now whatever the depth
+  return (uint32_t)(pacer->frameIndex % FRAME_PACER_MAX_DEPTH);
+}
+
+uint64_t framePacerSignalValue(const FramePacer *pacer) {
+  return pacer->frameIndex + 1;
+}
+
+void framePacerEndFrame(FramePacer *pacer) {
+  pacer->reportFrames++;
+  pacer->reportWaitNs += pacer->waitNs;
+  pacer->reportFrameNs += pacer->frameNs;
+  if (pacer->bound == FRAME_BOUND_GPU) {
+    pacer->reportGpuBound++;
+  }
+  if (pacer->reportFrames == FRAME_PACER_REPORT_INTERVAL) {
+    printf("frame pacing: depth %u, avg frame %.3f ms, avg timeline wait %.3f "
+           "ms, gpu-bound %u/%u frames\n",
+           pacer->depth, pacer->reportFrameNs / 1e6 / pacer->reportFrames,
+           pacer->reportWaitNs / 1e6 / pacer->reportFrames,
+           pacer->reportGpuBound, pacer->reportFrames);
+    pacer->reportFrames = 0;
+    pacer->reportGpuBound = 0;
+    pacer->reportWaitNs = 0;
+    pacer->reportFrameNs = 0;
+  }
+  pacer->frameIndex++;
+}
+
+void framePacerWaitIdle(const FramePacer *pacer, VkDevice device) {
+  if (pacer->frameIndex > 0) {
+    waitForValue(pacer, device, pacer->frameIndex);
+  }
+}
+
+void framePacerDestroy(FramePacer *pacer, VkDevice device) {
+  vkDestroySemaphore(device, pacer->timeline, NULL);
+  pacer->timeline = VK_NULL_HANDLE;
+}
@@ -0,0 +1,117 @@
+#include "frame_stats.h"
+#include "timer.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void frameClockInit(FrameClock *clock) {
+  uint64_t now = timerNowNs();
+  *clock = (FrameClock){
+      .startNs = now,
+      .lastNs = now,
+  };
+}
+
+void frameClockTick(FrameClock *clock) {
+  uint64_t now = timerNowNs();
+  clock->deltaSeconds = (now - clock->lastNs) / 1e9;
+  clock->elapsedSeconds = (now - clock->startNs) / 1e9;
+  clock->lastNs = now;
+  clock->frame++;
+}
+
+void frameStatsInit(FrameStats *stats, const char *csvPath) {
+  memset(stats, 0, sizeof(FrameStats));
+  stats->lastReportNs = timerNowNs();
+  if (csvPath == NULL) {
+    return;
+  }
+  // runs append to one file, so the header is only written once
+  stats->csv = fopen(csvPath, "a");
+  if (stats->csv == NULL) {
+    printf("failed to open frame stats csv: %s\n", csvPath);
+    exit(1);
+  }
+  fseek(stats->csv, 0, SEEK_END);
+  if (ftell(stats->csv) == 0) {
+    fprintf(stats->csv, "frame,elapsed_s,min_ms,avg_ms,p50_ms,p95_ms,p99_ms,"
+                        "max_ms,hitches\n");
+  }
+}
+
+static int compareDouble(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, uint32_t count, double p) {
+  uint32_t index = (uint32_t)(p * (count - 1) + 0.5);
+  return sorted[index];
+}
+
+FrameStatsSummary frameStatsSummarize(const FrameStats *stats) {
+  FrameStatsSummary summary = {0};
+  if (stats->count == 0) {
+    return summary;
+  }
+  double sorted[FRAME_STATS_WINDOW];
+  memcpy(sorted, stats->samples, sizeof(double) * stats->count);
+  qsort(sorted, stats->count, sizeof(double), compareDouble);
+  summary.min = sorted[0];
+  summary.max = sorted[stats->count - 1];
+  summary.avg = stats->sum / stats->count;
+  summary.p50 = percentile(sorted, stats->count, 0.50);
+  summary.p95 = percentile(sorted, stats->count, 0.95);
+  summary.p99 = percentile(sorted, stats->count, 0.99);
+  return summary;
+}
+
+void frameStatsRecord(FrameStats *stats, const FrameClock *clock) {
+  // the first tick has no previous frame to measure against
+  if (clock->frame < 2) {
+    return;
+  }
+  double ms = clock->deltaSeconds * 1000.0;
+  if (stats->count >= 16 &&
+      ms > FRAME_STATS_HITCH_FACTOR * (stats->sum / stats->count)) {
+    stats->hitches++;
+    stats->totalHitches++;
+    printf("hitch: frame %llu took %.3f ms (avg %.3f ms)\n",
+           (unsigned long long)clock->frame, ms, stats->sum / stats->count);
+  }
+  if (stats->count == FRAME_STATS_WINDOW) {
+    stats->sum -= stats->samples[stats->next];
+  } else {
+    stats->count++;
+  }
+  stats->samples[stats->next] = ms;
+  stats->sum += ms;
+  stats->next = (stats->next + 1) % FRAME_STATS_WINDOW;
+  stats->frames++;
+
+  if (clock->lastNs - stats->lastReportNs < FRAME_STATS_REPORT_NS) {
+    return;
+  }
+  stats->lastReportNs = clock->lastNs;
+  FrameStatsSummary s = frameStatsSummarize(stats);
+  printf("frame time (last %u): min %.3f avg %.3f p50 %.3f p95 %.3f p99 %.3f "
+         "max %.3f ms, %u hitches\n",
+         stats->count, s.min, s.avg, s.p50, s.p95, s.p99, s.max,
+         stats->hitches);
+  if (stats->csv != NULL) {
+    fprintf(stats->csv, "%llu,%.3f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%u\n",
+            (unsigned long long)clock->frame, clock->elapsedSeconds, s.min,
+            s.avg, s.p50, s.p95, s.p99, s.max, stats->hitches);
+    fflush(stats->csv);
+  }
+  stats->hitches = 0;
+}
+
+void frameStatsDestroy(FrameStats *stats) {
+  if (stats->csv != NULL) {
+    fclose(stats->csv);
+    stats->csv = NULL;
+  }
+}
@@ -0,0 +1,69 @@
+#include "gpu_timer.h"
+#include "frame_pacer.h"
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void gpuTimerInit(GpuTimer *timer, VkDevice device, float period) {
+  *timer = (GpuTimer){
+      .period = period,
+      .label = "gpu",
+  };
+  VkQueryPoolCreateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = FRAME_PACER_MAX_DEPTH * 2,
+  };
+  if (vkCreateQueryPool(device, &info, NULL, &timer->pool) != VK_SUCCESS) {
+    printf("failed to create timestamp query pool\n");
+    exit(1);
+  }
+}
+
+void gpuTimerSetLabel(GpuTimer *timer, const char *label) {
+  timer->label = label;
+  timer->sumNs = 0;
+  timer->samples = 0;
+  // queries in flight were recorded under the old label
+  for (uint32_t i = 0; i < FRAME_PACER_MAX_DEPTH; i++) {
+    timer->issued[i] = false;
+  }
+}
+
+bool gpuTimerCollect(GpuTimer *timer, VkDevice device, uint32_t slot) {
+  if (!timer->issued[slot]) {
+    return false;
+  }
+  timer->issued[slot] = false;
+  uint64_t stamps[2];
+  if (vkGetQueryPoolResults(device, timer->pool, slot * 2, 2, sizeof(stamps),
+                            stamps, sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+    return false;
+  }
+  uint64_t ns = (uint64_t)((stamps[1] - stamps[0]) * (double)timer->period);
+  timer->lastMs = ns / 1e6f;
+  timer->sumNs += ns;
+  if (++timer->samples % GPU_TIMER_REPORT_INTERVAL == 0) {
+    printf("%s: %.3f ms gpu/frame\n", timer->label,
+           timer->sumNs / 1e6 / timer->samples);
+  }
+  return true;
+}
+
+void gpuTimerBegin(GpuTimer *timer, VkCommandBuffer cmd, uint32_t slot) {
+  vkCmdResetQueryPool(cmd, timer->pool, slot * 2, 2);
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, timer->pool,
+                       slot * 2);
+}
+
+void gpuTimerEnd(GpuTimer *timer, VkCommandBuffer cmd, uint32_t slot) {
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
+                       timer->pool, slot * 2 + 1);
+  timer->issued[slot] = true;
+}
+
+void gpuTimerDestroy(GpuTimer *timer, VkDevice device) {
+  vkDestroyQueryPool(device, timer->pool, NULL);
+}
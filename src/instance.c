@@ -1,15 +1,38 @@
+#include "instance.h"
 #include "vulkan/vulkan_core.h"
 #include <GLFW/glfw3.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vulkan/vulkan.h>
 
-void createInstance(VkInstance *instance) {
+#define VALIDATION_LAYER "VK_LAYER_KHRONOS_validation"
+
+// Render servers and CI images often ship the loader without the SDK layers.
+static bool validationAvailable() {
+  uint32_t count = 0;
+  vkEnumerateInstanceLayerProperties(&count, NULL);
+  VkLayerProperties props[count + 1];
+  vkEnumerateInstanceLayerProperties(&count, props);
+  for (uint32_t i = 0; i < count; i++) {
+    if (strcmp(props[i].layerName, VALIDATION_LAYER) == 0) {
+      return true;
+    }
+  }
+  printf("%s not found, running without validation\n", VALIDATION_LAYER);
+  return false;
+}
+
+void createInstance(VkInstance *instance, bool windowed) {
   uint32_t extCount = 0;
-  const char **extensions = glfwGetRequiredInstanceExtensions(&extCount);
-  uint32_t layersCount = 1;
-  const char **layers = (const char *[]){"VK_LAYER_KHRONOS_validation"};
+  const char **extensions = NULL;
+  if (windowed) {
+    extensions = glfwGetRequiredInstanceExtensions(&extCount);
+  }
+  uint32_t layersCount = validationAvailable() ? 1 : 0;
+  const char **layers = (const char *[]){VALIDATION_LAYER};
   VkApplicationInfo appInfo = {.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
                                .apiVersion = VK_API_VERSION_1_4,
                                .engineVersion = VK_MAKE_VERSION(1, 0, 0),
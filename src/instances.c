@@ -0,0 +1,151 @@
+#include "instances.h"
+#include "frame_pacer.h"
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice,
+                                    uint32_t typeBits,
+                                    VkMemoryPropertyFlags props) {
+  VkPhysicalDeviceMemoryProperties memProps;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProps);
+  for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
+    if (typeBits & (1 << i) &&
+        (memProps.memoryTypes[i].propertyFlags & props) == props) {
+      return i;
+    }
+  }
+  printf("instances: unable to find suitable memory\n");
+  exit(1);
+}
+
+static void markDirty(InstanceBuffer *instances, uint32_t index) {
+  for (uint32_t i = 0; i < FRAME_PACER_MAX_DEPTH; i++) {
+    if (index < instances->dirtyBegin[i]) {
+      instances->dirtyBegin[i] = index;
+    }
+    if (index + 1 > instances->dirtyEnd[i]) {
+      instances->dirtyEnd[i] = index + 1;
+    }
+  }
+}
+
+void instanceBufferInit(InstanceBuffer *instances, VkDevice device,
+                        VkPhysicalDevice physicalDevice, uint32_t capacity) {
+  *instances = (InstanceBuffer){
+      .capacity = capacity,
+      .data = malloc(sizeof(InstanceData) * capacity),
+      .denseToHandle = malloc(sizeof(uint32_t) * capacity),
+      .handleToDense = malloc(sizeof(uint32_t) * capacity),
+      .freeHandles = malloc(sizeof(uint32_t) * capacity),
+  };
+  if (instances->data == NULL || instances->denseToHandle == NULL ||
+      instances->handleToDense == NULL || instances->freeHandles == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  VkDeviceSize size = sizeof(InstanceData) * capacity;
+  for (uint32_t i = 0; i < FRAME_PACER_MAX_DEPTH; i++) {
+    VkBufferCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    if (vkCreateBuffer(device, &info, NULL, &instances->buffers[i]) !=
+        VK_SUCCESS) {
+      printf("failed to create instance buffer\n");
+      exit(1);
+    }
+    VkMemoryRequirements memReq;
+    vkGetBufferMemoryRequirements(device, instances->buffers[i], &memReq);
+    VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memReq.size,
+        .memoryTypeIndex =
+            findMemoryTypeIndex(physicalDevice, memReq.memoryTypeBits,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+    };
+    if (vkAllocateMemory(device, &allocInfo, NULL, &instances->memory[i]) !=
+        VK_SUCCESS) {
+      printf("failed to allocate instance memory\n");
+      exit(1);
+    }
+    vkBindBufferMemory(device, instances->buffers[i], instances->memory[i], 0);
+    vkMapMemory(device, instances->memory[i], 0, size, 0,
+                (void **)&instances->mapped[i]);
+    instances->dirtyBegin[i] = UINT32_MAX;
+    instances->dirtyEnd[i] = 0;
+  }
+}
+
+uint32_t instanceAdd(InstanceBuffer *instances, const InstanceData *data) {
+  if (instances->count == instances->capacity) {
+    return INSTANCE_INVALID;
+  }
+  uint32_t handle = instances->freeCount > 0
+                        ? instances->freeHandles[--instances->freeCount]
+                        : instances->handleCount++;
+  uint32_t index = instances->count++;
+  instances->data[index] = *data;
+  instances->denseToHandle[index] = handle;
+  instances->handleToDense[handle] = index;
+  markDirty(instances, index);
+  return handle;
+}
+
+void instanceRemove(InstanceBuffer *instances, uint32_t handle) {
+  uint32_t index = instances->handleToDense[handle];
+  if (index == INSTANCE_INVALID) {
+    printf("removing dead instance %u\n", handle);
+    exit(1);
+  }
+  uint32_t last = --instances->count;
+  if (index != last) {
+    uint32_t moved = instances->denseToHandle[last];
+    instances->data[index] = instances->data[last];
+    instances->denseToHandle[index] = moved;
+    instances->handleToDense[moved] = index;
+    markDirty(instances, index);
+  }
+  instances->handleToDense[handle] = INSTANCE_INVALID;
+  instances->freeHandles[instances->freeCount++] = handle;
+}
+
+InstanceData *instanceGet(InstanceBuffer *instances, uint32_t handle) {
+  return &instances->data[instances->handleToDense[handle]];
+}
+
+void instanceTouch(InstanceBuffer *instances, uint32_t handle) {
+  markDirty(instances, instances->handleToDense[handle]);
+}
+
+void instanceBufferSync(InstanceBuffer *instances, uint32_t slot) {
+  // entries past count are never read, so the range is clamped to it
+  uint32_t begin = instances->dirtyBegin[slot];
+  uint32_t end = instances->dirtyEnd[slot];
+  if (end > instances->count) {
+    end = instances->count;
+  }
+  if (begin < end) {
+    memcpy(&instances->mapped[slot][begin], &instances->data[begin],
+           sizeof(InstanceData) * (end - begin));
+  }
+  instances->dirtyBegin[slot] = UINT32_MAX;
+  instances->dirtyEnd[slot] = 0;
+}
+
+void instanceBufferDestroy(InstanceBuffer *instances, VkDevice device) {
+  for (uint32_t i = 0; i < FRAME_PACER_MAX_DEPTH; i++) {
+    vkUnmapMemory(device, instances->memory[i]);
+    vkDestroyBuffer(device, instances->buffers[i], NULL);
+    vkFreeMemory(device, instances->memory[i], NULL);
+  }
+  free(instances->data);
+  free(instances->denseToHandle);
+  free(instances->handleToDense);
+  free(instances->freeHandles);
+}
@@ -7,10 +7,29 @@
 #include "cglm/mat4.h"
 #include "cglm/types.h"
 #include "cglm/util.h"
+#include "barrier.h"
+#include "bindless.h"
+#include "bvh.h"
+#include "cull.h"
+#include "device.h"
 #include "file_utils.h"
+#include "frame_pacer.h"
+#include "frame_stats.h"
+#include "dynamic_resolution.h"
+#include "gpu_timer.h"
 #include "instance.h"
+#include "instances.h"
+#include "pipeline_cache.h"
+#include "pipeline_library.h"
+#include "pipeline_stats.h"
+#include "present_latency.h"
+#include "readback.h"
+#include "render_graph.h"
+#include "shader_watch.h"
 #include "stb_image.h"
+#include "timer.h"
 #include "tinyobj_loader_c.h"
+#include "upload.h"
 #include "vulkan/vulkan_core.h"
 #include <GLFW/glfw3.h>
 #include <cglm/affine-mat.h>
@@ -23,13 +42,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <vulkan/vulkan.h>
 
+// Views drawn by --views, side by side along the camera's right axis.
+#define MULTIVIEW_MAX_VIEWS 4
+
+#define MULTIVIEW_EYE_SEPARATION 0.06f
+
+// Mirrors the Views block in shaders/tri.vert and depth.vert.
 typedef struct {
-  mat4 model;
-  mat4 view;
-  mat4 proj;
+  mat4 viewProj[MULTIVIEW_MAX_VIEWS];
 } UniformBufferObject;
 
 typedef struct {
@@ -38,6 +60,149 @@ typedef struct {
   vec2 texture;
 } Vertex;
 
+// Mirrors the push constant block in shaders/cull.comp.
+typedef struct {
+  uint32_t objectCount;
+  uint32_t phase;
+  // late draws start this many commands into the draw buffer
+  uint32_t lateOffset;
+} CullPushConstants;
+
+// Mirrors the CullUniforms block in shaders/cull.comp.
+typedef struct {
+  vec4 planes[6];
+  mat4 viewProj;
+  mat4 prevViewProj;
+  int32_t pyramidSize[2];
+  uint32_t occlusion;
+  uint32_t pad;
+} CullUniforms;
+
+// Mirrors the Counts block in shaders/cull.comp.
+typedef struct {
+  uint32_t drawCount[2];
+  uint32_t candidateCount;
+  uint32_t frustumVisible;
+} CullCounts;
+
+#define CULL_PHASE_EARLY 0
+#define CULL_PHASE_LATE 1
+
+#define CAMERA_NEAR 0.1f
+#define CAMERA_FAR 10.0f
+
+// The froxel grid lights are binned into: screen tiles split into depth
+// slices spaced exponentially between the near and far planes.
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+#define CLUSTER_COUNT (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+
+// Lights one cluster holds; further lights reaching it are dropped.
+#define CLUSTER_MAX_LIGHTS 127
+
+#define LIGHT_MAX 16384
+
+// Lights expected to reach any point of the scene; radii shrink as --lights
+// adds more, so the lights per pixel stay put.
+#define LIGHT_OVERLAP 8.0f
+
+#define LIGHT_INTENSITY 1.5f
+
+#define LIGHT_AMBIENT 0.1f
+
+// Frames per light count in --light-bench, enough for one report of each
+// gpu timer after the queries in flight are dropped.
+#define LIGHT_BENCH_FRAMES                                                    \
+  (GPU_TIMER_REPORT_INTERVAL + 2 * FRAME_PACER_MAX_DEPTH)
+
+// Mirrors Light in shaders/light_bin.comp and tri.frag.
+typedef struct {
+  // scene space position and the radius the light reaches
+  vec4 sphere;
+  vec4 color;
+} Light;
+
+// Mirrors the Clusters block in shaders/light_bin.comp and tri.frag.
+typedef struct {
+  mat4 view[MULTIVIEW_MAX_VIEWS];
+  mat4 invProj;
+  uint32_t grid[4];
+  float slices[4];
+  float ambient;
+  float pad[3];
+} ClusterUniforms;
+
+// Covers a 32768 pixel wide depth pyramid.
+#define HIZ_MAX_LEVELS 16
+
+#define OCCLUSION_REPORT_INTERVAL 300
+
+typedef struct {
+  const char *name;
+  VkSampleCountFlagBits samples;
+  // single-sampled main pass followed by a compute FXAA pass
+  bool fxaa;
+} AaMode;
+
+// Mirrors the push constant block in shaders/fxaa.comp and upscale.comp.
+typedef struct {
+  int32_t region[2];
+  float sharpness;
+} PostPushConstants;
+
+// Mirrors the push constant block in shaders/tri.vert.
+typedef struct {
+  uint32_t viewBase;
+} DrawPushConstants;
+
+typedef enum {
+  SCENE_SHADE,
+  // shading after a depth prepass, tested with EQUAL
+  SCENE_SHADE_EQUAL,
+  // the prepass itself: positions only and no fragment shader
+  SCENE_DEPTH_ONLY,
+} ScenePipelineKind;
+
+// One main pass pipeline, packed into a PipelineLibrary key.
+typedef struct {
+  VkSampleCountFlagBits samples;
+  ScenePipelineKind kind;
+  bool wireframe;
+  // flat grey instead of the material's texture
+  bool untextured;
+  bool alphaTest;
+} SceneVariant;
+
+#define SCENE_KEY_WIREFRAME (1u << 16)
+#define SCENE_KEY_UNTEXTURED (1u << 17)
+#define SCENE_KEY_ALPHA_TEST (1u << 18)
+
+// Mirrors the specialization constants in shaders/tri.frag.
+typedef struct {
+  VkBool32 textured;
+  VkBool32 alphaTest;
+} SceneSpecialization;
+
+// A sampled texture registered in the bindless table.
+typedef struct {
+  VkImage image;
+  VkDeviceMemory memory;
+  TrackedImage tracked;
+  VkImageView view;
+  uint32_t mipLevels;
+  uint32_t slot;
+} Texture;
+
+// Objects cycle through these materials.
+const char *sceneTexturePaths[] = {
+    "assets/viking_room.png",
+    "assets/texture.jpg",
+};
+
+#define SCENE_TEXTURE_COUNT                                                    \
+  (sizeof(sceneTexturePaths) / sizeof(sceneTexturePaths[0]))
+
 GLFWwindow *window;
 
 VkInstance vkInstance;
@@ -46,23 +211,43 @@ VkPhysicalDevice physicalDevice;
 
 VkDevice device;
 
+QueueFamilies queueFamilies;
+
 VkQueue queue;
 
-uint32_t mipLevels;
+VkQueue transferQueue;
+
+// Light binning runs here, overlapping the graphics queue, when the device
+// has a compute family without graphics; otherwise it is a graph pass.
+VkQueue computeQueue;
+
+bool asyncCompute = false;
+
+VkCommandPool computeCommandPool;
+
+VkCommandBuffer computeCommandBuffers[FRAME_PACER_MAX_DEPTH];
 
-VkImage textureImage;
+// signalled with the frame's timeline value once its lists are binned
+VkSemaphore computeTimeline;
 
-VkImageView textureImageView;
+// the compute family may not support timestamps
+bool computeTimestamps = false;
 
-VkImage depthImage;
+Uploader uploader;
 
-VkImageView depthImageView;
+uint64_t uploadWaitValue = 0;
 
-VkDeviceMemory depthImageMemory;
+VkPipelineStageFlags2 uploadWaitStages = 0;
+
+Texture sceneTextures[SCENE_TEXTURE_COUNT];
+
+BarrierBatch frameBarriers;
 
 VkSampler textureSampler;
 
-VkDeviceMemory textureMem;
+uint32_t textureSamplerSlot;
+
+BindlessTable bindless;
 
 VkImage *swapchainImages;
 
@@ -82,8 +267,6 @@ VkSurfaceKHR surface;
 
 VkRenderPass renderPass;
 
-VkPipeline pipeline;
-
 VkFramebuffer *framebuffers;
 
 VkCommandPool commandPool;
@@ -94,7 +277,7 @@ VkSemaphore *imageAvailableSemaphores;
 
 VkSemaphore *renderFinishedSemaphores;
 
-VkFence *inFlight;
+FramePacer framePacer;
 
 VkBuffer vertexBuffer;
 
@@ -118,7 +301,20 @@ VkDescriptorPool descriptorPool;
 
 VkDescriptorSet *descriptorSets;
 
-const int MAX_FRAMES_IN_FLIGHT = 3;
+// per-frame resources are allocated for the deepest supported pacing, the
+// active depth is framePacer.depth
+const int MAX_FRAMES_IN_FLIGHT = FRAME_PACER_MAX_DEPTH;
+
+uint32_t framesInFlight = 3;
+
+FrameClock frameClock;
+
+FrameStats frameStats;
+
+const char *statsCsvPath = NULL;
+
+// boxes for --cull-bench, which runs instead of the renderer when non-zero
+uint32_t cullBenchBoxes = 0;
 
 uint32_t currentFrame = 0;
 
@@ -148,11 +344,329 @@ VkDeviceMemory modelIndicesBufferMemory;
 
 VkSampleCountFlagBits msaaSample = VK_SAMPLE_COUNT_8_BIT;
 
-VkImage colorImage;
+// selected with --aa, cycled with A and clamped to the device's limits
+const AaMode aaModes[] = {
+    {"msaa1", VK_SAMPLE_COUNT_1_BIT, false},
+    {"msaa2", VK_SAMPLE_COUNT_2_BIT, false},
+    {"msaa4", VK_SAMPLE_COUNT_4_BIT, false},
+    {"msaa8", VK_SAMPLE_COUNT_8_BIT, false},
+    {"fxaa", VK_SAMPLE_COUNT_1_BIT, true},
+};
+
+const uint32_t aaModeCount = sizeof(aaModes) / sizeof(aaModes[0]);
+
+uint32_t aaMode = 3;
+
+// switched to between frames, once the device is idle
+uint32_t requestedAaMode = 3;
+
+VkSampleCountFlags supportedSamples;
+
+// FXAA and upscaling blit their result into the swapchain
+bool swapchainTransferDst = false;
+
+// --present-mode picks the mode asked for and M cycles it; presentMode is
+// what the surface allowed, see choosePresentMode
+VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+VkPresentModeKHR presentMode;
+
+// set when the swapchain no longer matches the window or the requested
+// present mode; it is recreated before the next frame
+bool swapchainDirty = false;
+
+#define MAX_RETIRED_SWAPCHAINS 4
+
+// Swapchain objects replaced by recreateSwapchain. Frames in flight may still
+// use them, so they are destroyed once the frame timeline reaches value.
+typedef struct {
+  VkSwapchainKHR swapchain;
+  VkImage *images;
+  VkImageView *views;
+  VkFramebuffer *framebuffers;
+  VkSemaphore *renderFinished;
+  uint32_t imageCount;
+  // the frame graph and depth pyramid it replaced, when the extent changed
+  RenderGraph *frameGraph;
+  VkImage depthPyramid;
+  VkDeviceMemory depthPyramidMemory;
+  VkImageView depthPyramidView;
+  VkImageView depthPyramidMips[HIZ_MAX_LEVELS];
+  uint32_t depthPyramidLevels;
+  uint64_t value;
+} RetiredSwapchain;
+
+RetiredSwapchain retiredSwapchains[MAX_RETIRED_SWAPCHAINS];
+uint32_t retiredSwapchainCount = 0;
+
+// VK_KHR_present_id and VK_KHR_present_wait, for presentLatency
+bool presentWaitSupported = false;
+
+PresentLatency presentLatency;
+
+// when the CPU started the frame being recorded
+uint64_t frameStartNs;
+
+// the single-sampled scene an MSAA pass resolves into when rendering offscreen
+uint32_t rgScene;
+
+uint32_t rgAaOutput;
+
+uint32_t rgUpscaled;
+
+// whichever image the blit copies into the swapchain
+uint32_t rgPostOutput;
+
+// shared by the FXAA and upscale passes
+VkDescriptorSetLayout postDescriptorLayout;
+
+VkPipelineLayout postPipelineLayout;
+
+VkSampler postSampler;
+
+VkPipeline fxaaPipeline;
+
+VkDescriptorSet fxaaDescriptorSets[FRAME_PACER_MAX_DEPTH];
+
+VkPipeline upscalePipeline;
+
+VkDescriptorSet upscaleDescriptorSets[FRAME_PACER_MAX_DEPTH];
+
+// --dynamic-resolution renders offscreen at a scale picked from GPU time
+bool dynamicResolution = false;
+
+float frameBudgetMs = 16.6f;
+
+// 0 is a plain bilinear upscale, set by --upscale sharpen
+float upscaleSharpness = 0.0f;
+
+DynamicResolution dynRes;
+
+// the part of the render targets the scene is drawn into this frame
+VkExtent2D renderExtent;
+
+GpuTimer gpuTimer;
+
+// instances placed by the scene, --objects or --stress
+uint32_t objectCount = 1;
+
+InstanceBuffer instances;
+
+uint32_t *sceneHandles;
+
+// re-adds one instance per frame to keep compaction exercised
+bool stressScene = false;
+
+// scene objects by sceneHandles index, for picking
+Bvh sceneBvh;
+
+vec3 *sceneBoxes;
+
+// proj * view * model of the last updated frame
+mat4 sceneViewProj;
+
+// --dynamic-rendering records the main pass with vkCmdBeginRendering, so no
+// render pass or framebuffers are created
+bool dynamicRendering = false;
+
+// --views renders this many views into the layers of the scene targets, in
+// one multiview pass unless --view-passes draws each in a pass of its own
+uint32_t viewCount = 1;
+
+bool viewPasses = false;
+
+// P toggles a depth-only prepass; the main pass then shades with EQUAL
+bool depthPrepass = false;
+
+// W toggles line rasterization, where the device has fillModeNonSolid
+bool wireframe = false;
+
+// T toggles texturing, C alpha testing against the texture's alpha
+bool texturing = true;
+
+bool alphaTest = false;
+
+bool wireframeSupported = false;
+
+// Compiled for every supported sample count at startup.
+const SceneVariant sceneVariants[] = {
+    {.kind = SCENE_SHADE},
+    {.kind = SCENE_SHADE_EQUAL},
+    {.kind = SCENE_DEPTH_ONLY},
+    {.kind = SCENE_SHADE, .wireframe = true},
+    {.kind = SCENE_SHADE, .untextured = true},
+    {.kind = SCENE_SHADE_EQUAL, .untextured = true},
+    // the prepass has no fragment shader to discard with, so alpha tested
+    // geometry is drawn without one
+    {.kind = SCENE_SHADE, .alphaTest = true},
+};
+
+PipelineLibrary pipelineLibrary;
+
+// --hot-reload recompiles edited shaders and rebuilds the scene variants
+// that use them while running
+bool hotReload = false;
+
+ShaderWatcher shaderWatcher;
+
+// --headless renders this many frames into offscreen images without a window,
+// surface or swapchain
+bool headless = false;
+uint32_t headlessFrames = 0;
+
+// --readback writes the last headless frame to this path as a PPM
+const char *readbackPath = NULL;
+
+// backs swapchainImages in headless mode
+VkDeviceMemory *offscreenImageMemory;
+
+// --capture streams every presented frame to this path, see Readback
+const char *capturePath = NULL;
+Readback readback;
+
+// Scene pipelines are created against these, one per sample count; each is
+// compatible with the main render passes of its count.
+VkRenderPass variantRenderPasses[4];
+
+// the current sample count's plain shading variant
+PipelineFuture *shadeFuture;
+
+// picked once per frame so both main pass phases agree; a variant that is
+// still compiling is replaced by its fallback
+VkPipeline frameShadePipeline;
+
+VkPipeline framePrepassPipeline;
+
+// tightly packed positions for the prepass
+VkBuffer positionBuffer;
+
+VkDeviceMemory positionBufferMemory;
+
+PipelineStats pipelineStats;
+
+// without the feature the pool is never created or issued, so collecting and
+// destroying it are no-ops; the prepass toggle still works
+bool pipelineStatsSupported = false;
+
+PipelineCache pipelineCache;
+
+// prims for --bvh-bench, which runs instead of the renderer when non-zero
+uint32_t bvhBenchPrims = 0;
+
+VkBuffer *drawCommandBuffers;
+
+VkDeviceMemory *drawCommandMemoryList;
+
+VkBuffer *drawCountBuffers;
+
+VkDeviceMemory *drawCountMemoryList;
+
+VkDescriptorSetLayout cullDescriptorLayout;
+
+VkPipelineLayout cullPipelineLayout;
+
+VkPipeline cullPipeline;
+
+VkDescriptorSet *cullDescriptorSets;
+
+vec4 cullPlanes[6];
+
+// host visible so the frame pacer can read back the counts of retired slots
+void **drawCountMapped;
+
+VkBuffer *cullCandidateBuffers;
+
+VkDeviceMemory *cullCandidateMemoryList;
+
+VkBuffer *cullUniformBuffers;
 
-VkDeviceMemory colorImageMemory;
+VkDeviceMemory *cullUniformMemoryList;
 
-VkImageView colorImageView;
+void **cullUniformsMapped;
+
+// toggled with O; off, every object in the frustum is drawn early
+bool occlusionCulling = true;
+
+// --lights; they move every frame, so each slot has its own copy
+uint32_t lightCount = 0;
+
+// --light-bench steps lightCount through these in a headless run
+const uint32_t lightBenchCounts[] = {1, 10, 100, 1000, 10000};
+
+bool lightBench = false;
+
+VkBuffer *lightBuffers;
+
+VkDeviceMemory *lightMemoryList;
+
+void **lightsMapped;
+
+VkBuffer *clusterUniformBuffers;
+
+VkDeviceMemory *clusterUniformMemoryList;
+
+void **clusterUniformsMapped;
+
+// per view and cluster a count followed by CLUSTER_MAX_LIGHTS indices
+VkBuffer *clusterLightBuffers;
+
+VkDeviceMemory *clusterLightMemoryList;
+
+VkPipelineLayout lightBinPipelineLayout;
+
+VkPipeline lightBinPipeline;
+
+GpuTimer lightBinTimer;
+
+// bounds of every object, which the lights are spread through
+vec3 sceneMin;
+
+vec3 sceneMax;
+
+// the view-projection the depth pyramid was last built with
+mat4 prevViewProj = GLM_MAT4_IDENTITY_INIT;
+
+// Farthest depth per texel over the previous frame's early draws, kept in
+// GENERAL for both storage writes and sampling. Mip 0 is the full extent
+// whatever the render scale.
+VkImage depthPyramid;
+
+VkDeviceMemory depthPyramidMemory;
+
+VkImageView depthPyramidView;
+
+VkImageView depthPyramidMips[HIZ_MAX_LEVELS];
+
+uint32_t depthPyramidLevels;
+
+// a new pyramid is cleared by the next frame's cull pass
+bool depthPyramidCleared = false;
+
+VkDescriptorSet hizDescriptorSets[FRAME_PACER_MAX_DEPTH][HIZ_MAX_LEVELS];
+
+// Per frame slot, whether its post, hi-z and cull sets still point at
+// replaced render targets. A slot's sets are only rewritten once the frame
+// that last used them has retired, so resizing never waits for the GPU.
+bool attachmentSetsStale[FRAME_PACER_MAX_DEPTH];
+
+VkPipeline hizReducePipeline;
+
+VkPipeline hizResolvePipeline;
+
+uint64_t occlusionFrames = 0;
+
+double occlusionCulledSum = 0.0;
+
+VkRenderPass lateRenderPass;
+
+RenderGraph frameGraph;
+
+uint32_t rgSwapchain;
+
+uint32_t rgColor;
+
+uint32_t rgDepth;
+
+uint32_t currentImageIndex;
 
 Vertex vertices[] = {
     {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {1.0f, 0.0f}},
@@ -175,20 +689,35 @@ void createDescriptorSetLayout() {
       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
       .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
   };
-  VkDescriptorSetLayoutBinding samplerLayoutBinding = {
-      .binding = 1,
+  VkDescriptorSetLayoutBinding objectLayoutBinding = {
+      .binding = 2,
       .descriptorCount = 1,
-      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      .pImmutableSamplers = NULL,
-      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
   };
+  // cluster uniforms, lights and cluster lists, written by the light
+  // binning pass and read when shading
+  VkDescriptorSetLayoutBinding clusterBindings[3];
+  for (uint32_t i = 0; i < 3; i++) {
+    clusterBindings[i] = (VkDescriptorSetLayoutBinding){
+        .binding = 3 + i,
+        .descriptorCount = 1,
+        .descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+                                 : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .stageFlags =
+            VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+    };
+  }
   VkDescriptorSetLayoutBinding bindings[] = {
       uboLayoutBinding,
-      samplerLayoutBinding,
+      objectLayoutBinding,
+      clusterBindings[0],
+      clusterBindings[1],
+      clusterBindings[2],
   };
   VkDescriptorSetLayoutCreateInfo info = {
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-      .bindingCount = 2,
+      .bindingCount = 5,
       .pBindings = bindings,
   };
   if (vkCreateDescriptorSetLayout(device, &info, NULL, &descriptorLayout) !=
@@ -198,6 +727,59 @@ void createDescriptorSetLayout() {
   };
 }
 
+// objects, draws, counts and candidates, then the cull uniforms and the
+// depth pyramid
+void createCullDescriptorSetLayout() {
+  VkDescriptorSetLayoutBinding bindings[6];
+  for (uint32_t i = 0; i < 6; i++) {
+    bindings[i] = (VkDescriptorSetLayoutBinding){
+        .binding = i,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    };
+  }
+  bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  bindings[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  VkDescriptorSetLayoutCreateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = 6,
+      .pBindings = bindings,
+  };
+  if (vkCreateDescriptorSetLayout(device, &info, NULL,
+                                  &cullDescriptorLayout) != VK_SUCCESS) {
+    printf("Unable to create cull descriptor set layout\n");
+    exit(1);
+  };
+}
+
+void createPostDescriptorSetLayout() {
+  VkDescriptorSetLayoutBinding bindings[] = {
+      {
+          .binding = 0,
+          .descriptorCount = 1,
+          .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      },
+      {
+          .binding = 1,
+          .descriptorCount = 1,
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+          .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      },
+  };
+  VkDescriptorSetLayoutCreateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = 2,
+      .pBindings = bindings,
+  };
+  if (vkCreateDescriptorSetLayout(device, &info, NULL,
+                                  &postDescriptorLayout) != VK_SUCCESS) {
+    printf("Unable to create post descriptor set layout\n");
+    exit(1);
+  };
+}
+
 VkVertexInputBindingDescription getVertexBindDesc() {
   VkVertexInputBindingDescription desc = {
       .binding = 0,
@@ -267,74 +849,53 @@ VkCommandBuffer beginSingleTimeCommands() {
   return commandBuffer;
 }
 
-void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+// Submits on the graphics queue after the upload timeline reached
+// uploadValue, 0 means no dependency on the transfer queue.
+void endSingleTimeCommandsAfterUpload(VkCommandBuffer commandBuffer,
+                                      uint64_t uploadValue,
+                                      VkPipelineStageFlags2 waitStages) {
   vkEndCommandBuffer(commandBuffer);
-  VkSubmitInfo submitInfo = {
-      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .commandBufferCount = 1,
-      .pCommandBuffers = &commandBuffer,
+  VkCommandBufferSubmitInfo cmdInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+      .commandBuffer = commandBuffer,
+  };
+  VkSemaphoreSubmitInfo waitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+      .semaphore = uploader.timeline,
+      .value = uploadValue,
+      .stageMask = waitStages,
+  };
+  VkSubmitInfo2 submitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+      .waitSemaphoreInfoCount = uploadValue > 0 ? 1 : 0,
+      .pWaitSemaphoreInfos = &waitInfo,
+      .commandBufferInfoCount = 1,
+      .pCommandBufferInfos = &cmdInfo,
   };
-  vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+  vkQueueSubmit2(queue, 1, &submitInfo, VK_NULL_HANDLE);
   vkQueueWaitIdle(queue);
   vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 }
 
-void transitionImageLayout(VkImage image, VkFormat format,
-                           VkImageLayout oldLayout, VkImageLayout newLayout,
-                           uint32_t mipLevels) {
-  VkCommandBuffer cmdBuff = beginSingleTimeCommands();
-  VkImageMemoryBarrier barrier = {
-      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-      .oldLayout = oldLayout,
-      .newLayout = newLayout,
-      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .image = image,
-      .subresourceRange = {
-          .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-          .baseMipLevel = 0,
-          .levelCount = mipLevels,
-          .baseArrayLayer = 0,
-          .layerCount = 1,
-      }};
-  VkPipelineStageFlags sourceStage;
-  VkPipelineStageFlags destinationStage;
-  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-      newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-  } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-             newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  } else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-             newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
-                            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-  } else {
-    printf("unsupported ransistion\n");
-    exit(1);
-  }
-  vkCmdPipelineBarrier(cmdBuff, sourceStage, destinationStage, 0, 0, NULL, 0,
-                       NULL, 1, &barrier);
-  endSingleTimeCommands(cmdBuff);
+void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+  endSingleTimeCommandsAfterUpload(commandBuffer, 0, 0);
 }
 
-void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
-                  VkMemoryPropertyFlags props, VkBuffer *buffer,
-                  VkDeviceMemory *memory) {
+// Usable by every queue family in families without ownership transfers;
+// with fewer than two it is exclusive like any other buffer.
+void createSharedBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                        VkMemoryPropertyFlags props, const uint32_t *families,
+                        uint32_t familyCount, VkBuffer *buffer,
+                        VkDeviceMemory *memory) {
+  bool shared = familyCount > 1;
   VkBufferCreateInfo info = {
       .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
       .size = size,
       .usage = usage,
-      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .sharingMode =
+          shared ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+      .queueFamilyIndexCount = shared ? familyCount : 0,
+      .pQueueFamilyIndices = shared ? families : NULL,
   };
   if (vkCreateBuffer(device, &info, NULL, buffer) != VK_SUCCESS) {
     printf("error creating buffer\n");
@@ -355,58 +916,45 @@ void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
   vkBindBufferMemory(device, *buffer, *memory, 0);
 }
 
-void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-  VkCommandBufferAllocateInfo allocInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-      .commandPool = commandPool,
-      .commandBufferCount = 1,
-  };
-  VkCommandBuffer commandBuffer;
-  vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-  VkCommandBufferBeginInfo beginInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-  };
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
-  VkBufferCopy copyRegion = {
-      .srcOffset = 0,
-      .dstOffset = 0,
-      .size = size,
-  };
-  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-  vkEndCommandBuffer(commandBuffer);
-  VkSubmitInfo submitInfo = {
-      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .commandBufferCount = 1,
-      .pCommandBuffers = &commandBuffer,
-  };
-  vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(queue);
-  vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                  VkMemoryPropertyFlags props, VkBuffer *buffer,
+                  VkDeviceMemory *memory) {
+  createSharedBuffer(size, usage, props, NULL, 0, buffer, memory);
 }
 
-void createIndexBuffer() {
-  VkDeviceSize size = sizeof(uint32_t) * 12;
+// Copies data into dst through a staging buffer on the transfer queue. The
+// copy runs asynchronously; the next frame acquires dst for dstAccess.
+void uploadBuffer(const void *src, VkDeviceSize size, VkBuffer dst,
+                  VkAccessFlags2 dstAccess, VkPipelineStageFlags2 dstStage) {
   VkBuffer stage;
   VkDeviceMemory stageMemory;
   createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                &stage, &stageMemory);
-
   void *data;
   vkMapMemory(device, stageMemory, 0, size, 0, &data);
-  memcpy(data, indices, size);
+  memcpy(data, src, size);
   vkUnmapMemory(device, stageMemory);
 
+  VkCommandBuffer commandBuffer = uploaderBegin(&uploader, device);
+  VkBufferCopy copyRegion = {
+      .srcOffset = 0,
+      .dstOffset = 0,
+      .size = size,
+  };
+  vkCmdCopyBuffer(commandBuffer, stage, dst, 1, &copyRegion);
+  uploaderReleaseBuffer(&uploader, commandBuffer, dst, dstAccess, dstStage);
+  uploaderSubmit(&uploader, commandBuffer, stage, stageMemory);
+}
+
+void createIndexBuffer() {
+  VkDeviceSize size = sizeof(uint32_t) * 12;
   createBuffer(
       size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
-
-  copyBuffer(stage, indexBuffer, size);
-  vkDestroyBuffer(device, stage, NULL);
-  vkFreeMemory(device, stageMemory, NULL);
+  uploadBuffer(indices, size, indexBuffer, VK_ACCESS_2_INDEX_READ_BIT,
+               VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT);
   printf("created index buffer\n");
 }
 
@@ -439,23 +987,38 @@ void createUniformBuffers() {
 }
 
 void createDescriptorPool() {
+  // the scene, cull and cluster uniforms
   VkDescriptorPoolSize poolSize = {
       .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-      .descriptorCount = MAX_FRAMES_IN_FLIGHT,
+      .descriptorCount = MAX_FRAMES_IN_FLIGHT * 3,
   };
+  // per frame the depth pyramid, then one input and output per post pass
+  // and pyramid level; textures live in the bindless table
   VkDescriptorPoolSize samplerPoolSize = {
       .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      .descriptorCount = MAX_FRAMES_IN_FLIGHT,
+      .descriptorCount = MAX_FRAMES_IN_FLIGHT * (3 + HIZ_MAX_LEVELS),
+  };
+  VkDescriptorPoolSize storageImagePoolSize = {
+      .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .descriptorCount = MAX_FRAMES_IN_FLIGHT * (2 + HIZ_MAX_LEVELS),
+  };
+  // objects, lights and cluster lists for the scene, objects/draws/count/
+  // candidates for culling
+  VkDescriptorPoolSize storagePoolSize = {
+      .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = MAX_FRAMES_IN_FLIGHT * 7,
   };
   VkDescriptorPoolSize poolSizes[] = {
       poolSize,
       samplerPoolSize,
+      storagePoolSize,
+      storageImagePoolSize,
   };
   VkDescriptorPoolCreateInfo info = {
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-      .poolSizeCount = 2,
+      .poolSizeCount = 4,
       .pPoolSizes = poolSizes,
-      .maxSets = MAX_FRAMES_IN_FLIGHT,
+      .maxSets = MAX_FRAMES_IN_FLIGHT * (4 + HIZ_MAX_LEVELS),
   };
   if (vkCreateDescriptorPool(device, &info, NULL, &descriptorPool) !=
       VK_SUCCESS) {
@@ -499,27 +1062,254 @@ void createDescriptorSets() {
         .descriptorCount = 1,
         .pBufferInfo = &bufferInfo,
     };
-    VkDescriptorImageInfo imageInfo = {
-        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        .imageView = textureImageView,
-        .sampler = textureSampler,
+    VkDescriptorBufferInfo objectInfo = {
+        .buffer = instances.buffers[i],
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
     };
-    VkWriteDescriptorSet samplerWrite = {
+    VkWriteDescriptorSet objectWrite = {
         .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
         .dstSet = descriptorSets[i],
-        .dstBinding = 1,
+        .dstBinding = 2,
         .dstArrayElement = 0,
-        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
         .descriptorCount = 1,
-        .pImageInfo = &imageInfo};
-
-    VkWriteDescriptorSet writes[] = {bufferWrite, samplerWrite};
-    vkUpdateDescriptorSets(device, 2, writes, 0, NULL);
+        .pBufferInfo = &objectInfo,
+    };
+    VkDescriptorBufferInfo clusterInfos[] = {
+        {clusterUniformBuffers[i], 0, sizeof(ClusterUniforms)},
+        {lightBuffers[i], 0, VK_WHOLE_SIZE},
+        {clusterLightBuffers[i], 0, VK_WHOLE_SIZE},
+    };
+    VkWriteDescriptorSet writes[5] = {bufferWrite, objectWrite};
+    for (uint32_t j = 0; j < 3; j++) {
+      writes[2 + j] = (VkWriteDescriptorSet){
+          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+          .dstSet = descriptorSets[i],
+          .dstBinding = 3 + j,
+          .dstArrayElement = 0,
+          .descriptorType = j == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+                                   : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .descriptorCount = 1,
+          .pBufferInfo = &clusterInfos[j],
+      };
+    }
+    vkUpdateDescriptorSets(device, 5, writes, 0, NULL);
   }
 }
 
-void createImage(uint32_t width, uint32_t height, uint32_t mipLevels,
-                 VkSampleCountFlagBits numSamples, VkFormat format,
+void createPostDescriptorSets() {
+  VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    layouts[i] = postDescriptorLayout;
+  }
+  VkDescriptorSetAllocateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = descriptorPool,
+      .descriptorSetCount = MAX_FRAMES_IN_FLIGHT,
+      .pSetLayouts = layouts,
+  };
+  if (vkAllocateDescriptorSets(device, &info, fxaaDescriptorSets) !=
+          VK_SUCCESS ||
+      vkAllocateDescriptorSets(device, &info, upscaleDescriptorSets) !=
+          VK_SUCCESS) {
+    printf("Unable to allocate post descriptor sets\n");
+    exit(1);
+  }
+}
+
+void writePostDescriptorSet(VkDescriptorSet set, uint32_t input,
+                            uint32_t output) {
+  VkDescriptorImageInfo inputInfo = {
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      .imageView = rgView(&frameGraph, input),
+      .sampler = postSampler,
+  };
+  VkDescriptorImageInfo outputInfo = {
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+      .imageView = rgView(&frameGraph, output),
+  };
+  VkWriteDescriptorSet writes[] = {
+      {
+          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+          .dstSet = set,
+          .dstBinding = 0,
+          .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          .descriptorCount = 1,
+          .pImageInfo = &inputInfo,
+      },
+      {
+          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+          .dstSet = set,
+          .dstBinding = 1,
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+          .descriptorCount = 1,
+          .pImageInfo = &outputInfo,
+      },
+  };
+  vkUpdateDescriptorSets(device, 2, writes, 0, NULL);
+}
+
+// Points a frame slot's post passes at the graph's current images.
+void updatePostDescriptorSets(uint32_t slot) {
+  uint32_t input = msaaSample == VK_SAMPLE_COUNT_1_BIT ? rgColor : rgScene;
+  if (aaModes[aaMode].fxaa) {
+    writePostDescriptorSet(fxaaDescriptorSets[slot], input, rgAaOutput);
+    input = rgAaOutput;
+  }
+  if (dynamicResolution) {
+    writePostDescriptorSet(upscaleDescriptorSets[slot], input, rgUpscaled);
+  }
+}
+
+// One set per frame slot and level of the deepest pyramid, so a resize
+// never reallocates.
+void createHizDescriptorSets() {
+  VkDescriptorSetLayout layouts[HIZ_MAX_LEVELS];
+  for (uint32_t i = 0; i < HIZ_MAX_LEVELS; i++) {
+    layouts[i] = postDescriptorLayout;
+  }
+  VkDescriptorSetAllocateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = descriptorPool,
+      .descriptorSetCount = HIZ_MAX_LEVELS,
+      .pSetLayouts = layouts,
+  };
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    if (vkAllocateDescriptorSets(device, &info, hizDescriptorSets[i]) !=
+        VK_SUCCESS) {
+      printf("Unable to allocate hi-z descriptor sets\n");
+      exit(1);
+    }
+  }
+}
+
+// Set 0 reads the graph's depth into mip 0, set i reduces mip i - 1 into
+// mip i.
+void updateHizDescriptorSets(uint32_t slot) {
+  for (uint32_t i = 0; i < depthPyramidLevels; i++) {
+    VkDescriptorImageInfo inputInfo = {
+        .imageLayout = i == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                              : VK_IMAGE_LAYOUT_GENERAL,
+        .imageView = i == 0 ? rgLayerView(&frameGraph, rgDepth, 0)
+                            : depthPyramidMips[i - 1],
+        .sampler = postSampler,
+    };
+    VkDescriptorImageInfo outputInfo = {
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .imageView = depthPyramidMips[i],
+    };
+    VkWriteDescriptorSet writes[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = hizDescriptorSets[slot][i],
+            .dstBinding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = 1,
+            .pImageInfo = &inputInfo,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = hizDescriptorSets[slot][i],
+            .dstBinding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .descriptorCount = 1,
+            .pImageInfo = &outputInfo,
+        },
+    };
+    vkUpdateDescriptorSets(device, 2, writes, 0, NULL);
+  }
+}
+
+void createCullDescriptorSets() {
+  VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    layouts[i] = cullDescriptorLayout;
+  }
+  cullDescriptorSets = malloc(sizeof(VkDescriptorSet) * MAX_FRAMES_IN_FLIGHT);
+  if (cullDescriptorSets == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  VkDescriptorSetAllocateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = descriptorPool,
+      .descriptorSetCount = MAX_FRAMES_IN_FLIGHT,
+      .pSetLayouts = layouts,
+  };
+  if (vkAllocateDescriptorSets(device, &info, cullDescriptorSets) !=
+      VK_SUCCESS) {
+    printf("Unable to allocate cull descriptor sets\n");
+    exit(1);
+  }
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    VkDescriptorBufferInfo bufferInfos[] = {
+        {.buffer = instances.buffers[i], .offset = 0, .range = VK_WHOLE_SIZE},
+        {.buffer = drawCommandBuffers[i], .offset = 0, .range = VK_WHOLE_SIZE},
+        {.buffer = drawCountBuffers[i], .offset = 0, .range = VK_WHOLE_SIZE},
+        {.buffer = cullCandidateBuffers[i],
+         .offset = 0,
+         .range = VK_WHOLE_SIZE},
+        {.buffer = cullUniformBuffers[i], .offset = 0, .range = VK_WHOLE_SIZE},
+    };
+    VkWriteDescriptorSet writes[5];
+    for (uint32_t b = 0; b < 5; b++) {
+      writes[b] = (VkWriteDescriptorSet){
+          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+          .dstSet = cullDescriptorSets[i],
+          .dstBinding = b,
+          .dstArrayElement = 0,
+          .descriptorType = b == 4 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+                                   : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .descriptorCount = 1,
+          .pBufferInfo = &bufferInfos[b],
+      };
+    }
+    vkUpdateDescriptorSets(device, 5, writes, 0, NULL);
+  }
+}
+
+// The depth pyramid the cull passes sample; written with the other
+// attachment sets.
+void updateCullPyramidDescriptor(uint32_t slot) {
+  VkDescriptorImageInfo pyramidInfo = {
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+      .imageView = depthPyramidView,
+      .sampler = postSampler,
+  };
+  VkWriteDescriptorSet write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = cullDescriptorSets[slot],
+      .dstBinding = 5,
+      .dstArrayElement = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = 1,
+      .pImageInfo = &pyramidInfo,
+  };
+  vkUpdateDescriptorSets(device, 1, &write, 0, NULL);
+}
+
+// Every slot picks up the current render targets and depth pyramid when it
+// next records.
+void markAttachmentSetsStale() {
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    attachmentSetsStale[i] = true;
+  }
+}
+
+// Must only be called once the slot's previous frame has retired.
+void updateAttachmentSets(uint32_t slot) {
+  if (!attachmentSetsStale[slot]) {
+    return;
+  }
+  updatePostDescriptorSets(slot);
+  updateHizDescriptorSets(slot);
+  updateCullPyramidDescriptor(slot);
+  attachmentSetsStale[slot] = false;
+}
+
+void createImage(uint32_t width, uint32_t height, uint32_t mipLevels,
+                 VkSampleCountFlagBits numSamples, VkFormat format,
                  VkImageTiling tiling, VkImageUsageFlags usage,
                  VkMemoryPropertyFlags props, VkImage *image,
                  VkDeviceMemory *imageMemory) {
@@ -560,9 +1350,8 @@ void createImage(uint32_t width, uint32_t height, uint32_t mipLevels,
   vkBindImageMemory(device, *image, *imageMemory, 0);
 }
 
-void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                       uint32_t height) {
-  VkCommandBuffer cmdBuff = beginSingleTimeCommands();
+void copyBufferToImage(VkCommandBuffer cmdBuff, VkBuffer buffer, VkImage image,
+                       uint32_t width, uint32_t height) {
   VkBufferImageCopy region = {
       .bufferOffset = 0,
       .bufferRowLength = 0,
@@ -579,39 +1368,31 @@ void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
   };
   vkCmdCopyBufferToImage(cmdBuff, buffer, image,
                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-  endSingleTimeCommands(cmdBuff);
 }
 
-void generateMipmaps(VkImage image, uint32_t texWidth, uint32_t texHeight,
-                     uint32_t mipLevels) {
+void generateMipmaps(TrackedImage *image, uint32_t texWidth,
+                     uint32_t texHeight, uint32_t mipLevels) {
   printf("generateMipmaps\n");
   // Skip checking physical device format capabilities
   VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-  VkImageMemoryBarrier barrier = {
-      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-      .image = image,
-      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .subresourceRange =
-          {
-              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-              .baseArrayLayer = 0,
-              .layerCount = 1,
-              .levelCount = 1,
-          },
-  };
+  // blits need the graphics queue, take the image over from the transfer queue
+  VkPipelineStageFlags2 waitStages = 0;
+  uint64_t uploadValue =
+      uploaderFlushAcquires(&uploader, commandBuffer, &waitStages);
+  // the acquire made every level available to blits; later transitions
+  // chain off its blit stage
+  setImageState(image, 0, mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_NONE);
+  BarrierBatch batch = {0};
   uint32_t mipWidth = texWidth;
   uint32_t mipHeight = texHeight;
   for (uint32_t i = 1; i < mipLevels; i++) {
     printf("mipHeight %d, mipWidth: %d\n", mipHeight, mipWidth);
-    barrier.subresourceRange.baseMipLevel = i - 1;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
-                         &barrier);
+    barrierImage(&batch, image, i - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                 VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+    barrierImage(&batch, image, i, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                 VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+    barrierFlush(&batch, commandBuffer);
     VkImageBlit blit = {
         .srcOffsets[0] = {0, 0, 0},
         .srcOffsets[1] = {mipWidth, mipHeight, 1},
@@ -637,16 +1418,10 @@ void generateMipmaps(VkImage image, uint32_t texWidth, uint32_t texHeight,
                 .layerCount = 1,
             },
     };
-    vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                   image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+    vkCmdBlitImage(commandBuffer, image->image,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image->image,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
                    VK_FILTER_LINEAR);
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0,
-                         NULL, 1, &barrier);
     if (mipWidth > 1) {
       mipWidth /= 2;
     }
@@ -654,22 +1429,26 @@ void generateMipmaps(VkImage image, uint32_t texWidth, uint32_t texHeight,
       mipHeight /= 2;
     }
   }
-  barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0,
-                       NULL, 1, &barrier);
-  endSingleTimeCommands(commandBuffer);
+  // all levels move to shader read in one batch once the chain is done
+  barrierImage(&batch, image, 0, mipLevels,
+               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+               VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+               VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+  barrierFlush(&batch, commandBuffer);
+  barrierBatchDestroy(&batch);
+  endSingleTimeCommandsAfterUpload(commandBuffer, uploadValue, waitStages);
 }
 
-void createTextureImage() {
+void createTextureImage(Texture *texture, const char *path) {
   int texWidth, texHeight, texChannels;
-  stbi_uc *pixels = stbi_load("assets/viking_room.png", &texWidth, &texHeight,
-                              &texChannels, STBI_rgb_alpha);
-  mipLevels = ((uint32_t)floor(log2(max(texWidth, texHeight)))) + 1;
+  stbi_uc *pixels =
+      stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+  if (pixels == NULL) {
+    printf("failed to load texture %s\n", path);
+    exit(1);
+  }
+  uint32_t mipLevels = ((uint32_t)floor(log2(max(texWidth, texHeight)))) + 1;
+  texture->mipLevels = mipLevels;
   VkDeviceSize dSize = texWidth * texHeight * 4;
   VkBuffer stage;
   VkDeviceMemory stageMem;
@@ -689,12 +1468,31 @@ void createTextureImage() {
                   VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-              &textureImage, &textureMem);
-  transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-                        VK_IMAGE_LAYOUT_UNDEFINED,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-  copyBufferToImage(stage, textureImage, texWidth, texHeight);
-  generateMipmaps(textureImage, texWidth, texHeight, mipLevels);
+              &texture->image, &texture->memory);
+  VkImageSubresourceRange range = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel = 0,
+      .levelCount = mipLevels,
+      .baseArrayLayer = 0,
+      .layerCount = 1,
+  };
+  trackImage(&texture->tracked, texture->image, VK_IMAGE_ASPECT_COLOR_BIT,
+             mipLevels, 1);
+  VkCommandBuffer cmdBuff = uploaderBegin(&uploader, device);
+  BarrierBatch batch = {0};
+  barrierImage(&batch, &texture->tracked, 0, mipLevels,
+               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+               VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+  barrierFlush(&batch, cmdBuff);
+  barrierBatchDestroy(&batch);
+  copyBufferToImage(cmdBuff, stage, texture->image, texWidth, texHeight);
+  uploaderReleaseImage(&uploader, cmdBuff, texture->image, range,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_ACCESS_2_TRANSFER_READ_BIT |
+                           VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_2_BLIT_BIT);
+  uploaderSubmit(&uploader, cmdBuff, stage, stageMem);
+  generateMipmaps(&texture->tracked, texWidth, texHeight, mipLevels);
 }
 
 void createTextureSampler() {
@@ -715,7 +1513,8 @@ void createTextureSampler() {
       .compareOp = VK_COMPARE_OP_ALWAYS,
       .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
       .minLod = 0.0f,
-      .maxLod = (float)mipLevels,
+      // shared by textures with different mip counts
+      .maxLod = VK_LOD_CLAMP_NONE,
       .mipLodBias = 0.0f,
   };
   if (vkCreateSampler(device, &samplerInfo, NULL, &textureSampler) !=
@@ -726,25 +1525,14 @@ void createTextureSampler() {
 }
 
 void createVertexBuffer() {
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingMemory;
   VkDeviceSize bufferSize = sizeof(Vertex) * 8;
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               &stagingBuffer, &stagingMemory);
-
-  void *data;
-  vkMapMemory(device, stagingMemory, 0, bufferSize, 0, &data);
-  memcpy(data, vertices, bufferSize);
-  vkUnmapMemory(device, stagingMemory);
   createBuffer(
       bufferSize,
       VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
-  copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
-  vkDestroyBuffer(device, stagingBuffer, NULL);
-  vkFreeMemory(device, stagingMemory, NULL);
+  uploadBuffer(vertices, bufferSize, vertexBuffer,
+               VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT,
+               VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT);
 }
 
 void pickPhysicalDevice() {
@@ -756,42 +1544,176 @@ void pickPhysicalDevice() {
   }
   VkPhysicalDevice devices[deviceCount];
   vkEnumeratePhysicalDevices(vkInstance, &deviceCount, devices);
-  // skipped queue introspection logic for simplicity
   physicalDevice = devices[0];
   printf("selected physical device: %p\n", physicalDevice);
+  queueFamilies = findQueueFamilies(physicalDevice, surface);
+}
+
+// Exits naming a feature the renderer cannot run without.
+void requireFeature(VkBool32 supported, const char *name) {
+  if (!supported) {
+    printf("device does not support %s\n", name);
+    exit(1);
+  }
+}
+
+// The bindless table is one update-after-bind set seen by the fragment
+// stage, so both its per-set and per-stage limits apply.
+void checkBindlessLimits() {
+  VkPhysicalDeviceVulkan12Properties props12 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+  };
+  VkPhysicalDeviceProperties2 props = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &props12,
+  };
+  vkGetPhysicalDeviceProperties2(physicalDevice, &props);
+  if (props12.maxDescriptorSetUpdateAfterBindSampledImages <
+          BINDLESS_MAX_TEXTURES ||
+      props12.maxPerStageDescriptorUpdateAfterBindSampledImages <
+          BINDLESS_MAX_TEXTURES ||
+      props12.maxDescriptorSetUpdateAfterBindSamplers <
+          BINDLESS_MAX_SAMPLERS ||
+      props12.maxPerStageDescriptorUpdateAfterBindSamplers <
+          BINDLESS_MAX_SAMPLERS) {
+    printf("bindless table needs %u textures and %u samplers, device allows "
+           "%u and %u per set, %u and %u per stage\n",
+           BINDLESS_MAX_TEXTURES, BINDLESS_MAX_SAMPLERS,
+           props12.maxDescriptorSetUpdateAfterBindSampledImages,
+           props12.maxDescriptorSetUpdateAfterBindSamplers,
+           props12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+           props12.maxPerStageDescriptorUpdateAfterBindSamplers);
+    exit(1);
+  }
 }
 
 void createLogicalDevice() {
   printf("creating logical device\n");
   float queuePriority = 1.0f;
-  VkDeviceQueueCreateInfo queueCreateInfo = {
-      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-      .queueFamilyIndex = 0,
-      .queueCount = 1,
-      .pQueuePriorities = &queuePriority};
+  VkDeviceQueueCreateInfo queueCreateInfos[MAX_QUEUE_FAMILIES];
+  uint32_t queueCreateInfoCount =
+      getQueueCreateInfos(&queueFamilies, &queuePriority, queueCreateInfos);
+  // what the device offers, checked before anything is enabled
+  VkPhysicalDeviceVulkan13Features supported13 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+  };
+  VkPhysicalDeviceVulkan12Features supported12 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+      .pNext = &supported13,
+  };
+  VkPhysicalDeviceVulkan11Features supported11 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES,
+      .pNext = &supported12,
+  };
+  VkPhysicalDeviceFeatures2 supported2 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &supported11,
+  };
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &supported2);
+  VkPhysicalDeviceFeatures supported = supported2.features;
+  wireframeSupported = supported.fillModeNonSolid;
+  pipelineStatsSupported = supported.pipelineStatisticsQuery;
+  // culled draws are compacted on the GPU and drawn with a count buffer
+  requireFeature(supported.multiDrawIndirect, "multiDrawIndirect");
+  requireFeature(supported.drawIndirectFirstInstance,
+                 "drawIndirectFirstInstance");
+  requireFeature(supported12.drawIndirectCount, "drawIndirectCount");
+  // the bindless texture table
+  requireFeature(supported12.runtimeDescriptorArray, "runtimeDescriptorArray");
+  requireFeature(supported12.descriptorBindingPartiallyBound,
+                 "descriptorBindingPartiallyBound");
+  requireFeature(supported12.descriptorBindingSampledImageUpdateAfterBind,
+                 "descriptorBindingSampledImageUpdateAfterBind");
+  requireFeature(supported12.descriptorBindingUpdateUnusedWhilePending,
+                 "descriptorBindingUpdateUnusedWhilePending");
+  requireFeature(supported12.shaderSampledImageArrayNonUniformIndexing,
+                 "shaderSampledImageArrayNonUniformIndexing");
+  checkBindlessLimits();
   VkPhysicalDeviceFeatures features = {
+      .fillModeNonSolid = supported.fillModeNonSolid,
       .samplerAnisotropy = VK_TRUE,
+      .multiDrawIndirect = VK_TRUE,
+      .drawIndirectFirstInstance = VK_TRUE,
+      .pipelineStatisticsQuery = supported.pipelineStatisticsQuery,
+  };
+  // present ids let presentLatency time frames all the way to the display
+  presentWaitSupported =
+      !headless &&
+      deviceSupportsExtension(physicalDevice,
+                              VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+      deviceSupportsExtension(physicalDevice,
+                              VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+  VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+  };
+  VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+      .pNext = &presentWaitFeatures,
+  };
+  if (presentWaitSupported) {
+    VkPhysicalDeviceFeatures2 query = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &presentIdFeatures,
+    };
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &query);
+    presentWaitSupported =
+        presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+  }
+  VkPhysicalDeviceVulkan13Features features13 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+      .pNext = presentWaitSupported ? &presentIdFeatures : NULL,
+      .synchronization2 = VK_TRUE,
+      .dynamicRendering = dynamicRendering,
+  };
+  // the scene vertex shaders read gl_ViewIndex
+  VkPhysicalDeviceVulkan11Features features11 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES,
+      .pNext = &features13,
+      .multiview = VK_TRUE,
+  };
+  VkPhysicalDeviceVulkan12Features features12 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+      .pNext = &features11,
+      .timelineSemaphore = VK_TRUE,
+      .drawIndirectCount = VK_TRUE,
+      // the bindless texture table
+      .runtimeDescriptorArray = VK_TRUE,
+      .descriptorBindingPartiallyBound = VK_TRUE,
+      .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+      .descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+      .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
   };
-  const char **ext = (const char *[]){VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+  const char **ext = (const char *[]){
+      VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+      VK_KHR_PRESENT_ID_EXTENSION_NAME,
+      VK_KHR_PRESENT_WAIT_EXTENSION_NAME,
+  };
+  uint32_t extCount = headless ? 0 : presentWaitSupported ? 3 : 1;
   VkDeviceCreateInfo deviceCreateInfo = {
       .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-      .queueCreateInfoCount = 1,
-
-      .pQueueCreateInfos = &queueCreateInfo,
+      .pNext = &features12,
+      .queueCreateInfoCount = queueCreateInfoCount,
+      .pQueueCreateInfos = queueCreateInfos,
       .pEnabledFeatures = &features,
-      .enabledExtensionCount = 1,
+      .enabledExtensionCount = extCount,
       .ppEnabledExtensionNames = ext};
   VkResult createDeviceResult =
       vkCreateDevice(physicalDevice, &deviceCreateInfo, NULL, &device);
   if (createDeviceResult != VK_SUCCESS) {
     printf("failed to create logical device, error code: %d\n",
            createDeviceResult);
+    exit(1);
   }
 }
 
 void getDeviceQueues() {
-  printf("getting device queue\n");
-  vkGetDeviceQueue(device, 0, 0, &queue);
+  printf("getting device queues\n");
+  vkGetDeviceQueue(device, queueFamilies.graphics, 0, &queue);
+  vkGetDeviceQueue(device, queueFamilies.transfer, 0, &transferQueue);
+  vkGetDeviceQueue(device, queueFamilies.compute, 0, &computeQueue);
+  asyncCompute = queueFamilies.compute != queueFamilies.graphics;
+  printf("light binning on the %s queue\n",
+         asyncCompute ? "compute" : "graphics");
 }
 
 void createSurface() {
@@ -803,34 +1725,96 @@ void createSurface() {
   }
 }
 
-void createSwapchain() {
+// Tearing modes fall back to each other before vsync, so a request keeps its
+// latency class where it can. FIFO is always supported.
+VkPresentModeKHR choosePresentMode(VkPresentModeKHR requested) {
+  uint32_t count = 0;
+  vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &count,
+                                            NULL);
+  VkPresentModeKHR modes[count + 1];
+  vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &count,
+                                            modes);
+  VkPresentModeKHR fallback = VK_PRESENT_MODE_FIFO_KHR;
+  if (requested == VK_PRESENT_MODE_MAILBOX_KHR) {
+    fallback = VK_PRESENT_MODE_IMMEDIATE_KHR;
+  } else if (requested == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+    fallback = VK_PRESENT_MODE_MAILBOX_KHR;
+  }
+  VkPresentModeKHR preferred[] = {requested, fallback};
+  for (uint32_t p = 0; p < 2; p++) {
+    for (uint32_t i = 0; i < count; i++) {
+      if (modes[i] == preferred[p]) {
+        return modes[i];
+      }
+    }
+  }
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+// The surface's extent, or the window's framebuffer size when the surface
+// leaves it to the swapchain.
+VkExtent2D chooseSwapchainExtent(const VkSurfaceCapabilitiesKHR *caps) {
+  if (caps->currentExtent.width != UINT32_MAX) {
+    return caps->currentExtent;
+  }
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+  VkExtent2D extent = {(uint32_t)width, (uint32_t)height};
+  if (extent.width < caps->minImageExtent.width) {
+    extent.width = caps->minImageExtent.width;
+  }
+  if (extent.width > caps->maxImageExtent.width) {
+    extent.width = caps->maxImageExtent.width;
+  }
+  if (extent.height < caps->minImageExtent.height) {
+    extent.height = caps->minImageExtent.height;
+  }
+  if (extent.height > caps->maxImageExtent.height) {
+    extent.height = caps->maxImageExtent.height;
+  }
+  return extent;
+}
+
+void createSwapchain(VkSwapchainKHR oldSwapchain) {
   printf("creating swapchain\n");
   VkSurfaceCapabilitiesKHR surfaceCaps;
   vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface,
                                             &surfaceCaps);
-  VkExtent2D extent = {
-      .width = 800,
-      .height = 600,
-  };
+  VkExtent2D extent = chooseSwapchainExtent(&surfaceCaps);
   uint32_t swapchainImageCount = surfaceCaps.minImageCount + 1;
+  if (surfaceCaps.maxImageCount > 0 &&
+      swapchainImageCount > surfaceCaps.maxImageCount) {
+    swapchainImageCount = surfaceCaps.maxImageCount;
+  }
+  presentMode = choosePresentMode(requestedPresentMode);
   VkFormat imageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+  swapchainTransferDst =
+      surfaceCaps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  if (capturePath != NULL &&
+      !(surfaceCaps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+    printf("capture needs swapchain images that can be copied from\n");
+    exit(1);
+  }
   VkSwapchainCreateInfoKHR info = {
       .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
       .imageFormat = imageFormat,
       .imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
-      .presentMode = VK_PRESENT_MODE_MAILBOX_KHR,
+      .presentMode = presentMode,
       .imageExtent = extent,
       .surface = surface,
       .minImageCount = swapchainImageCount,
       .imageArrayLayers = 1,
-      .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+      .imageUsage =
+          VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+          (swapchainTransferDst ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0) |
+          (capturePath != NULL ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0),
       .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
       .queueFamilyIndexCount = 1,
       .pQueueFamilyIndices = 0,
       .preTransform = surfaceCaps.currentTransform,
       .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
       .clipped = VK_TRUE,
-      .oldSwapchain = VK_NULL_HANDLE,
+      .oldSwapchain = oldSwapchain,
   };
   VkResult result = vkCreateSwapchainKHR(device, &info, NULL, &swapchain);
   if (result != VK_SUCCESS) {
@@ -842,7 +1826,8 @@ void createSwapchain() {
     printf("no images in the swapchain\n");
     exit(1);
   }
-  printf("swapchain images: %d\n", imageCount);
+  printf("swapchain images: %d, %ux%u, present mode %s\n", imageCount,
+         extent.width, extent.height, presentModeName(presentMode));
   swapchainImages = malloc(sizeof(VkImage) * imageCount);
   if (swapchainImages == NULL) {
     printf("malloc failed\n");
@@ -853,6 +1838,40 @@ void createSwapchain() {
   swapchainExtent = extent;
 }
 
+// Stands in for the swapchain in headless mode: one image per frame slot, so
+// the frame pacer's wait on the slot also makes its image free to reuse.
+void createOffscreenTargets() {
+  printf("creating offscreen targets\n");
+  imageCount = MAX_FRAMES_IN_FLIGHT;
+  swapchainImageFormat = VK_FORMAT_B8G8R8A8_UNORM;
+  swapchainExtent = (VkExtent2D){.width = 800, .height = 600};
+  swapchainTransferDst = true;
+  swapchainImages = malloc(sizeof(VkImage) * imageCount);
+  offscreenImageMemory = malloc(sizeof(VkDeviceMemory) * imageCount);
+  if (swapchainImages == NULL || offscreenImageMemory == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  for (uint32_t i = 0; i < imageCount; i++) {
+    createImage(swapchainExtent.width, swapchainExtent.height, 1,
+                VK_SAMPLE_COUNT_1_BIT, swapchainImageFormat,
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                    VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &swapchainImages[i],
+                &offscreenImageMemory[i]);
+  }
+}
+
+void destroyOffscreenTargets() {
+  for (uint32_t i = 0; i < imageCount; i++) {
+    vkDestroyImage(device, swapchainImages[i], NULL);
+    vkFreeMemory(device, offscreenImageMemory[i], NULL);
+  }
+  free(offscreenImageMemory);
+}
+
 VkImageView createImageView(VkImage image, VkFormat format,
                             VkImageAspectFlags aspectFlags,
                             uint32_t mipLevels) {
@@ -878,9 +1897,34 @@ VkImageView createImageView(VkImage image, VkFormat format,
   return imageView;
 }
 
-void createTextureImageView() {
-  textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB,
-                                     VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+void createTextureImageView(Texture *texture) {
+  texture->view = createImageView(texture->image, VK_FORMAT_R8G8B8A8_SRGB,
+                                  VK_IMAGE_ASPECT_COLOR_BIT,
+                                  texture->mipLevels);
+}
+
+// Loads the scene textures and their sampler into the bindless table.
+void createTextures() {
+  for (uint32_t i = 0; i < SCENE_TEXTURE_COUNT; i++) {
+    createTextureImage(&sceneTextures[i], sceneTexturePaths[i]);
+    createTextureImageView(&sceneTextures[i]);
+    sceneTextures[i].slot =
+        bindlessAddTexture(&bindless, device, sceneTextures[i].view,
+                           VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  }
+  createTextureSampler();
+  textureSamplerSlot = bindlessAddSampler(&bindless, device, textureSampler);
+}
+
+void destroyTextures() {
+  for (uint32_t i = 0; i < SCENE_TEXTURE_COUNT; i++) {
+    untrackImage(&sceneTextures[i].tracked);
+    vkDestroyImageView(device, sceneTextures[i].view, NULL);
+    vkDestroyImage(device, sceneTextures[i].image, NULL);
+    vkFreeMemory(device, sceneTextures[i].memory, NULL);
+  }
+  vkDestroySampler(device, textureSampler, NULL);
+  bindlessDestroy(&bindless, device);
 }
 
 void createImageViews() {
@@ -914,23 +1958,113 @@ VkShaderModule createShaderModule(const char *filepath) {
   return module;
 }
 
-void createGraphicsPipeline() {
-  VkShaderModule triVert = createShaderModule("shaders/comp/tri.vert.spv");
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo = {
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-      .stage = VK_SHADER_STAGE_VERTEX_BIT,
-      .module = triVert,
-      .pName = "main",
+// Everything that distinguishes two variants is in the key, so equal keys
+// describe identical create infos and the pipeline cache sees them as one.
+uint32_t sceneVariantKey(SceneVariant variant) {
+  return variant.samples | variant.kind << 8 |
+         (variant.wireframe ? SCENE_KEY_WIREFRAME : 0) |
+         (variant.untextured ? SCENE_KEY_UNTEXTURED : 0) |
+         (variant.alphaTest ? SCENE_KEY_ALPHA_TEST : 0);
+}
+
+SceneVariant sceneVariantFromKey(uint32_t key) {
+  return (SceneVariant){
+      .samples = key & 0xff,
+      .kind = (key >> 8) & 0xff,
+      .wireframe = (key & SCENE_KEY_WIREFRAME) != 0,
+      .untextured = (key & SCENE_KEY_UNTEXTURED) != 0,
+      .alphaTest = (key & SCENE_KEY_ALPHA_TEST) != 0,
+  };
+}
+
+uint32_t sampleCountIndex(VkSampleCountFlagBits samples) {
+  uint32_t index = 0;
+  while ((1u << index) != samples) {
+    index++;
+  }
+  return index;
+}
+
+// Views a multiview pass broadcasts to; 0 when the scene passes draw a
+// single view.
+uint32_t sceneViewMask() {
+  return viewCount > 1 && !viewPasses ? (1u << viewCount) - 1 : 0;
+}
+
+// Render passes recording each scene phase, one per view with --view-passes.
+uint32_t scenePassCount() { return viewPasses ? viewCount : 1; }
+
+void createPipelineLayout() {
+  VkPushConstantRange pushConstantRange = {
+      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+      .offset = 0,
+      .size = sizeof(DrawPushConstants),
+  };
+  VkDescriptorSetLayout setLayouts[] = {descriptorLayout, bindless.layout};
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = 2,
+      .pushConstantRangeCount = 1,
+      .pSetLayouts = setLayouts,
+      .pPushConstantRanges = &pushConstantRange,
+  };
+  VkResult result = vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL,
+                                           &pipelineLayout);
+  if (result != VK_SUCCESS) {
+    printf("failed pipeline layout\n");
+    exit(1);
+  }
+}
+
+// PipelineBuildFn for the main pass; everything it reads is fixed once the
+// library starts. Shaders are loaded per build so a rebuild picks up
+// recompiled SPIR-V.
+VkPipeline buildScenePipeline(uint32_t key, void *userData) {
+  SceneVariant variant = sceneVariantFromKey(key);
+  bool depthOnly = variant.kind == SCENE_DEPTH_ONLY;
+  VkShaderModule vertShader =
+      createShaderModule(depthOnly ? "shaders/comp/depth.vert.spv"
+                                   : "shaders/comp/tri.vert.spv");
+  VkShaderModule fragShader =
+      depthOnly ? VK_NULL_HANDLE
+                : createShaderModule("shaders/comp/tri.frag.spv");
+  SceneSpecialization constants = {
+      .textured = !variant.untextured,
+      .alphaTest = variant.alphaTest,
+  };
+  VkSpecializationMapEntry constantEntries[] = {
+      {
+          .constantID = 0,
+          .offset = offsetof(SceneSpecialization, textured),
+          .size = sizeof(VkBool32),
+      },
+      {
+          .constantID = 1,
+          .offset = offsetof(SceneSpecialization, alphaTest),
+          .size = sizeof(VkBool32),
+      },
+  };
+  VkSpecializationInfo specialization = {
+      .mapEntryCount = 2,
+      .pMapEntries = constantEntries,
+      .dataSize = sizeof(constants),
+      .pData = &constants,
   };
-  VkShaderModule triFrag = createShaderModule("shaders/comp/tri.frag.spv");
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo = {
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-      .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-      .module = triFrag,
-      .pName = "main",
+  VkPipelineShaderStageCreateInfo shaderStages[] = {
+      {
+          .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+          .stage = VK_SHADER_STAGE_VERTEX_BIT,
+          .module = vertShader,
+          .pName = "main",
+      },
+      {
+          .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+          .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+          .module = fragShader,
+          .pName = "main",
+          .pSpecializationInfo = &specialization,
+      },
   };
-  VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo,
-                                                    fragShaderStageInfo};
   VkDynamicState dynamicStates[] = {
       VK_DYNAMIC_STATE_VIEWPORT,
       VK_DYNAMIC_STATE_SCISSOR,
@@ -948,42 +2082,42 @@ void createGraphicsPipeline() {
   VkVertexInputBindingDescription binds[] = {
       getVertexBindDesc(),
   };
+  // the prepass reads tightly packed positions
+  VkVertexInputAttributeDescription positionAttr = {
+      .location = 0,
+      .binding = 0,
+      .format = VK_FORMAT_R32G32B32_SFLOAT,
+      .offset = 0,
+  };
+  VkVertexInputBindingDescription positionBind = {
+      .binding = 0,
+      .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+      .stride = sizeof(vec3),
+  };
   VkPipelineVertexInputStateCreateInfo vertexInputInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-      .vertexAttributeDescriptionCount = 3,
-      .pVertexAttributeDescriptions = attr,
+      .vertexAttributeDescriptionCount = depthOnly ? 1 : 3,
+      .pVertexAttributeDescriptions = depthOnly ? &positionAttr : attr,
       .vertexBindingDescriptionCount = 1,
-      .pVertexBindingDescriptions = binds,
+      .pVertexBindingDescriptions = depthOnly ? &positionBind : binds,
   };
   VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
       .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
       .primitiveRestartEnable = VK_FALSE,
   };
-  VkViewport viewport = {
-      .x = 0.0f,
-      .y = 0.0f,
-      .width = (float)swapchainExtent.width,
-      .height = (float)swapchainExtent.height,
-      .minDepth = 0.0f,
-      .maxDepth = 1.0f,
-  };
-  VkRect2D scissor = {
-      .offset = {0, 0},
-      .extent = swapchainExtent,
-  };
+  // viewport and scissor are dynamic, only their count is baked in
   VkPipelineViewportStateCreateInfo viewportStateInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
       .viewportCount = 1,
-      .pViewports = &viewport,
       .scissorCount = 1,
-      .pScissors = &scissor,
   };
   VkPipelineRasterizationStateCreateInfo rasterInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
       .depthClampEnable = VK_FALSE,
       .rasterizerDiscardEnable = VK_FALSE,
-      .polygonMode = VK_POLYGON_MODE_FILL,
+      .polygonMode =
+          variant.wireframe ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL,
       .lineWidth = 1.0f,
       .cullMode = VK_CULL_MODE_BACK_BIT,
       .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
@@ -993,11 +2127,13 @@ void createGraphicsPipeline() {
   VkPipelineMultisampleStateCreateInfo multisampleInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
       .sampleShadingEnable = VK_FALSE,
-      .rasterizationSamples = msaaSample,
+      .rasterizationSamples = variant.samples,
   };
   VkPipelineColorBlendAttachmentState colorBlendAttachment = {
-      .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-                        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+      .colorWriteMask =
+          depthOnly ? 0
+                    : VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
       .blendEnable = VK_FALSE,
   };
   VkPipelineColorBlendStateCreateInfo colorBlending = {
@@ -1008,29 +2144,28 @@ void createGraphicsPipeline() {
       .pAttachments = &colorBlendAttachment,
       .blendConstants = {0.0f, 0.0f, 0.0f, 0.0f},
   };
+  // after a prepass depth is final: only the front fragment passes EQUAL
+  bool equal = variant.kind == SCENE_SHADE_EQUAL;
   VkPipelineDepthStencilStateCreateInfo depthStencilInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
       .depthTestEnable = VK_TRUE,
-      .depthWriteEnable = VK_TRUE,
-      .depthCompareOp = VK_COMPARE_OP_LESS,
+      .depthWriteEnable = equal ? VK_FALSE : VK_TRUE,
+      .depthCompareOp = equal ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS,
       .depthBoundsTestEnable = VK_FALSE,
       .stencilTestEnable = VK_FALSE,
   };
-  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
-      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-      .setLayoutCount = 1,
-      .pushConstantRangeCount = 0,
-      .pSetLayouts = &descriptorLayout,
+  // attachment formats replace the render pass for dynamic rendering
+  VkPipelineRenderingCreateInfo renderingInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+      .colorAttachmentCount = 1,
+      .viewMask = sceneViewMask(),
+      .pColorAttachmentFormats = &swapchainImageFormat,
+      .depthAttachmentFormat = VK_FORMAT_D32_SFLOAT,
   };
-  VkResult result = vkCreatePipelineLayout(device, &pipelineLayoutInfo, NULL,
-                                           &pipelineLayout);
-  if (result != VK_SUCCESS) {
-    printf("failed pipeline layout\n");
-    exit(1);
-  }
   VkGraphicsPipelineCreateInfo pipelineInfo = {
       .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-      .stageCount = 2,
+      .pNext = dynamicRendering ? &renderingInfo : NULL,
+      .stageCount = depthOnly ? 1 : 2,
       .pStages = shaderStages,
       .pVertexInputState = &vertexInputInfo,
       .pInputAssemblyState = &inputAssemblyInfo,
@@ -1040,59 +2175,220 @@ void createGraphicsPipeline() {
       .pColorBlendState = &colorBlending,
       .pDynamicState = &dynamicStateInfo,
       .layout = pipelineLayout,
-      .renderPass = renderPass,
+      .renderPass =
+          dynamicRendering
+              ? VK_NULL_HANDLE
+              : variantRenderPasses[sampleCountIndex(variant.samples)],
       .subpass = 0,
       .basePipelineHandle = VK_NULL_HANDLE,
       .pDepthStencilState = &depthStencilInfo,
   };
-  VkResult pipelineResult = vkCreateGraphicsPipelines(
-      device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pipeline);
-  if (pipelineResult != VK_SUCCESS) {
-    printf("failed to create pipeline\n");
+  VkPipeline scenePipeline;
+  if (pipelineCacheCreateGraphics(&pipelineCache, device, &pipelineInfo,
+                                  &scenePipeline) != VK_SUCCESS) {
+    printf("failed to create scene pipeline variant %#x\n", key);
+    scenePipeline = VK_NULL_HANDLE;
+  }
+  vkDestroyShaderModule(device, fragShader, NULL);
+  vkDestroyShaderModule(device, vertShader, NULL);
+  return scenePipeline;
+}
+
+// PipelineKeyFilterFn selecting the scene variants built from the shader
+// named by userData.
+bool sceneVariantUsesShader(uint32_t key, void *userData) {
+  const char *name = userData;
+  if (sceneVariantFromKey(key).kind == SCENE_DEPTH_ONLY) {
+    return strcmp(name, "depth.vert") == 0;
+  }
+  return strcmp(name, "tri.vert") == 0 || strcmp(name, "tri.frag") == 0;
+}
+
+VkPipeline createPostPipeline(const char *path) {
+  VkShaderModule comp = createShaderModule(path);
+  VkComputePipelineCreateInfo pipelineInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .stage =
+          {
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+              .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+              .module = comp,
+              .pName = "main",
+          },
+      .layout = postPipelineLayout,
+  };
+  VkPipeline postPipeline;
+  if (pipelineCacheCreateCompute(&pipelineCache, device, &pipelineInfo,
+                                 &postPipeline) != VK_SUCCESS) {
+    printf("failed to create post pipeline %s\n", path);
     exit(1);
   }
-  vkDestroyShaderModule(device, triFrag, NULL);
-  vkDestroyShaderModule(device, triVert, NULL);
+  vkDestroyShaderModule(device, comp, NULL);
+  return postPipeline;
 }
 
-void createRenderPass() {
-  VkAttachmentDescription colorAttachment = {
-      .format = swapchainImageFormat,
-      .samples = msaaSample,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-      .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+// Shares the scene's set 0, whose cluster bindings are visible to compute.
+void createLightBinPipeline() {
+  VkShaderModule binComp =
+      createShaderModule("shaders/comp/light_bin.comp.spv");
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = 1,
+      .pSetLayouts = &descriptorLayout,
   };
-  VkAttachmentDescription depthAttachment = {
-      .format = VK_FORMAT_D32_SFLOAT,
-      .samples = msaaSample,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-      .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-      .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+  if (vkCreatePipelineLayout(device, &layoutInfo, NULL,
+                             &lightBinPipelineLayout) != VK_SUCCESS) {
+    printf("failed light binning pipeline layout\n");
+    exit(1);
+  }
+  VkComputePipelineCreateInfo pipelineInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .stage =
+          {
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+              .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+              .module = binComp,
+              .pName = "main",
+          },
+      .layout = lightBinPipelineLayout,
   };
-  VkAttachmentDescription colorAttachmentResolve = {
-      .format = swapchainImageFormat,
-      .samples = VK_SAMPLE_COUNT_1_BIT,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-      .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+  if (pipelineCacheCreateCompute(&pipelineCache, device, &pipelineInfo,
+                                 &lightBinPipeline) != VK_SUCCESS) {
+    printf("failed to create light binning pipeline\n");
+    exit(1);
+  }
+  vkDestroyShaderModule(device, binComp, NULL);
+}
+
+void createPostPipelines() {
+  VkPushConstantRange pushConstantRange = {
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .offset = 0,
+      .size = sizeof(PostPushConstants),
   };
-  VkAttachmentReference colorAttachmentRef = {
-      .attachment = 0,
-      .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = 1,
+      .pSetLayouts = &postDescriptorLayout,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange,
   };
-  VkAttachmentReference depthAttachmentRef = {
-      .attachment = 1,
-      .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+  if (vkCreatePipelineLayout(device, &layoutInfo, NULL, &postPipelineLayout) !=
+      VK_SUCCESS) {
+    printf("failed post pipeline layout\n");
+    exit(1);
+  }
+  fxaaPipeline = createPostPipeline("shaders/comp/fxaa.comp.spv");
+  upscalePipeline = createPostPipeline("shaders/comp/upscale.comp.spv");
+  // the depth pyramid passes only push the region
+  hizReducePipeline = createPostPipeline("shaders/comp/hiz_reduce.comp.spv");
+  hizResolvePipeline = createPostPipeline("shaders/comp/hiz_resolve.comp.spv");
+  // both passes sample between texels, clamped at the borders
+  VkSamplerCreateInfo samplerInfo = {
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+      .magFilter = VK_FILTER_LINEAR,
+      .minFilter = VK_FILTER_LINEAR,
+      .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+      .maxLod = 0.0f,
+  };
+  if (vkCreateSampler(device, &samplerInfo, NULL, &postSampler) !=
+      VK_SUCCESS) {
+    printf("error creating post sampler\n");
+    exit(1);
+  }
+}
+
+void createCullPipeline() {
+  VkShaderModule cullComp = createShaderModule("shaders/comp/cull.comp.spv");
+  VkPushConstantRange pushConstantRange = {
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .offset = 0,
+      .size = sizeof(CullPushConstants),
+  };
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = 1,
+      .pSetLayouts = &cullDescriptorLayout,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange,
+  };
+  if (vkCreatePipelineLayout(device, &layoutInfo, NULL, &cullPipelineLayout) !=
+      VK_SUCCESS) {
+    printf("failed cull pipeline layout\n");
+    exit(1);
+  }
+  VkComputePipelineCreateInfo pipelineInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .stage =
+          {
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+              .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+              .module = cullComp,
+              .pName = "main",
+          },
+      .layout = cullPipelineLayout,
+  };
+  if (pipelineCacheCreateCompute(&pipelineCache, device, &pipelineInfo,
+                                 &cullPipeline) != VK_SUCCESS) {
+    printf("failed to create cull pipeline\n");
+    exit(1);
+  }
+  vkDestroyShaderModule(device, cullComp, NULL);
+}
+
+// Attachments enter and leave the render pass in their attachment layouts,
+// transitions and dependencies come from the render graph.
+//
+// The late pass continues the early one after the depth pyramid is built.
+// Both share attachments, so they stay compatible and use the same pipelines
+// and framebuffers; only the late pass keeps its resolve.
+VkRenderPass createMainRenderPass(bool late, VkSampleCountFlagBits samples) {
+  // multisampled color only lives until it is resolved
+  bool resolve = samples != VK_SAMPLE_COUNT_1_BIT;
+  VkAttachmentDescription colorAttachment = {
+      .format = swapchainImageFormat,
+      .samples = samples,
+      .loadOp = late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = late && resolve ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+                                 : VK_ATTACHMENT_STORE_OP_STORE,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+  // early depth feeds the depth pyramid
+  VkAttachmentDescription depthAttachment = {
+      .format = VK_FORMAT_D32_SFLOAT,
+      .samples = samples,
+      .loadOp = late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = late ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+                      : VK_ATTACHMENT_STORE_OP_STORE,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+  };
+  VkAttachmentDescription colorAttachmentResolve = {
+      .format = swapchainImageFormat,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .storeOp = late ? VK_ATTACHMENT_STORE_OP_STORE
+                      : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+  VkAttachmentReference colorAttachmentRef = {
+      .attachment = 0,
+      .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+  };
+  VkAttachmentReference depthAttachmentRef = {
+      .attachment = 1,
+      .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
   };
   VkAttachmentReference colorAttachmentResolveRef = {
       .attachment = 2,
@@ -1103,55 +2399,97 @@ void createRenderPass() {
       .colorAttachmentCount = 1,
       .pColorAttachments = &colorAttachmentRef,
       .pDepthStencilAttachment = &depthAttachmentRef,
-      .pResolveAttachments = &colorAttachmentResolveRef,
-  };
-  VkSubpassDependency dependency = {
-      .srcSubpass = VK_SUBPASS_EXTERNAL,
-      .dstSubpass = 0,
-      .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-                      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-      .srcAccessMask = 0,
-      .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-                      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-      .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
-                       VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      .pResolveAttachments = resolve ? &colorAttachmentResolveRef : NULL,
   };
   VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment,
                                            colorAttachmentResolve};
+  // the views are offset copies of one camera, so the driver may share work
+  // between them
+  uint32_t viewMask = sceneViewMask();
+  VkRenderPassMultiviewCreateInfo multiviewInfo = {
+      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO,
+      .subpassCount = 1,
+      .pViewMasks = &viewMask,
+      .correlationMaskCount = 1,
+      .pCorrelationMasks = &viewMask,
+  };
   VkRenderPassCreateInfo renderPassInfo = {
       .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-      .attachmentCount = 3,
+      .pNext = viewMask != 0 ? &multiviewInfo : NULL,
+      .attachmentCount = resolve ? 3 : 2,
       .pAttachments = attachments,
       .subpassCount = 1,
       .pSubpasses = &subpass,
-      .dependencyCount = 1,
-      .pDependencies = &dependency,
-
   };
+  VkRenderPass mainRenderPass;
   VkResult result =
-      vkCreateRenderPass(device, &renderPassInfo, NULL, &renderPass);
+      vkCreateRenderPass(device, &renderPassInfo, NULL, &mainRenderPass);
   if (result != VK_SUCCESS) {
     printf("failed create render pass\n");
     exit(1);
   }
+  return mainRenderPass;
+}
+
+void createRenderPass() {
+  renderPass = createMainRenderPass(false, msaaSample);
+  lateRenderPass = createMainRenderPass(true, msaaSample);
+}
+
+// The scene goes through post passes before reaching the swapchain; several
+// views are rendered into layers and composed into it.
+bool renderOffscreen() {
+  return aaModes[aaMode].fxaa || dynamicResolution || viewCount > 1;
+}
+
+// Every layer for a multiview pass, the one being drawn for a pass per view.
+VkImageView sceneTargetView(const RenderGraph *graph, uint32_t resource,
+                            uint32_t view) {
+  return viewPasses ? rgLayerView(graph, resource, view)
+                    : rgView(graph, resource);
+}
+
+// Single-sampled rendering without post passes draws straight into the
+// swapchain.
+VkImageView mainColorView(const RenderGraph *graph, uint32_t imageIndex,
+                          uint32_t view) {
+  if (msaaSample == VK_SAMPLE_COUNT_1_BIT && !renderOffscreen()) {
+    return swapchainImageViews[imageIndex];
+  }
+  return sceneTargetView(graph, rgColor, view);
+}
+
+VkImageView resolveView(const RenderGraph *graph, uint32_t imageIndex,
+                        uint32_t view) {
+  if (renderOffscreen()) {
+    return sceneTargetView(graph, rgScene, view);
+  }
+  return swapchainImageViews[imageIndex];
 }
 
+// One per swapchain image and scene pass, indexed by
+// imageIndex * scenePassCount() + view.
 void createFramebuffers() {
-  framebuffers = malloc(sizeof(VkFramebuffer) * imageCount);
+  uint32_t passes = scenePassCount();
+  framebuffers = malloc(sizeof(VkFramebuffer) * imageCount * passes);
   if (framebuffers == NULL) {
     printf("malloc failed\n");
     exit(1);
   }
-  for (uint32_t i = 0; i < imageCount; i++) {
+  for (uint32_t i = 0; i < imageCount * passes; i++) {
+    uint32_t image = i / passes;
+    uint32_t view = i % passes;
     VkImageView attachments[] = {
-        colorImageView,
-        depthImageView,
-        swapchainImageViews[i],
+        mainColorView(&frameGraph, image, view),
+        sceneTargetView(&frameGraph, rgDepth, view),
+        msaaSample != VK_SAMPLE_COUNT_1_BIT
+            ? resolveView(&frameGraph, image, view)
+            : VK_NULL_HANDLE,
     };
     VkFramebufferCreateInfo framebufferInfo = {
         .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
         .renderPass = renderPass,
-        .attachmentCount = 3,
+        .attachmentCount = msaaSample != VK_SAMPLE_COUNT_1_BIT ? 3 : 2,
         .pAttachments = attachments,
         .width = swapchainExtent.width,
         .height = swapchainExtent.height,
@@ -1170,13 +2508,14 @@ void createCommandPool() {
   VkCommandPoolCreateInfo info = {
       .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
       .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-      .queueFamilyIndex = 0,
+      .queueFamilyIndex = queueFamilies.graphics,
   };
   VkResult result = vkCreateCommandPool(device, &info, NULL, &commandPool);
   if (result != VK_SUCCESS) {
     printf("failed to create command pool");
     exit(1);
   }
+  uploaderInit(&uploader, device, &queueFamilies, transferQueue);
 }
 
 void createCommandBuffers() {
@@ -1198,15 +2537,117 @@ void createCommandBuffers() {
   }
 }
 
-void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
-  VkCommandBufferBeginInfo begingInfo = {
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+// A pool, a command buffer per slot and a timeline for light binning on the
+// compute queue. Nothing to do when binning stays on the graphics queue.
+void createComputeObjects() {
+  if (!asyncCompute) {
+    return;
+  }
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, NULL);
+  VkQueueFamilyProperties families[familyCount];
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount,
+                                           families);
+  computeTimestamps = families[queueFamilies.compute].timestampValidBits > 0;
+  VkCommandPoolCreateInfo poolInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = queueFamilies.compute,
   };
-  VkResult result = vkBeginCommandBuffer(commandBuffer, &begingInfo);
-  if (result != VK_SUCCESS) {
-    printf("failed go begin command buffer");
+  if (vkCreateCommandPool(device, &poolInfo, NULL, &computeCommandPool) !=
+      VK_SUCCESS) {
+    printf("failed to create compute command pool\n");
     exit(1);
   }
+  VkCommandBufferAllocateInfo allocInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = computeCommandPool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = MAX_FRAMES_IN_FLIGHT,
+  };
+  if (vkAllocateCommandBuffers(device, &allocInfo, computeCommandBuffers) !=
+      VK_SUCCESS) {
+    printf("failed to allocate compute command buffers\n");
+    exit(1);
+  }
+  VkSemaphoreTypeCreateInfo typeInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+      .initialValue = 0,
+  };
+  VkSemaphoreCreateInfo semaphoreInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &typeInfo,
+  };
+  if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &computeTimeline) !=
+      VK_SUCCESS) {
+    printf("failed to create compute timeline\n");
+    exit(1);
+  }
+}
+
+void destroyComputeObjects() {
+  if (!asyncCompute) {
+    return;
+  }
+  vkDestroySemaphore(device, computeTimeline, NULL);
+  vkDestroyCommandPool(device, computeCommandPool, NULL);
+}
+
+// Visible objects were compacted into this frame's draws by the cull pass
+// of the given phase.
+void drawVisibleObjects(VkCommandBuffer commandBuffer, uint32_t phase) {
+  vkCmdDrawIndexedIndirectCount(
+      commandBuffer, drawCommandBuffers[currentFrame],
+      phase * instances.capacity * sizeof(VkDrawIndexedIndirectCommand),
+      drawCountBuffers[currentFrame], phase * sizeof(uint32_t),
+      instances.count, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+// Multisampled color resolves into the swapchain image at the end of the
+// pass; the graph has already moved the attachments into their layouts.
+void beginRendering(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                    uint32_t imageIndex, bool late, uint32_t view) {
+  bool resolve = late && msaaSample != VK_SAMPLE_COUNT_1_BIT;
+  VkRenderingAttachmentInfo colorAttachment = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+      .imageView = mainColorView(graph, imageIndex, view),
+      .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .resolveMode =
+          resolve ? VK_RESOLVE_MODE_AVERAGE_BIT : VK_RESOLVE_MODE_NONE,
+      .resolveImageView =
+          resolve ? resolveView(graph, imageIndex, view) : VK_NULL_HANDLE,
+      .resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .loadOp = late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = resolve ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+                         : VK_ATTACHMENT_STORE_OP_STORE,
+      .clearValue.color = {{0.0f, 0.0f, 0.0f, 1.0f}},
+  };
+  VkRenderingAttachmentInfo depthAttachment = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+      .imageView = sceneTargetView(graph, rgDepth, view),
+      .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      .resolveMode = VK_RESOLVE_MODE_NONE,
+      .loadOp = late ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = late ? VK_ATTACHMENT_STORE_OP_DONT_CARE
+                      : VK_ATTACHMENT_STORE_OP_STORE,
+      .clearValue.depthStencil = {1.0f, 0},
+  };
+  VkRenderingInfo renderingInfo = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+      .renderArea.offset = {0, 0},
+      .renderArea.extent = renderExtent,
+      .layerCount = 1,
+      .viewMask = sceneViewMask(),
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &colorAttachment,
+      .pDepthAttachment = &depthAttachment,
+  };
+  vkCmdBeginRendering(commandBuffer, &renderingInfo);
+}
+
+void beginRenderPass(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                     bool late, uint32_t view) {
   VkClearValue clearColor = {
       .color = {{0.0f, 0.0f, 0.0f, 1.0f}},
   };
@@ -1216,37 +2657,149 @@ void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
   VkClearValue clears[] = {clearColor, clearDepth};
   VkRenderPassBeginInfo renderPassInfo = {
       .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-      .renderPass = renderPass,
-      .framebuffer = framebuffers[imageIndex],
+      .renderPass = late ? lateRenderPass : renderPass,
+      .framebuffer = framebuffers[imageIndex * scenePassCount() + view],
       .renderArea.offset = {0, 0},
-      .renderArea.extent = swapchainExtent,
+      .renderArea.extent = renderExtent,
       .pClearValues = clears,
       .clearValueCount = 2,
   };
   vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
                        VK_SUBPASS_CONTENTS_INLINE);
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+}
+
+// Draws one cull phase's objects into view, or into every view from a
+// multiview pass.
+void recordSceneView(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                     uint32_t imageIndex, uint32_t phase, uint32_t view) {
+  bool late = phase == CULL_PHASE_LATE;
+  if (dynamicRendering) {
+    beginRendering(commandBuffer, graph, imageIndex, late, view);
+  } else {
+    beginRenderPass(commandBuffer, imageIndex, late, view);
+  }
+  // the aspect ratio is unchanged, so the projection is too
   VkViewport viewport = {
       .x = 0.0f,
       .y = 0.0f,
-      .width = swapchainExtent.width,
-      .height = swapchainExtent.height,
+      .width = renderExtent.width,
+      .height = renderExtent.height,
       .minDepth = 0.0f,
       .maxDepth = 1.0f,
   };
   vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
   VkRect2D scissor = {
       .offset = {0, 0},
-      .extent = swapchainExtent,
+      .extent = renderExtent,
   };
   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
   VkDeviceSize offsets[] = {0};
-  vkCmdBindVertexBuffers(commandBuffer, 0, 1, &modelBuffer, offsets);
+  vkCmdBindIndexBuffer(commandBuffer, modelIndiciesBuffer, 0,
+                       VK_INDEX_TYPE_UINT32);
+  // set 1 is the bindless table; materials index it, so no per-draw binds
+  VkDescriptorSet sets[] = {descriptorSets[currentFrame], bindless.set};
   vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          pipelineLayout, 0, 1, &descriptorSets[currentFrame],
-                          0, NULL);
-  vkCmdDraw(commandBuffer, modelVerticesNum, 1, 0, 0);
-  vkCmdEndRenderPass(commandBuffer);
+                          pipelineLayout, 0, 2, sets, 0, NULL);
+  DrawPushConstants push = {.viewBase = view};
+  vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+                     0, sizeof(push), &push);
+  if (framePrepassPipeline != VK_NULL_HANDLE) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      framePrepassPipeline);
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &positionBuffer, offsets);
+    drawVisibleObjects(commandBuffer, phase);
+  }
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    frameShadePipeline);
+  vkCmdBindVertexBuffers(commandBuffer, 0, 1, &modelBuffer, offsets);
+  drawVisibleObjects(commandBuffer, phase);
+  if (dynamicRendering) {
+    vkCmdEndRendering(commandBuffer);
+  } else {
+    vkCmdEndRenderPass(commandBuffer);
+  }
+}
+
+// The statistics query spans both phases and every view.
+void recordScenePass(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                     uint32_t imageIndex, uint32_t phase) {
+  bool late = phase == CULL_PHASE_LATE;
+  if (!late && pipelineStatsSupported) {
+    pipelineStatsReset(&pipelineStats, commandBuffer, currentFrame);
+    pipelineStatsBegin(&pipelineStats, commandBuffer, currentFrame,
+                       framePrepassPipeline != VK_NULL_HANDLE ? 1 : 0);
+  }
+  for (uint32_t view = 0; view < scenePassCount(); view++) {
+    recordSceneView(commandBuffer, graph, imageIndex, phase, view);
+  }
+  if (late && pipelineStatsSupported) {
+    pipelineStatsEnd(&pipelineStats, commandBuffer, currentFrame);
+  }
+}
+
+void recordMainPass(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                    void *userData) {
+  recordScenePass(commandBuffer, graph, *(uint32_t *)userData,
+                  CULL_PHASE_EARLY);
+}
+
+void recordLateMainPass(VkCommandBuffer commandBuffer,
+                        const RenderGraph *graph, void *userData) {
+  recordScenePass(commandBuffer, graph, *(uint32_t *)userData,
+                  CULL_PHASE_LATE);
+}
+
+VkPipeline findScenePipeline(SceneVariant variant, VkPipeline fallback) {
+  PipelineFuture *future =
+      pipelineLibraryFind(&pipelineLibrary, sceneVariantKey(variant));
+  return pipelineLibraryGet(future, fallback);
+}
+
+// Picks the variant for the current toggles. Until it has compiled, or if no
+// such variant is built, frames draw without the prepass or with plain
+// shading; that pipeline was waited for when the sample count was set.
+void selectScenePipelines() {
+  VkPipeline shade = pipelineLibraryGet(shadeFuture, VK_NULL_HANDLE);
+  SceneVariant variant = {
+      .samples = msaaSample,
+      .kind = SCENE_SHADE,
+      .wireframe = wireframe,
+      .untextured = !texturing,
+      .alphaTest = alphaTest,
+  };
+  frameShadePipeline = findScenePipeline(variant, shade);
+  framePrepassPipeline = VK_NULL_HANDLE;
+  if (!depthPrepass) {
+    return;
+  }
+  variant.kind = SCENE_SHADE_EQUAL;
+  VkPipeline equal = findScenePipeline(variant, VK_NULL_HANDLE);
+  SceneVariant depthOnly = {.samples = msaaSample, .kind = SCENE_DEPTH_ONLY};
+  VkPipeline prepass = findScenePipeline(depthOnly, VK_NULL_HANDLE);
+  if (equal != VK_NULL_HANDLE && prepass != VK_NULL_HANDLE) {
+    frameShadePipeline = equal;
+    framePrepassPipeline = prepass;
+  }
+}
+
+void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+  VkCommandBufferBeginInfo begingInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+  };
+  VkResult result = vkBeginCommandBuffer(commandBuffer, &begingInfo);
+  if (result != VK_SUCCESS) {
+    printf("failed go begin command buffer");
+    exit(1);
+  }
+  uploadWaitValue =
+      uploaderFlushAcquires(&uploader, commandBuffer, &uploadWaitStages);
+  currentImageIndex = imageIndex;
+  selectScenePipelines();
+  rgSetImage(&frameGraph, rgSwapchain, swapchainImages[imageIndex],
+             swapchainImageViews[imageIndex]);
+  gpuTimerBegin(&gpuTimer, commandBuffer, currentFrame);
+  rgExecute(&frameGraph, commandBuffer, &frameBarriers);
+  gpuTimerEnd(&gpuTimer, commandBuffer, currentFrame);
   VkResult endBufferResult = vkEndCommandBuffer(commandBuffer);
   if (endBufferResult != VK_SUCCESS) {
     printf("end buffer failed\n");
@@ -1254,29 +2807,35 @@ void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
   }
 }
 
-void createSyncObjects() {
-  imageAvailableSemaphores = malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
-  if (imageAvailableSemaphores == NULL) {
-    printf("malloc failed\n");
-    exit(1);
-  }
-  renderFinishedSemaphores = malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
+// Present waits on these, so they belong to the swapchain image rather than
+// to the frame slot that happened to render into it.
+void createPresentSemaphores() {
+  renderFinishedSemaphores = malloc(sizeof(VkSemaphore) * imageCount);
   if (renderFinishedSemaphores == NULL) {
     printf("malloc failed\n");
     exit(1);
   }
-  inFlight = malloc(sizeof(VkFence) * MAX_FRAMES_IN_FLIGHT);
-  if (inFlight == NULL) {
+  VkSemaphoreCreateInfo semaphoreInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+  };
+  for (uint32_t i = 0; i < imageCount; i++) {
+    if (vkCreateSemaphore(device, &semaphoreInfo, NULL,
+                          &renderFinishedSemaphores[i]) != VK_SUCCESS) {
+      printf("failed to create semaphore");
+      exit(1);
+    }
+  }
+}
+
+void createSyncObjects() {
+  imageAvailableSemaphores = malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
+  if (imageAvailableSemaphores == NULL) {
     printf("malloc failed\n");
     exit(1);
   }
   VkSemaphoreCreateInfo semaphoreInfo = {
       .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
   };
-  VkFenceCreateInfo fenceInfo = {
-      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-      .flags = VK_FENCE_CREATE_SIGNALED_BIT,
-  };
   for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
     printf("creating sync objects for index: %d\n", i);
     if (vkCreateSemaphore(device, &semaphoreInfo, NULL,
@@ -1284,127 +2843,575 @@ void createSyncObjects() {
       printf("failed to create semaphore\n");
       exit(1);
     }
-    if (vkCreateSemaphore(device, &semaphoreInfo, NULL,
-                          &renderFinishedSemaphores[i]) != VK_SUCCESS) {
-      printf("failed to create semaphore");
-      exit(1);
-    }
-    if (vkCreateFence(device, &fenceInfo, NULL, &inFlight[i]) != VK_SUCCESS) {
-      printf("failed to create fence");
-      exit(1);
-    }
   }
+  createPresentSemaphores();
+  framePacerInit(&framePacer, device, framesInFlight);
 }
 
-clock_t start = 0;
+// Lights and cluster uniforms are rewritten by the CPU every frame; the
+// cluster lists only ever live on the GPU. With async compute the first two
+// are read by both queues, while the lists are handed from the compute queue
+// to the graphics queue each frame.
+void createLightBuffers() {
+  lightBuffers = malloc(sizeof(VkBuffer) * MAX_FRAMES_IN_FLIGHT);
+  lightMemoryList = malloc(sizeof(VkDeviceMemory) * MAX_FRAMES_IN_FLIGHT);
+  lightsMapped = malloc(sizeof(void *) * MAX_FRAMES_IN_FLIGHT);
+  clusterUniformBuffers = malloc(sizeof(VkBuffer) * MAX_FRAMES_IN_FLIGHT);
+  clusterUniformMemoryList =
+      malloc(sizeof(VkDeviceMemory) * MAX_FRAMES_IN_FLIGHT);
+  clusterUniformsMapped = malloc(sizeof(void *) * MAX_FRAMES_IN_FLIGHT);
+  clusterLightBuffers = malloc(sizeof(VkBuffer) * MAX_FRAMES_IN_FLIGHT);
+  clusterLightMemoryList =
+      malloc(sizeof(VkDeviceMemory) * MAX_FRAMES_IN_FLIGHT);
+  if (lightBuffers == NULL || lightMemoryList == NULL ||
+      lightsMapped == NULL || clusterUniformBuffers == NULL ||
+      clusterUniformMemoryList == NULL || clusterUniformsMapped == NULL ||
+      clusterLightBuffers == NULL || clusterLightMemoryList == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  VkDeviceSize clusterSize = sizeof(uint32_t) * (CLUSTER_MAX_LIGHTS + 1) *
+                             CLUSTER_COUNT * viewCount;
+  uint32_t families[] = {queueFamilies.graphics, queueFamilies.compute};
+  uint32_t familyCount = asyncCompute ? 2 : 1;
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    createSharedBuffer(sizeof(Light) * LIGHT_MAX,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                       families, familyCount, &lightBuffers[i],
+                       &lightMemoryList[i]);
+    vkMapMemory(device, lightMemoryList[i], 0, sizeof(Light) * LIGHT_MAX, 0,
+                &lightsMapped[i]);
+    createSharedBuffer(sizeof(ClusterUniforms),
+                       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                       families, familyCount, &clusterUniformBuffers[i],
+                       &clusterUniformMemoryList[i]);
+    vkMapMemory(device, clusterUniformMemoryList[i], 0,
+                sizeof(ClusterUniforms), 0, &clusterUniformsMapped[i]);
+    createBuffer(clusterSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &clusterLightBuffers[i],
+                 &clusterLightMemoryList[i]);
+  }
+}
 
-void updateUniformBuffer(uint32_t currentImage) {
-  if (start == 0) {
-    start = clock();
+void destroyLightBuffers() {
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vkDestroyBuffer(device, lightBuffers[i], NULL);
+    vkFreeMemory(device, lightMemoryList[i], NULL);
+    vkDestroyBuffer(device, clusterUniformBuffers[i], NULL);
+    vkFreeMemory(device, clusterUniformMemoryList[i], NULL);
+    vkDestroyBuffer(device, clusterLightBuffers[i], NULL);
+    vkFreeMemory(device, clusterLightMemoryList[i], NULL);
   }
-  clock_t currentTime = clock();
-  float time = (float)(currentTime - start) / CLOCKS_PER_SEC;
-  UniformBufferObject ubo = {
-      .model = GLM_MAT4_IDENTITY_INIT,
-      .view = GLM_MAT4_IDENTITY_INIT,
-      .proj = GLM_MAT4_IDENTITY_INIT,
-  };
-  glm_rotate(ubo.model, time / 50 * glm_rad(45.0f), (vec3){0.0f, 0.0f, 1.0f});
+  free(lightBuffers);
+  free(lightMemoryList);
+  free(lightsMapped);
+  free(clusterUniformBuffers);
+  free(clusterUniformMemoryList);
+  free(clusterUniformsMapped);
+  free(clusterLightBuffers);
+  free(clusterLightMemoryList);
+}
+
+// Uniform in [0, 1) and fixed per light, so changing the count keeps the
+// lights already placed.
+float lightRandom(uint32_t light, uint32_t channel) {
+  uint32_t h = light * 0x9E3779B1u ^ channel * 0x85EBCA77u;
+  h ^= h >> 15;
+  h *= 0x2C1B3C6Du;
+  h ^= h >> 12;
+  h *= 0x297A2D39u;
+  h ^= h >> 15;
+  return (h >> 8) / 16777216.0f;
+}
+
+// Scatters the lights through the scene bounds, each circling its own spot.
+void updateLights(uint32_t slot) {
+  if (lightCount == 0) {
+    return;
+  }
+  vec3 size;
+  glm_vec3_sub(sceneMax, sceneMin, size);
+  float volume = size[0] * size[1] * size[2];
+  // LIGHT_OVERLAP spheres of this radius cover the volume on average
+  float radius =
+      cbrtf(volume * LIGHT_OVERLAP / (lightCount * 4.0f / 3.0f * GLM_PIf));
+  float orbit = radius * 0.25f;
+  float time = (float)frameClock.elapsedSeconds;
+  Light *lights = lightsMapped[slot];
+  for (uint32_t i = 0; i < lightCount; i++) {
+    float angle = time * (0.5f + lightRandom(i, 3)) +
+                  lightRandom(i, 4) * 2.0f * GLM_PIf;
+    lights[i] = (Light){
+        .sphere = {sceneMin[0] + lightRandom(i, 0) * size[0] +
+                       cosf(angle) * orbit,
+                   sceneMin[1] + lightRandom(i, 1) * size[1] +
+                       sinf(angle) * orbit,
+                   sceneMin[2] + lightRandom(i, 2) * size[2], radius},
+        .color = {LIGHT_INTENSITY * (0.2f + 0.8f * lightRandom(i, 5)),
+                  LIGHT_INTENSITY * (0.2f + 0.8f * lightRandom(i, 6)),
+                  LIGHT_INTENSITY * (0.2f + 0.8f * lightRandom(i, 7)), 0.0f},
+    };
+  }
+}
+
+void setLightCount(uint32_t count) {
+  static char frameLabel[32];
+  static char binLabel[32];
+  lightCount = count;
+  snprintf(frameLabel, sizeof(frameLabel), "%u lights", count);
+  snprintf(binLabel, sizeof(binLabel), "binning %u lights", count);
+  gpuTimerSetLabel(&gpuTimer, frameLabel);
+  gpuTimerSetLabel(&lightBinTimer, binLabel);
+}
+
+// Views are the camera shifted along its right axis, so the union of their
+// frustums is bounded by the first view's left plane, the last view's right
+// plane and the planes they share.
+void updateUniformBuffer(uint32_t currentImage) {
+  float time = (float)frameClock.elapsedSeconds;
+  mat4 model = GLM_MAT4_IDENTITY_INIT;
+  mat4 proj;
+  glm_rotate(model, time / 50 * glm_rad(45.0f), (vec3){0.0f, 0.0f, 1.0f});
   vec3 eye = {1.0f, 1.0f, 1.0f};
   vec3 center = {0.0f, 0.0f, 0.0f};
   vec3 up = {0.0f, 0.0f, 1.0f};
-  glm_lookat(eye, center, up, ubo.view);
+  vec3 forward, right;
+  glm_vec3_sub(center, eye, forward);
+  glm_vec3_crossn(forward, up, right);
   glm_perspective(glm_rad(45.0f),
-                  swapchainExtent.width / (float)swapchainExtent.height, 0.1f,
-                  10.0f, ubo.proj);
-  ubo.proj[1][1] *= -1;
+                  swapchainExtent.width / (float)swapchainExtent.height,
+                  CAMERA_NEAR, CAMERA_FAR, proj);
+  proj[1][1] *= -1;
+  UniformBufferObject ubo = {0};
+  // lights are binned in each view's eye space, tiled over the rendered
+  // region
+  ClusterUniforms clusters = {
+      .grid = {CLUSTER_TILES_X, CLUSTER_TILES_Y, CLUSTER_SLICES, lightCount},
+      .slices = {(float)renderExtent.width, (float)renderExtent.height,
+                 CAMERA_NEAR, CAMERA_FAR},
+      // no lights leaves the scene as textured
+      .ambient = lightCount > 0 ? LIGHT_AMBIENT : 1.0f,
+  };
+  glm_mat4_inv(proj, clusters.invProj);
+  // the pyramid the early cull tests against was built last frame
+  glm_mat4_copy(sceneViewProj, prevViewProj);
+  for (uint32_t i = 0; i < viewCount; i++) {
+    float shift = (i - (viewCount - 1) / 2.0f) * MULTIVIEW_EYE_SEPARATION;
+    vec3 offset, viewEye, viewCenter;
+    glm_vec3_scale(right, shift, offset);
+    glm_vec3_add(eye, offset, viewEye);
+    glm_vec3_add(center, offset, viewCenter);
+    mat4 view;
+    glm_lookat(viewEye, viewCenter, up, view);
+    glm_mat4_mul(view, model, clusters.view[i]);
+    // planes in object space before the per-object transform
+    glm_mat4_mulN((mat4 *[]){&proj, &view, &model}, 3, ubo.viewProj[i]);
+    vec4 planes[6];
+    glm_frustum_planes(ubo.viewProj[i], planes);
+    if (i == 0) {
+      memcpy(cullPlanes, planes, sizeof(planes));
+    } else {
+      // left, right, bottom, top, near, far
+      glm_vec4_copy(planes[1], cullPlanes[1]);
+    }
+  }
   memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+  memcpy(clusterUniformsMapped[currentImage], &clusters, sizeof(clusters));
+  glm_mat4_copy(ubo.viewProj[0], sceneViewProj);
+  // the pyramid only holds the first view's depth
+  CullUniforms cull = {
+      .pyramidSize = {(int32_t)swapchainExtent.width,
+                      (int32_t)swapchainExtent.height},
+      .occlusion = occlusionCulling && viewCount == 1,
+  };
+  memcpy(cull.planes, cullPlanes, sizeof(cullPlanes));
+  glm_mat4_copy(sceneViewProj, cull.viewProj);
+  glm_mat4_copy(prevViewProj, cull.prevViewProj);
+  memcpy(cullUniformsMapped[currentImage], &cull, sizeof(cull));
 }
 
-void drawFrame() {
-  vkWaitForFences(device, 1, &inFlight[currentFrame], VK_TRUE, UINT64_MAX);
-
-  uint32_t imageIndex;
-  vkAcquireNextImageKHR(device, swapchain, UINT64_MAX,
-                        imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE,
-                        &imageIndex);
-  updateUniformBuffer(currentFrame);
-  vkResetFences(device, 1, &inFlight[currentFrame]);
-  vkResetCommandBuffer(commandBuffers[currentFrame], 0);
-  recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
-
-  VkPipelineStageFlags waitStages[] = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  VkSubmitInfo submitInfo = {
-      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-      .waitSemaphoreCount = 1,
-      .pWaitSemaphores = &imageAvailableSemaphores[currentFrame],
-      .pWaitDstStageMask = waitStages,
-      .commandBufferCount = 1,
-      .pCommandBuffers = &commandBuffers[currentFrame],
-      .signalSemaphoreCount = 1,
-      .pSignalSemaphores = &renderFinishedSemaphores[currentFrame],
-  };
-  if (vkQueueSubmit(queue, 1, &submitInfo, inFlight[currentFrame]) !=
-      VK_SUCCESS) {
-    printf("queue submit failed\n");
-    exit(1);
+// The slot's counts are from the frame that just retired.
+void collectOcclusionStats() {
+  CullCounts *counts = drawCountMapped[currentFrame];
+  if (counts->frustumVisible == 0) {
+    return;
   }
-  VkPresentInfoKHR presentInfo = {
-      .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-      .waitSemaphoreCount = 1,
-      .pWaitSemaphores = &renderFinishedSemaphores[currentFrame],
-      .swapchainCount = 1,
-      .pSwapchains = &swapchain,
-      .pImageIndices = &imageIndex,
-  };
-  VkResult result = vkQueuePresentKHR(queue, &presentInfo);
-  if (result != VK_SUCCESS) {
-    printf("present failed\n");
-    exit(1);
+  uint32_t drawn = counts->drawCount[0] + counts->drawCount[1];
+  occlusionCulledSum +=
+      100.0 * (counts->frustumVisible - drawn) / counts->frustumVisible;
+  if (++occlusionFrames % OCCLUSION_REPORT_INTERVAL == 0) {
+    printf("occlusion: %.1f%% culled per frame, last frame %u in frustum, "
+           "%u early, %u of %u retested late\n",
+           occlusionCulledSum / occlusionFrames, counts->frustumVisible,
+           counts->drawCount[0], counts->drawCount[1],
+           counts->candidateCount);
   }
-  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
-void createDepthResources() {
-  VkFormat depthFormat = VK_FORMAT_D32_SFLOAT;
-  createImage(
-      swapchainExtent.width, swapchainExtent.height, 1, msaaSample, depthFormat,
-      VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthImage, &depthImageMemory);
-  depthImageView =
-      createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+void updateRenderScale() {
+  if (!dynResUpdate(&dynRes, gpuTimer.lastMs)) {
+    return;
+  }
+  float scale = dynResScale(&dynRes);
+  renderExtent.width = (uint32_t)(swapchainExtent.width * scale);
+  renderExtent.height = (uint32_t)(swapchainExtent.height * scale);
 }
 
-void initWindow() {
-  if (!glfwInit()) {
-    printf("failed to init GLFW\n");
-    exit(1);
+// Queues rebuilds of the scene variants using each recompiled shader. The
+// library swaps them in at a later frame boundary once they have compiled.
+void reloadShaders() {
+  char name[SHADER_WATCH_NAME_SIZE];
+  while (shaderWatchPoll(&shaderWatcher, name, sizeof(name))) {
+    uint32_t count = pipelineLibraryRebuild(&pipelineLibrary,
+                                            sceneVariantUsesShader, name);
+    if (count == 0) {
+      printf("%s is not hot-reloadable, restart to pick it up\n", name);
+    } else {
+      printf("%s changed, rebuilding %u pipelines\n", name, count);
+    }
   }
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-  window = glfwCreateWindow(800, 600, "Learn Vulkan", NULL, NULL);
 }
 
-void loadFile(void *ctx, const char *filename, const int isMtl,
-              const char *objFilename, char **data, size_t *len) {
-  if (isMtl == 1) {
+void destroyRetiredSwapchain(RetiredSwapchain *retired) {
+  if (retired->framebuffers != NULL) {
+    for (uint32_t i = 0; i < retired->imageCount * scenePassCount(); i++) {
+      vkDestroyFramebuffer(device, retired->framebuffers[i], NULL);
+    }
+  }
+  for (uint32_t i = 0; i < retired->imageCount; i++) {
+    vkDestroyImageView(device, retired->views[i], NULL);
+    vkDestroySemaphore(device, retired->renderFinished[i], NULL);
+  }
+  vkDestroySwapchainKHR(device, retired->swapchain, NULL);
+  free(retired->images);
+  free(retired->views);
+  free(retired->framebuffers);
+  free(retired->renderFinished);
+  if (retired->frameGraph == NULL) {
     return;
   }
-  *data = load(filename, len);
-  printf("load file len: %lld\n", *len);
+  rgDestroy(retired->frameGraph, device);
+  free(retired->frameGraph);
+  for (uint32_t i = 0; i < retired->depthPyramidLevels; i++) {
+    vkDestroyImageView(device, retired->depthPyramidMips[i], NULL);
+  }
+  vkDestroyImageView(device, retired->depthPyramidView, NULL);
+  vkDestroyImage(device, retired->depthPyramid, NULL);
+  vkFreeMemory(device, retired->depthPyramidMemory, NULL);
 }
 
-void loadModel(const char *filename, Vertex **vertices, int *numVertices) {
-  tinyobj_attrib_t attrib;
-  tinyobj_shape_t *shapes;
-  tinyobj_material_t *materials;
-  size_t numShapes;
-  size_t numMaterials;
-  int result =
-      tinyobj_parse_obj(&attrib, &shapes, &numShapes, &materials, &numMaterials,
-                        filename, loadFile, NULL, TINYOBJ_FLAG_TRIANGULATE);
-  if (result != TINYOBJ_SUCCESS) {
+void collectRetiredSwapchains() {
+  if (retiredSwapchainCount == 0) {
+    return;
+  }
+  uint64_t completed = 0;
+  vkGetSemaphoreCounterValue(device, framePacer.timeline, &completed);
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < retiredSwapchainCount; i++) {
+    if (retiredSwapchains[i].value <= completed) {
+      destroyRetiredSwapchain(&retiredSwapchains[i]);
+    } else {
+      retiredSwapchains[kept++] = retiredSwapchains[i];
+    }
+  }
+  retiredSwapchainCount = kept;
+}
+
+void drawFrame() {
+  currentFrame = framePacerBeginFrame(&framePacer, device);
+  frameStartNs = timerNowNs();
+  uploaderCollect(&uploader, device);
+  bindlessCollect(&bindless, currentFrame);
+  pipelineLibraryCollect(&pipelineLibrary, device, currentFrame);
+  if (hotReload) {
+    reloadShaders();
+  }
+  pipelineLibrarySwap(&pipelineLibrary, currentFrame);
+  pipelineStatsCollect(&pipelineStats, device, currentFrame);
+  if (capturePath != NULL) {
+    readbackPoll(&readback, device, framePacer.timeline);
+  }
+  if (!headless) {
+    collectRetiredSwapchains();
+  }
+  collectOcclusionStats();
+  gpuTimerCollect(&lightBinTimer, device, currentFrame);
+  if (gpuTimerCollect(&gpuTimer, device, currentFrame) && dynamicResolution) {
+    updateRenderScale();
+  }
+  updateScene();
+  instanceBufferSync(&instances, currentFrame);
+
+  uint32_t imageIndex = currentFrame;
+  if (!headless) {
+    VkResult acquired = vkAcquireNextImageKHR(
+        device, swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame],
+        VK_NULL_HANDLE, &imageIndex);
+    if (acquired == VK_ERROR_OUT_OF_DATE_KHR) {
+      // nothing was submitted, so the frame starts over on a new swapchain
+      swapchainDirty = true;
+      return;
+    }
+    if (acquired == VK_SUBOPTIMAL_KHR) {
+      // still presentable; replaced after this frame
+      swapchainDirty = true;
+    } else if (acquired != VK_SUCCESS) {
+      printf("failed to acquire swapchain image: %d\n", acquired);
+      exit(1);
+    }
+  }
+  updateUniformBuffer(currentFrame);
+  updateLights(currentFrame);
+  updateAttachmentSets(currentFrame);
+  if (asyncCompute) {
+    submitLightBinning(framePacerSignalValue(&framePacer));
+  }
+  vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+  recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+
+  VkSemaphoreSubmitInfo waits[3];
+  uint32_t waitCount = 0;
+  VkSemaphoreSubmitInfo signals[2];
+  uint32_t signalCount = 0;
+  // headless frames have no acquire or present, so skip the binary semaphores
+  if (!headless) {
+    waits[waitCount++] = (VkSemaphoreSubmitInfo){
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = imageAvailableSemaphores[currentFrame],
+        .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+    };
+    signals[signalCount++] = (VkSemaphoreSubmitInfo){
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = renderFinishedSemaphores[imageIndex],
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+    };
+  }
+  // only wait on the transfer queue when this frame acquires uploads
+  if (uploadWaitValue > 0) {
+    waits[waitCount++] = (VkSemaphoreSubmitInfo){
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = uploader.timeline,
+        .value = uploadWaitValue,
+        .stageMask = uploadWaitStages,
+    };
+  }
+  // shading needs this frame's cluster lists from the compute queue
+  if (asyncCompute) {
+    waits[waitCount++] = (VkSemaphoreSubmitInfo){
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = computeTimeline,
+        .value = framePacerSignalValue(&framePacer),
+        .stageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+    };
+  }
+  signals[signalCount++] = (VkSemaphoreSubmitInfo){
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+      .semaphore = framePacer.timeline,
+      .value = framePacerSignalValue(&framePacer),
+      .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+  };
+  VkCommandBufferSubmitInfo cmdInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+      .commandBuffer = commandBuffers[currentFrame],
+  };
+  VkSubmitInfo2 submitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+      .waitSemaphoreInfoCount = waitCount,
+      .pWaitSemaphoreInfos = waits,
+      .commandBufferInfoCount = 1,
+      .pCommandBufferInfos = &cmdInfo,
+      .signalSemaphoreInfoCount = signalCount,
+      .pSignalSemaphoreInfos = signals,
+  };
+  if (vkQueueSubmit2(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    printf("queue submit failed\n");
+    exit(1);
+  }
+  if (headless) {
+    barrierEndFrame(&frameBarriers);
+    framePacerEndFrame(&framePacer);
+    return;
+  }
+  // the frame's timeline value doubles as its present id
+  uint64_t presentId = framePacerSignalValue(&framePacer);
+  VkPresentIdKHR presentIdInfo = {
+      .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+      .swapchainCount = 1,
+      .pPresentIds = &presentId,
+  };
+  VkPresentInfoKHR presentInfo = {
+      .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+      .pNext = presentWaitSupported ? &presentIdInfo : NULL,
+      .waitSemaphoreCount = 1,
+      .pWaitSemaphores = &renderFinishedSemaphores[imageIndex],
+      .swapchainCount = 1,
+      .pSwapchains = &swapchain,
+      .pImageIndices = &imageIndex,
+  };
+  VkResult result =
+      presentLatencyPresent(&presentLatency, queue, &presentInfo);
+  if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+    presentLatencyTrack(&presentLatency, swapchain, presentId, frameStartNs,
+                        presentMode);
+  }
+  if (result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR) {
+    swapchainDirty = true;
+  } else if (result != VK_SUCCESS) {
+    printf("present failed: %d\n", result);
+    exit(1);
+  }
+  barrierEndFrame(&frameBarriers);
+  framePacerEndFrame(&framePacer);
+}
+
+bool aaModeSupported(uint32_t mode) {
+  // FXAA filters a single layer
+  if (aaModes[mode].fxaa) {
+    return swapchainTransferDst && viewCount == 1;
+  }
+  return (supportedSamples & aaModes[mode].samples) != 0;
+}
+
+void keyCallback(GLFWwindow *window, int key, int scancode, int action,
+                 int mods) {
+  if (action != GLFW_PRESS) {
+    return;
+  }
+  // 1-4 trade throughput against latency
+  if (key >= GLFW_KEY_1 && key <= GLFW_KEY_4) {
+    framePacerSetDepth(&framePacer, key - GLFW_KEY_1 + 1);
+  }
+  if (key == GLFW_KEY_A) {
+    uint32_t next = requestedAaMode;
+    do {
+      next = (next + 1) % aaModeCount;
+    } while (!aaModeSupported(next));
+    requestedAaMode = next;
+  }
+  if (key == GLFW_KEY_O) {
+    occlusionCulling = !occlusionCulling;
+    printf("occlusion culling %s\n", occlusionCulling ? "on" : "off");
+  }
+  if (key == GLFW_KEY_P) {
+    depthPrepass = !depthPrepass;
+    printf("depth prepass %s\n", depthPrepass ? "on" : "off");
+  }
+  if (key == GLFW_KEY_W && wireframeSupported) {
+    wireframe = !wireframe;
+    printf("wireframe %s\n", wireframe ? "on" : "off");
+  }
+  if (key == GLFW_KEY_T) {
+    texturing = !texturing;
+    printf("texturing %s\n", texturing ? "on" : "off");
+  }
+  if (key == GLFW_KEY_C) {
+    alphaTest = !alphaTest;
+    printf("alpha test %s\n", alphaTest ? "on" : "off");
+  }
+  if (key == GLFW_KEY_M) {
+    requestedPresentMode = (VkPresentModeKHR)((requestedPresentMode + 1) %
+                                              PRESENT_LATENCY_MODES);
+    swapchainDirty = true;
+  }
+}
+
+bool pickHit(uint32_t prim, vec3 origin, vec3 dir, float *t, void *userData) {
+  InstanceData *instance = instanceGet(&instances, sceneHandles[prim]);
+  vec4 sphere;
+  glm_sphere_transform(instance->sphere, instance->model, sphere);
+  float t1, t2;
+  if (!glm_ray_sphere(origin, dir, sphere, &t1, &t2)) {
+    return false;
+  }
+  float entry = t1 >= 0.0f ? t1 : t2;
+  if (entry < 0.0f || entry >= *t) {
+    return false;
+  }
+  *t = entry;
+  return true;
+}
+
+// Casts a ray through the cursor in scene space, before the shared model
+// rotation, and reports the closest object.
+void mouseButtonCallback(GLFWwindow *window, int button, int action,
+                         int mods) {
+  if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) {
+    return;
+  }
+  double x, y;
+  glfwGetCursorPos(window, &x, &y);
+  // the cursor is in screen coordinates, which on HiDPI displays are not
+  // the framebuffer pixels the swapchain covers
+  int windowWidth, windowHeight, framebufferWidth, framebufferHeight;
+  glfwGetWindowSize(window, &windowWidth, &windowHeight);
+  glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+  if (windowWidth == 0 || windowHeight == 0) {
+    return;
+  }
+  x *= (double)framebufferWidth / windowWidth;
+  y *= (double)framebufferHeight / windowHeight;
+  mat4 inverse;
+  glm_mat4_inv(sceneViewProj, inverse);
+  vec4 viewport = {0.0f, 0.0f, (float)swapchainExtent.width,
+                   (float)swapchainExtent.height};
+  vec3 nearPoint, farPoint, dir;
+  glm_unprojecti((vec3){(float)x, (float)y, 0.0f}, inverse, viewport,
+                 nearPoint);
+  glm_unprojecti((vec3){(float)x, (float)y, 1.0f}, inverse, viewport,
+                 farPoint);
+  glm_vec3_sub(farPoint, nearPoint, dir);
+  glm_vec3_normalize(dir);
+  float t;
+  uint32_t prim = bvhRayCast(&sceneBvh, nearPoint, dir, INFINITY, pickHit,
+                             NULL, &t);
+  if (prim == UINT32_MAX) {
+    printf("picked nothing\n");
+  } else {
+    printf("picked object %u at distance %.3f\n", prim, t);
+  }
+}
+
+void framebufferSizeCallback(GLFWwindow *window, int width, int height) {
+  swapchainDirty = true;
+}
+
+void initWindow() {
+  if (!glfwInit()) {
+    printf("failed to init GLFW\n");
+    exit(1);
+  }
+  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+  // capture streams have a fixed frame size
+  glfwWindowHint(GLFW_RESIZABLE, capturePath == NULL ? GLFW_TRUE : GLFW_FALSE);
+  window = glfwCreateWindow(800, 600, "Learn Vulkan", NULL, NULL);
+  glfwSetKeyCallback(window, keyCallback);
+  glfwSetMouseButtonCallback(window, mouseButtonCallback);
+  glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+}
+
+void loadFile(void *ctx, const char *filename, const int isMtl,
+              const char *objFilename, char **data, size_t *len) {
+  if (isMtl == 1) {
+    return;
+  }
+  *data = load(filename, len);
+  printf("load file len: %lld\n", *len);
+}
+
+void loadModel(const char *filename, Vertex **vertices, int *numVertices) {
+  tinyobj_attrib_t attrib;
+  tinyobj_shape_t *shapes;
+  tinyobj_material_t *materials;
+  size_t numShapes;
+  size_t numMaterials;
+  int result =
+      tinyobj_parse_obj(&attrib, &shapes, &numShapes, &materials, &numMaterials,
+                        filename, loadFile, NULL, TINYOBJ_FLAG_TRIANGULATE);
+  if (result != TINYOBJ_SUCCESS) {
     printf("Failed to load model, error: %d\n", result);
     exit(1);
   }
@@ -1442,75 +3449,1085 @@ void loadModel(const char *filename, Vertex **vertices, int *numVertices) {
 }
 
 void createModelBuffer() {
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingMemory;
   VkDeviceSize bufferSize = sizeof(Vertex) * modelVerticesNum;
-  createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               &stagingBuffer, &stagingMemory);
-
-  void *data;
-  vkMapMemory(device, stagingMemory, 0, bufferSize, 0, &data);
-  memcpy(data, modelVertices, bufferSize);
-  vkUnmapMemory(device, stagingMemory);
   createBuffer(
       bufferSize,
       VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &modelBuffer, &modelBufferMemory);
-  copyBuffer(stagingBuffer, modelBuffer, bufferSize);
-  vkDestroyBuffer(device, stagingBuffer, NULL);
-  vkFreeMemory(device, stagingMemory, NULL);
+  uploadBuffer(modelVertices, bufferSize, modelBuffer,
+               VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT,
+               VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT);
+}
+
+void createPositionBuffer() {
+  vec3 *positions = malloc(sizeof(vec3) * modelVerticesNum);
+  if (positions == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  for (int i = 0; i < modelVerticesNum; i++) {
+    glm_vec3_copy(modelVertices[i].vertex, positions[i]);
+  }
+  VkDeviceSize size = sizeof(vec3) * modelVerticesNum;
+  createBuffer(
+      size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &positionBuffer,
+      &positionBufferMemory);
+  uploadBuffer(positions, size, positionBuffer,
+               VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT,
+               VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT);
+  free(positions);
+}
+
+void createModelIndexBuffer() {
+  // the model is unrolled per face, so indices are sequential
+  modelIndicesNum = modelVerticesNum;
+  modelIndices = malloc(sizeof(uint32_t) * modelIndicesNum);
+  if (modelIndices == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  for (uint32_t i = 0; i < modelIndicesNum; i++) {
+    modelIndices[i] = i;
+  }
+  VkDeviceSize size = sizeof(uint32_t) * modelIndicesNum;
+  createBuffer(
+      size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &modelIndiciesBuffer,
+      &modelIndicesBufferMemory);
+  uploadBuffer(modelIndices, size, modelIndiciesBuffer,
+               VK_ACCESS_2_INDEX_READ_BIT, VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT);
+}
+
+// Lays objectCount instances of the model out on a square grid around the
+// origin, each with the model's bounding sphere for culling.
+void createObjects() {
+  vec3 boxMin = {INFINITY, INFINITY, INFINITY};
+  vec3 boxMax = {-INFINITY, -INFINITY, -INFINITY};
+  for (int i = 0; i < modelVerticesNum; i++) {
+    glm_vec3_minv(boxMin, modelVertices[i].vertex, boxMin);
+    glm_vec3_maxv(boxMax, modelVertices[i].vertex, boxMax);
+  }
+  vec3 center;
+  glm_vec3_center(boxMin, boxMax, center);
+  float radius = 0.0f;
+  for (int i = 0; i < modelVerticesNum; i++) {
+    radius = glm_max(radius, glm_vec3_distance(center, modelVertices[i].vertex));
+  }
+  instanceBufferInit(&instances, device, physicalDevice, objectCount);
+  sceneHandles = malloc(sizeof(uint32_t) * objectCount);
+  if (sceneHandles == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  sceneBoxes = malloc(sizeof(vec3) * 2 * objectCount);
+  if (sceneBoxes == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  uint32_t side = (uint32_t)ceil(sqrt((double)objectCount));
+  float spacing = radius * 2.5f;
+  float offset = (side - 1) * spacing * 0.5f;
+  for (uint32_t i = 0; i < objectCount; i++) {
+    Texture *texture = &sceneTextures[i % SCENE_TEXTURE_COUNT];
+    InstanceData instance = {
+        .indexCount = modelIndicesNum,
+        .firstIndex = 0,
+        .vertexOffset = 0,
+        .materialIndex = bindlessMaterial(texture->slot, textureSamplerSlot),
+    };
+    vec3 position = {(i % side) * spacing - offset,
+                     (i / side) * spacing - offset, 0.0f};
+    glm_translate_make(instance.model, position);
+    glm_vec4(center, radius, instance.sphere);
+    // the buffer is sized for every object, so this never fails
+    sceneHandles[i] = instanceAdd(&instances, &instance);
+    vec4 sphere;
+    glm_sphere_transform(instance.sphere, instance.model, sphere);
+    glm_vec3_subs(sphere, radius, sceneBoxes[i * 2]);
+    glm_vec3_adds(sphere, radius, sceneBoxes[i * 2 + 1]);
+  }
+  glm_vec3_copy(sceneBoxes[0], sceneMin);
+  glm_vec3_copy(sceneBoxes[1], sceneMax);
+  for (uint32_t i = 1; i < objectCount; i++) {
+    glm_vec3_minv(sceneMin, sceneBoxes[i * 2], sceneMin);
+    glm_vec3_maxv(sceneMax, sceneBoxes[i * 2 + 1], sceneMax);
+  }
+  bvhBuild(&sceneBvh, sceneBoxes, objectCount);
+  printf("objects: %u, bounding radius %.3f, %u bvh nodes\n", objectCount,
+         radius, sceneBvh.nodeCount);
+}
+
+// Removes and re-adds one instance per frame, so the last instance is moved
+// into the hole and both end up in the slot's dirty range.
+void updateScene() {
+  if (!stressScene) {
+    return;
+  }
+  uint32_t i = framePacer.frameIndex % objectCount;
+  InstanceData instance = *instanceGet(&instances, sceneHandles[i]);
+  instanceRemove(&instances, sceneHandles[i]);
+  // the removal just freed room for it
+  sceneHandles[i] = instanceAdd(&instances, &instance);
+}
+
+// Per frame slot, the cull pass of one frame must not overwrite the draws a
+// previous frame is still consuming.
+void createDrawBuffers() {
+  drawCommandBuffers = malloc(sizeof(VkBuffer) * MAX_FRAMES_IN_FLIGHT);
+  drawCommandMemoryList = malloc(sizeof(VkDeviceMemory) * MAX_FRAMES_IN_FLIGHT);
+  drawCountBuffers = malloc(sizeof(VkBuffer) * MAX_FRAMES_IN_FLIGHT);
+  drawCountMemoryList = malloc(sizeof(VkDeviceMemory) * MAX_FRAMES_IN_FLIGHT);
+  drawCountMapped = malloc(sizeof(void *) * MAX_FRAMES_IN_FLIGHT);
+  cullCandidateBuffers = malloc(sizeof(VkBuffer) * MAX_FRAMES_IN_FLIGHT);
+  cullCandidateMemoryList =
+      malloc(sizeof(VkDeviceMemory) * MAX_FRAMES_IN_FLIGHT);
+  cullUniformBuffers = malloc(sizeof(VkBuffer) * MAX_FRAMES_IN_FLIGHT);
+  cullUniformMemoryList = malloc(sizeof(VkDeviceMemory) * MAX_FRAMES_IN_FLIGHT);
+  cullUniformsMapped = malloc(sizeof(void *) * MAX_FRAMES_IN_FLIGHT);
+  if (drawCommandBuffers == NULL || drawCommandMemoryList == NULL ||
+      drawCountBuffers == NULL || drawCountMemoryList == NULL ||
+      drawCountMapped == NULL || cullCandidateBuffers == NULL ||
+      cullCandidateMemoryList == NULL || cullUniformBuffers == NULL ||
+      cullUniformMemoryList == NULL || cullUniformsMapped == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    // early draws, then late draws from instances.capacity
+    createBuffer(sizeof(VkDrawIndexedIndirectCommand) * instances.capacity * 2,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &drawCommandBuffers[i],
+                 &drawCommandMemoryList[i]);
+    createBuffer(sizeof(CullCounts),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 &drawCountBuffers[i], &drawCountMemoryList[i]);
+    vkMapMemory(device, drawCountMemoryList[i], 0, sizeof(CullCounts), 0,
+                &drawCountMapped[i]);
+    memset(drawCountMapped[i], 0, sizeof(CullCounts));
+    createBuffer(sizeof(uint32_t) * instances.capacity,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &cullCandidateBuffers[i],
+                 &cullCandidateMemoryList[i]);
+    createBuffer(sizeof(CullUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 &cullUniformBuffers[i], &cullUniformMemoryList[i]);
+    vkMapMemory(device, cullUniformMemoryList[i], 0, sizeof(CullUniforms), 0,
+                &cullUniformsMapped[i]);
+  }
+}
+
+// Starts out cleared to the far plane by the first cull pass after it, so
+// nothing is occluded before a frame has built it.
+void createDepthPyramid() {
+  uint32_t width = swapchainExtent.width;
+  uint32_t height = swapchainExtent.height;
+  depthPyramidLevels = 1;
+  while ((width > 1 || height > 1) && depthPyramidLevels < HIZ_MAX_LEVELS) {
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    depthPyramidLevels++;
+  }
+  createImage(swapchainExtent.width, swapchainExtent.height, depthPyramidLevels,
+              VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R32_SFLOAT,
+              VK_IMAGE_TILING_OPTIMAL,
+              VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+                  VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthPyramid,
+              &depthPyramidMemory);
+  depthPyramidView = createImageView(depthPyramid, VK_FORMAT_R32_SFLOAT,
+                                     VK_IMAGE_ASPECT_COLOR_BIT,
+                                     depthPyramidLevels);
+  for (uint32_t i = 0; i < depthPyramidLevels; i++) {
+    VkImageViewCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = depthPyramid,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = VK_FORMAT_R32_SFLOAT,
+        .subresourceRange =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .baseMipLevel = i,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+    };
+    if (vkCreateImageView(device, &info, NULL, &depthPyramidMips[i]) !=
+        VK_SUCCESS) {
+      printf("failed to create depth pyramid view\n");
+      exit(1);
+    }
+  }
+  depthPyramidCleared = false;
+}
+
+void destroyDepthPyramid() {
+  for (uint32_t i = 0; i < depthPyramidLevels; i++) {
+    vkDestroyImageView(device, depthPyramidMips[i], NULL);
+  }
+  vkDestroyImageView(device, depthPyramidView, NULL);
+  vkDestroyImage(device, depthPyramid, NULL);
+  vkFreeMemory(device, depthPyramidMemory, NULL);
+}
+
+// Compute reads of the pyramid wait for the last pyramid build, whether it
+// was recorded earlier this frame or last frame.
+static const VkMemoryBarrier2 pyramidReadBarrier = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+};
+
+void dispatchCull(VkCommandBuffer commandBuffer, uint32_t phase) {
+  CullPushConstants push = {
+      .objectCount = instances.count,
+      .phase = phase,
+      .lateOffset = instances.capacity,
+  };
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    cullPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          cullPipelineLayout, 0, 1,
+                          &cullDescriptorSets[currentFrame], 0, NULL);
+  vkCmdPushConstants(commandBuffer, cullPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+  // the late phase runs over the candidates, never more than the objects
+  vkCmdDispatch(commandBuffer, (instances.count + 63) / 64, 1, 1);
+  VkMemoryBarrier2 drawBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT |
+                      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT |
+                       VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                       VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+  };
+  VkDependencyInfo drawDependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &drawBarrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &drawDependency);
+}
+
+// Clears a new depth pyramid to the far plane, in GENERAL from then on.
+void clearDepthPyramid(VkCommandBuffer commandBuffer) {
+  VkImageSubresourceRange range = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel = 0,
+      .levelCount = depthPyramidLevels,
+      .baseArrayLayer = 0,
+      .layerCount = 1,
+  };
+  VkImageMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+      .srcAccessMask = VK_ACCESS_2_NONE,
+      .dstStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT,
+      .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = depthPyramid,
+      .subresourceRange = range,
+  };
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = 1,
+      .pImageMemoryBarriers = &barrier,
+  };
+  VkClearColorValue far = {.float32 = {1.0f, 0.0f, 0.0f, 0.0f}};
+  vkCmdPipelineBarrier2(commandBuffer, &dependency);
+  vkCmdClearColorImage(commandBuffer, depthPyramid, VK_IMAGE_LAYOUT_GENERAL,
+                       &far, 1, &range);
+  depthPyramidCleared = true;
+}
+
+void recordCullPass(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                    void *userData) {
+  if (!depthPyramidCleared) {
+    clearDepthPyramid(commandBuffer);
+  }
+  vkCmdFillBuffer(commandBuffer, drawCountBuffers[currentFrame], 0,
+                  sizeof(CullCounts), 0);
+  // covers the count clear and a pyramid clear alike
+  VkMemoryBarrier2 barriers[] = {
+      {
+          .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+          .srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT,
+          .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+          .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+          .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                           VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+                           VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+      },
+      pyramidReadBarrier,
+  };
+  VkDependencyInfo clearDependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 2,
+      .pMemoryBarriers = barriers,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &clearDependency);
+  dispatchCull(commandBuffer, CULL_PHASE_EARLY);
 }
 
-void createColorResources() {
-  VkFormat colorFormat = swapchainImageFormat;
-  createImage(swapchainExtent.width, swapchainExtent.height, 1, msaaSample,
-              colorFormat, VK_IMAGE_TILING_OPTIMAL,
-              VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT |
-                  VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &colorImage,
-              &colorImageMemory);
-  colorImageView =
-      createImageView(colorImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+// Retests what the early phase found occluded against the pyramid the hiz
+// pass just built from this frame's early draws.
+void recordLateCullPass(VkCommandBuffer commandBuffer,
+                        const RenderGraph *graph, void *userData) {
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &pyramidReadBarrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &dependency);
+  dispatchCull(commandBuffer, CULL_PHASE_LATE);
+  // the timeline signal alone does not make the counts visible to the host
+  VkMemoryBarrier2 hostBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT,
+      .dstAccessMask = VK_ACCESS_2_HOST_READ_BIT,
+  };
+  VkDependencyInfo hostDependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &hostBarrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &hostDependency);
+}
+
+// One invocation per cluster and view.
+void dispatchLightBin(VkCommandBuffer commandBuffer) {
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    lightBinPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          lightBinPipelineLayout, 0, 1,
+                          &descriptorSets[currentFrame], 0, NULL);
+  vkCmdDispatch(commandBuffer, (CLUSTER_COUNT + 63) / 64, viewCount, 1);
+}
+
+// Binning on the graphics queue; shading reads the lists from the fragment
+// shader.
+void recordLightBinPass(VkCommandBuffer commandBuffer,
+                        const RenderGraph *graph, void *userData) {
+  gpuTimerBegin(&lightBinTimer, commandBuffer, currentFrame);
+  dispatchLightBin(commandBuffer);
+  VkMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+      .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+  };
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &dependency);
+  gpuTimerEnd(&lightBinTimer, commandBuffer, currentFrame);
+}
+
+// Bins the slot's lists on the compute queue, overlapping the graphics
+// queue's culling and depth work, and releases them to the graphics family.
+// The slot's previous reads retired with it and its old lists are not
+// needed, so the writes need no acquire.
+void submitLightBinning(uint64_t value) {
+  VkCommandBuffer commandBuffer = computeCommandBuffers[currentFrame];
+  vkResetCommandBuffer(commandBuffer, 0);
+  VkCommandBufferBeginInfo beginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  vkBeginCommandBuffer(commandBuffer, &beginInfo);
+  if (computeTimestamps) {
+    gpuTimerBegin(&lightBinTimer, commandBuffer, currentFrame);
+  }
+  dispatchLightBin(commandBuffer);
+  if (computeTimestamps) {
+    gpuTimerEnd(&lightBinTimer, commandBuffer, currentFrame);
+  }
+  cmdReleaseBuffer(commandBuffer, clusterLightBuffers[currentFrame],
+                   queueFamilies.compute, queueFamilies.graphics,
+                   VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                   VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    printf("failed to record light binning\n");
+    exit(1);
+  }
+  VkCommandBufferSubmitInfo cmdInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+      .commandBuffer = commandBuffer,
+  };
+  VkSemaphoreSubmitInfo signalInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+      .semaphore = computeTimeline,
+      .value = value,
+      .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+  };
+  VkSubmitInfo2 submitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+      .commandBufferInfoCount = 1,
+      .pCommandBufferInfos = &cmdInfo,
+      .signalSemaphoreInfoCount = 1,
+      .pSignalSemaphoreInfos = &signalInfo,
+  };
+  if (vkQueueSubmit2(computeQueue, 1, &submitInfo, VK_NULL_HANDLE) !=
+      VK_SUCCESS) {
+    printf("compute submit failed\n");
+    exit(1);
+  }
+}
+
+// Takes over the lists submitLightBinning released; the frame's submit waits
+// for the binning at the fragment shader.
+void recordLightAcquirePass(VkCommandBuffer commandBuffer,
+                            const RenderGraph *graph, void *userData) {
+  VkBufferMemoryBarrier2 barrier = bufferAcquireBarrier(
+      clusterLightBuffers[currentFrame], queueFamilies.compute,
+      queueFamilies.graphics, VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+      VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT);
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .bufferMemoryBarrierCount = 1,
+      .pBufferMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(commandBuffer, &dependency);
+}
+
+// Builds the depth pyramid level by level, each waiting on the one above.
+// The first step resolves the early pass's depth, over the rendered region,
+// into the full-extent mip 0.
+void recordHizPass(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                   void *userData) {
+  // both cull phases of earlier work must be done reading
+  VkMemoryBarrier2 writeBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+                       VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+  };
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &writeBarrier,
+  };
+  uint32_t width = swapchainExtent.width;
+  uint32_t height = swapchainExtent.height;
+  PostPushConstants push = {
+      .region = {(int32_t)renderExtent.width, (int32_t)renderExtent.height},
+  };
+  for (uint32_t i = 0; i < depthPyramidLevels; i++) {
+    vkCmdPipelineBarrier2(commandBuffer, &dependency);
+    VkPipeline reduce = i == 0 && msaaSample != VK_SAMPLE_COUNT_1_BIT
+                            ? hizResolvePipeline
+                            : hizReducePipeline;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, reduce);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            postPipelineLayout, 0, 1,
+                            &hizDescriptorSets[currentFrame][i], 0, NULL);
+    vkCmdPushConstants(commandBuffer, postPipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(commandBuffer, (width + 7) / 8, (height + 7) / 8, 1);
+    push.region[0] = (int32_t)width;
+    push.region[1] = (int32_t)height;
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+  }
+}
+
+void recordFxaaPass(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                    void *userData) {
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    fxaaPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          postPipelineLayout, 0, 1,
+                          &fxaaDescriptorSets[currentFrame], 0, NULL);
+  PostPushConstants push = {
+      .region = {(int32_t)renderExtent.width, (int32_t)renderExtent.height},
+  };
+  vkCmdPushConstants(commandBuffer, postPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+  vkCmdDispatch(commandBuffer, (renderExtent.width + 7) / 8,
+                (renderExtent.height + 7) / 8, 1);
+}
+
+void recordUpscalePass(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                       void *userData) {
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    upscalePipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          postPipelineLayout, 0, 1,
+                          &upscaleDescriptorSets[currentFrame], 0, NULL);
+  PostPushConstants push = {
+      .region = {(int32_t)renderExtent.width, (int32_t)renderExtent.height},
+      .sharpness = upscaleSharpness,
+  };
+  vkCmdPushConstants(commandBuffer, postPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+  vkCmdDispatch(commandBuffer, (swapchainExtent.width + 7) / 8,
+                (swapchainExtent.height + 7) / 8, 1);
+}
+
+// The blit converts the RGBA post output to the swapchain's BGRA.
+void recordBlitPass(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                    void *userData) {
+  uint32_t imageIndex = *(uint32_t *)userData;
+  VkImageSubresourceLayers layers = {
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .mipLevel = 0,
+      .baseArrayLayer = 0,
+      .layerCount = 1,
+  };
+  VkOffset3D extent = {(int32_t)swapchainExtent.width,
+                       (int32_t)swapchainExtent.height, 1};
+  VkImageBlit region = {
+      .srcSubresource = layers,
+      .srcOffsets = {{0, 0, 0}, extent},
+      .dstSubresource = layers,
+      .dstOffsets = {{0, 0, 0}, extent},
+  };
+  vkCmdBlitImage(commandBuffer, rgImage(graph, rgPostOutput),
+                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                 swapchainImages[imageIndex],
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region,
+                 VK_FILTER_NEAREST);
+}
+
+// Places the views side by side, each column showing the middle of its
+// view at full size.
+void recordComposePass(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                       void *userData) {
+  uint32_t imageIndex = *(uint32_t *)userData;
+  int32_t width = (int32_t)swapchainExtent.width;
+  int32_t height = (int32_t)swapchainExtent.height;
+  VkImageBlit regions[MULTIVIEW_MAX_VIEWS];
+  for (uint32_t i = 0; i < viewCount; i++) {
+    int32_t left = (int32_t)(i * swapchainExtent.width / viewCount);
+    int32_t right = (int32_t)((i + 1) * swapchainExtent.width / viewCount);
+    int32_t crop = (width - (right - left)) / 2;
+    regions[i] = (VkImageBlit){
+        .srcSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = 0,
+                .baseArrayLayer = i,
+                .layerCount = 1,
+            },
+        .srcOffsets = {{crop, 0, 0}, {crop + right - left, height, 1}},
+        .dstSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        .dstOffsets = {{left, 0, 0}, {right, height, 1}},
+    };
+  }
+  vkCmdBlitImage(commandBuffer, rgImage(graph, rgPostOutput),
+                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                 swapchainImages[imageIndex],
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, viewCount, regions,
+                 VK_FILTER_NEAREST);
+}
+
+void recordCapturePass(VkCommandBuffer commandBuffer, const RenderGraph *graph,
+                       void *userData) {
+  uint32_t imageIndex = *(uint32_t *)userData;
+  readbackRecord(&readback, commandBuffer, swapchainImages[imageIndex],
+                 framePacerSignalValue(&framePacer));
+}
+
+void createFrameGraph() {
+  rgInit(&frameGraph);
+  // acquire waits at color output, so that is where the image was last used
+  rgSwapchain = rgImportImage(&frameGraph, "swapchain", swapchainImageFormat,
+                              swapchainExtent, VK_IMAGE_ASPECT_COLOR_BIT,
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT);
+  // targets are allocated at the full extent so scale changes never
+  // reallocate them
+  bool fxaa = aaModes[aaMode].fxaa;
+  bool offscreen = renderOffscreen();
+  bool resolve = msaaSample != VK_SAMPLE_COUNT_1_BIT;
+  bool direct = !resolve && !offscreen;
+  if (!direct) {
+    rgColor = rgCreateImage(&frameGraph, "color", swapchainImageFormat,
+                            swapchainExtent, msaaSample,
+                            VK_IMAGE_ASPECT_COLOR_BIT);
+  }
+  rgDepth = rgCreateImage(&frameGraph, "depth", VK_FORMAT_D32_SFLOAT,
+                          swapchainExtent, msaaSample,
+                          VK_IMAGE_ASPECT_DEPTH_BIT);
+  if (viewCount > 1) {
+    rgSetLayers(&frameGraph, rgColor, viewCount);
+    rgSetLayers(&frameGraph, rgDepth, viewCount);
+  }
+  // writes only buffers, which the graph does not track
+  uint32_t cullPass =
+      rgAddPass(&frameGraph, "cull", true, recordCullPass, NULL);
+  rgSetSideEffects(&frameGraph, cullPass);
+  // writes or acquires the cluster lists, which the graph does not track
+  uint32_t lightBinPass =
+      asyncCompute ? rgAddPass(&frameGraph, "light acquire", false,
+                               recordLightAcquirePass, NULL)
+                   : rgAddPass(&frameGraph, "light bin", true,
+                               recordLightBinPass, NULL);
+  rgSetSideEffects(&frameGraph, lightBinPass);
+  uint32_t mainPass = rgAddPass(&frameGraph, "main", false, recordMainPass,
+                                &currentImageIndex);
+  uint32_t color = direct ? rgSwapchain : rgColor;
+  rgWrite(&frameGraph, mainPass, rgDepth, RG_USAGE_DEPTH_ATTACHMENT);
+  rgWrite(&frameGraph, mainPass, color, RG_USAGE_COLOR_ATTACHMENT);
+  // writes the pyramid, which the graph does not track, for the late cull
+  // and next frame's early cull; with several views it holds the first and
+  // goes unused
+  uint32_t hizPass = rgAddPass(&frameGraph, "hiz", true, recordHizPass, NULL);
+  rgRead(&frameGraph, hizPass, rgDepth, RG_USAGE_SAMPLED);
+  rgSetSideEffects(&frameGraph, hizPass);
+  uint32_t lateCullPass =
+      rgAddPass(&frameGraph, "cull late", true, recordLateCullPass, NULL);
+  rgSetSideEffects(&frameGraph, lateCullPass);
+  uint32_t latePass = rgAddPass(&frameGraph, "main late", false,
+                                recordLateMainPass, &currentImageIndex);
+  rgRead(&frameGraph, latePass, rgDepth, RG_USAGE_DEPTH_ATTACHMENT);
+  rgWrite(&frameGraph, latePass, rgDepth, RG_USAGE_DEPTH_ATTACHMENT);
+  rgRead(&frameGraph, latePass, color, RG_USAGE_COLOR_ATTACHMENT);
+  rgWrite(&frameGraph, latePass, color, RG_USAGE_COLOR_ATTACHMENT);
+  if (!offscreen) {
+    if (resolve) {
+      // the early pass's resolve attachment is bound but not stored
+      rgWrite(&frameGraph, mainPass, rgSwapchain, RG_USAGE_COLOR_ATTACHMENT);
+      rgWrite(&frameGraph, latePass, rgSwapchain, RG_USAGE_COLOR_ATTACHMENT);
+    }
+  } else {
+    uint32_t post = rgColor;
+    if (resolve) {
+      rgScene = rgCreateImage(&frameGraph, "scene", swapchainImageFormat,
+                              swapchainExtent, VK_SAMPLE_COUNT_1_BIT,
+                              VK_IMAGE_ASPECT_COLOR_BIT);
+      rgSetLayers(&frameGraph, rgScene, viewCount);
+      rgWrite(&frameGraph, mainPass, rgScene, RG_USAGE_COLOR_ATTACHMENT);
+      rgWrite(&frameGraph, latePass, rgScene, RG_USAGE_COLOR_ATTACHMENT);
+      post = rgScene;
+    }
+    if (fxaa) {
+      rgAaOutput = rgCreateImage(&frameGraph, "fxaa",
+                                 VK_FORMAT_R8G8B8A8_UNORM, swapchainExtent,
+                                 VK_SAMPLE_COUNT_1_BIT,
+                                 VK_IMAGE_ASPECT_COLOR_BIT);
+      uint32_t fxaaPass =
+          rgAddPass(&frameGraph, "fxaa", true, recordFxaaPass, NULL);
+      rgRead(&frameGraph, fxaaPass, post, RG_USAGE_SAMPLED);
+      rgWrite(&frameGraph, fxaaPass, rgAaOutput, RG_USAGE_STORAGE_WRITE);
+      post = rgAaOutput;
+    }
+    if (dynamicResolution) {
+      rgUpscaled = rgCreateImage(&frameGraph, "upscaled",
+                                 VK_FORMAT_R8G8B8A8_UNORM, swapchainExtent,
+                                 VK_SAMPLE_COUNT_1_BIT,
+                                 VK_IMAGE_ASPECT_COLOR_BIT);
+      uint32_t upscalePass =
+          rgAddPass(&frameGraph, "upscale", true, recordUpscalePass, NULL);
+      rgRead(&frameGraph, upscalePass, post, RG_USAGE_SAMPLED);
+      rgWrite(&frameGraph, upscalePass, rgUpscaled, RG_USAGE_STORAGE_WRITE);
+      post = rgUpscaled;
+    }
+    rgPostOutput = post;
+    uint32_t blitPass =
+        viewCount > 1
+            ? rgAddPass(&frameGraph, "compose", false, recordComposePass,
+                        &currentImageIndex)
+            : rgAddPass(&frameGraph, "blit", false, recordBlitPass,
+                        &currentImageIndex);
+    rgRead(&frameGraph, blitPass, rgPostOutput, RG_USAGE_TRANSFER_SRC);
+    rgWrite(&frameGraph, blitPass, rgSwapchain, RG_USAGE_TRANSFER_DST);
+  }
+  if (capturePath != NULL) {
+    // writes a readback buffer, which the graph does not track
+    uint32_t capturePass = rgAddPass(&frameGraph, "capture", false,
+                                     recordCapturePass, &currentImageIndex);
+    rgRead(&frameGraph, capturePass, rgSwapchain, RG_USAGE_TRANSFER_SRC);
+    rgSetSideEffects(&frameGraph, capturePass);
+  }
+  // headless frames end ready for readback instead of present
+  rgSetOutput(&frameGraph, rgSwapchain,
+              headless ? RG_USAGE_TRANSFER_SRC : RG_USAGE_PRESENT);
+  rgCompile(&frameGraph, device, physicalDevice);
+  rgDump(&frameGraph, stdout);
+}
+
+void createQueryPools() {
+  const char *names[PIPELINE_STATS_VARIANTS] = {"no prepass", "prepass"};
+  if (pipelineStatsSupported) {
+    pipelineStatsInit(&pipelineStats, device, names);
+  } else {
+    printf("pipeline statistics queries unsupported, not collecting\n");
+  }
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physicalDevice, &props);
+  gpuTimerInit(&gpuTimer, device, props.limits.timestampPeriod);
+  gpuTimerSetLabel(&gpuTimer, aaModes[aaMode].name);
+  gpuTimerInit(&lightBinTimer, device, props.limits.timestampPeriod);
+  gpuTimerSetLabel(&lightBinTimer, "light binning");
+}
+
+// Steps the requested mode down until the device supports it; 1x MSAA
+// always is.
+void initAaMode() {
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physicalDevice, &props);
+  supportedSamples = props.limits.framebufferColorSampleCounts &
+                     props.limits.framebufferDepthSampleCounts;
+  while (!aaModeSupported(aaMode)) {
+    aaMode--;
+  }
+  if (dynamicResolution && !swapchainTransferDst) {
+    printf("dynamic resolution needs a swapchain that can be blitted to\n");
+    exit(1);
+  }
+  if (viewCount > 1 && !swapchainTransferDst) {
+    printf("multiview needs a swapchain that can be blitted to\n");
+    exit(1);
+  }
+  if (viewCount > 1) {
+    printf("multiview: %u views, %s\n", viewCount,
+           viewPasses ? "one render pass each" : "one render pass");
+  }
+  dynResInit(&dynRes, frameBudgetMs);
+  renderExtent = swapchainExtent;
+  requestedAaMode = aaMode;
+  msaaSample = aaModes[aaMode].samples;
+}
+
+void reportAaMode() {
+  printf("anti-aliasing: %s, render targets %.2f MiB\n", aaModes[aaMode].name,
+         rgMemorySize(&frameGraph) / (1024.0 * 1024.0));
+}
+
+void createVariantRenderPasses() {
+  for (uint32_t i = 0; i < aaModeCount; i++) {
+    uint32_t index = sampleCountIndex(aaModes[i].samples);
+    if (aaModeSupported(i) && variantRenderPasses[index] == VK_NULL_HANDLE) {
+      variantRenderPasses[index] =
+          createMainRenderPass(false, aaModes[i].samples);
+    }
+  }
+}
+
+void requestSampleCountVariants(VkSampleCountFlagBits samples) {
+  uint32_t count = sizeof(sceneVariants) / sizeof(sceneVariants[0]);
+  for (uint32_t i = 0; i < count; i++) {
+    SceneVariant variant = sceneVariants[i];
+    if (variant.wireframe && !wireframeSupported) {
+      continue;
+    }
+    variant.samples = samples;
+    pipelineLibraryRequest(&pipelineLibrary, sceneVariantKey(variant));
+  }
+}
+
+// Nothing can stand in for the current sample count's plain shading
+// pipeline, so it is waited for.
+void bindSceneVariants() {
+  SceneVariant variant = {.samples = msaaSample, .kind = SCENE_SHADE};
+  shadeFuture =
+      pipelineLibraryFind(&pipelineLibrary, sceneVariantKey(variant));
+  pipelineLibraryWait(&pipelineLibrary, shadeFuture);
+}
+
+// Compiles every scene variant in the background, the current sample count
+// first, so switching modes later finds its pipelines ready.
+void createScenePipelines() {
+  createPipelineLayout();
+  if (!dynamicRendering) {
+    createVariantRenderPasses();
+  }
+  pipelineLibraryInit(&pipelineLibrary, buildScenePipeline, NULL);
+  requestSampleCountVariants(msaaSample);
+  for (uint32_t i = 0; i < aaModeCount; i++) {
+    if (aaModeSupported(i)) {
+      requestSampleCountVariants(aaModes[i].samples);
+    }
+  }
+  bindSceneVariants();
+}
+
+void destroyScenePipelines() {
+  pipelineLibraryDestroy(&pipelineLibrary, device);
+  vkDestroyPipelineLayout(device, pipelineLayout, NULL);
+  for (uint32_t i = 0; i < 4; i++) {
+    vkDestroyRenderPass(device, variantRenderPasses[i], NULL);
+  }
+}
+
+// Rebuilds everything that depends on the sample count or the render
+// targets, between frames.
+void applyAaMode() {
+  framePacerWaitIdle(&framePacer, device);
+  vkDeviceWaitIdle(device);
+  aaMode = requestedAaMode;
+  msaaSample = aaModes[aaMode].samples;
+  destroyFramebuffers();
+  free(framebuffers);
+  framebuffers = NULL;
+  rgDestroy(&frameGraph, device);
+  vkDestroyRenderPass(device, renderPass, NULL);
+  vkDestroyRenderPass(device, lateRenderPass, NULL);
+  renderPass = VK_NULL_HANDLE;
+  lateRenderPass = VK_NULL_HANDLE;
+  if (!dynamicRendering) {
+    createRenderPass();
+  }
+  bindSceneVariants();
+  createFrameGraph();
+  if (!dynamicRendering) {
+    createFramebuffers();
+  }
+  markAttachmentSetsStale();
+  gpuTimerSetLabel(&gpuTimer, aaModes[aaMode].name);
+  reportAaMode();
+}
+
+// Rebuilds everything sized to the swapchain. The old frame graph and depth
+// pyramid go to retired, so frames still in flight keep using them until the
+// old swapchain is destroyed.
+void resizeAttachments(RetiredSwapchain *retired) {
+  if (capturePath != NULL) {
+    // frames in flight may still copy into the ring buffers
+    framePacerWaitIdle(&framePacer, device);
+    vkDeviceWaitIdle(device);
+    printf("frame size changed, stopping capture\n");
+    readbackDestroy(&readback, device, framePacer.timeline);
+    capturePath = NULL;
+  }
+  retired->frameGraph = malloc(sizeof(RenderGraph));
+  if (retired->frameGraph == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  *retired->frameGraph = frameGraph;
+  retired->depthPyramid = depthPyramid;
+  retired->depthPyramidMemory = depthPyramidMemory;
+  retired->depthPyramidView = depthPyramidView;
+  memcpy(retired->depthPyramidMips, depthPyramidMips,
+         sizeof(depthPyramidMips));
+  retired->depthPyramidLevels = depthPyramidLevels;
+  createFrameGraph();
+  createDepthPyramid();
+  markAttachmentSetsStale();
+  renderExtent = swapchainExtent;
+}
+
+// Replaces the swapchain between frames, passing the old one as oldSwapchain.
+// Frames in flight keep the old views, framebuffers and present semaphores
+// until they retire. A new extent also replaces the frame graph targets and
+// the depth pyramid, which retire the same way, so neither a present mode
+// change nor a resize waits for the GPU. Only an active capture, or more
+// than MAX_RETIRED_SWAPCHAINS replacements in flight, still wait. Returns
+// false while the window is minimized.
+bool recreateSwapchain() {
+  VkSurfaceCapabilitiesKHR caps;
+  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &caps);
+  VkExtent2D extent = chooseSwapchainExtent(&caps);
+  if (extent.width == 0 || extent.height == 0) {
+    return false;
+  }
+  if (retiredSwapchainCount == MAX_RETIRED_SWAPCHAINS) {
+    framePacerWaitIdle(&framePacer, device);
+    collectRetiredSwapchains();
+  }
+  // the waiter must be done with the old swapchain before it is retired
+  presentLatencyReset(&presentLatency);
+  VkExtent2D oldExtent = swapchainExtent;
+  retiredSwapchains[retiredSwapchainCount++] = (RetiredSwapchain){
+      .swapchain = swapchain,
+      .images = swapchainImages,
+      .views = swapchainImageViews,
+      .framebuffers = framebuffers,
+      .renderFinished = renderFinishedSemaphores,
+      .imageCount = imageCount,
+      .value = framePacer.frameIndex,
+  };
+  framebuffers = NULL;
+  createSwapchain(swapchain);
+  createImageViews();
+  createPresentSemaphores();
+  if (swapchainExtent.width != oldExtent.width ||
+      swapchainExtent.height != oldExtent.height) {
+    resizeAttachments(&retiredSwapchains[retiredSwapchainCount - 1]);
+  }
+  if (!dynamicRendering) {
+    createFramebuffers();
+  }
+  swapchainDirty = false;
+  return true;
 }
 
 void initVulkan() {
-  initWindow();
-  createInstance(&vkInstance);
-  createSurface();
+  if (!headless) {
+    initWindow();
+  }
+  createInstance(&vkInstance, !headless);
+  if (!headless) {
+    createSurface();
+  }
   pickPhysicalDevice();
   createLogicalDevice();
+  pipelineCacheInit(&pipelineCache, device, physicalDevice,
+                    PIPELINE_CACHE_PATH);
   getDeviceQueues();
-  createSwapchain();
+  if (headless) {
+    createOffscreenTargets();
+  } else {
+    createSwapchain(VK_NULL_HANDLE);
+  }
   createImageViews();
-  createRenderPass();
+  initAaMode();
+  if (!dynamicRendering) {
+    createRenderPass();
+  }
   createDescriptorSetLayout();
-  createGraphicsPipeline();
+  bindlessInit(&bindless, device);
+  createCullDescriptorSetLayout();
+  createPostDescriptorSetLayout();
+  createScenePipelines();
+  if (hotReload) {
+    hotReload = shaderWatchInit(&shaderWatcher, "shaders", "shaders/comp");
+  }
+  createCullPipeline();
+  createLightBinPipeline();
+  createPostPipelines();
+  createQueryPools();
+  if (capturePath != NULL) {
+    readbackInit(&readback, device, physicalDevice, swapchainExtent,
+                 capturePath);
+  }
   createCommandPool();
-  createColorResources();
-  createDepthResources();
-  createFramebuffers();
-  createTextureImage();
-  createTextureImageView();
-  createTextureSampler();
+  createFrameGraph();
+  createDepthPyramid();
+  if (!dynamicRendering) {
+    createFramebuffers();
+  }
+  createTextures();
+  loadModel("assets/viking_room.obj", &modelVertices, &modelVerticesNum);
+  createModelBuffer();
+  createPositionBuffer();
+  createModelIndexBuffer();
+  createObjects();
+  createDrawBuffers();
+  createLightBuffers();
   createUniformBuffers();
   createDescriptorPool();
   createDescriptorSets();
+  createCullDescriptorSets();
+  createPostDescriptorSets();
+  createHizDescriptorSets();
+  markAttachmentSetsStale();
+  reportAaMode();
   createCommandBuffers();
+  createComputeObjects();
   createSyncObjects();
+  if (!headless) {
+    presentLatencyInit(&presentLatency, device, framePacer.timeline,
+                       presentWaitSupported);
+  }
   createVertexBuffer();
-  loadModel("assets/viking_room.obj", &modelVertices, &modelVerticesNum);
-  createModelBuffer();
   createIndexBuffer();
 }
 
+// Copies the last rendered frame to the host and writes it as a binary PPM.
+// The device must be idle and the image in TRANSFER_SRC_OPTIMAL.
+void writeFrameImage(const char *path) {
+  VkDeviceSize size =
+      (VkDeviceSize)swapchainExtent.width * swapchainExtent.height * 4;
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               &buffer, &memory);
+  VkCommandBuffer cmd = beginSingleTimeCommands();
+  VkBufferImageCopy region = {
+      .imageSubresource =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .layerCount = 1,
+          },
+      .imageExtent = {swapchainExtent.width, swapchainExtent.height, 1},
+  };
+  vkCmdCopyImageToBuffer(cmd, swapchainImages[currentImageIndex],
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1,
+                         &region);
+  endSingleTimeCommands(cmd);
+
+  uint8_t *pixels;
+  vkMapMemory(device, memory, 0, size, 0, (void **)&pixels);
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    printf("failed to open %s\n", path);
+    exit(1);
+  }
+  fprintf(file, "P6\n%u %u\n255\n", swapchainExtent.width,
+          swapchainExtent.height);
+  // BGRA to RGB
+  for (VkDeviceSize i = 0; i < size; i += 4) {
+    uint8_t rgb[3] = {pixels[i + 2], pixels[i + 1], pixels[i]};
+    fwrite(rgb, 1, 3, file);
+  }
+  fclose(file);
+  vkUnmapMemory(device, memory);
+  vkDestroyBuffer(device, buffer, NULL);
+  vkFreeMemory(device, memory, NULL);
+  printf("wrote frame %u to %s\n", headlessFrames, path);
+}
+
 void mainLoop() {
-  while (!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
+  frameClockInit(&frameClock);
+  frameStatsInit(&frameStats, statsCsvPath);
+  uint32_t frame = 0;
+  while (headless ? frame < headlessFrames : !glfwWindowShouldClose(window)) {
+    if (!headless) {
+      glfwPollEvents();
+    }
+    if (lightBench && frame % LIGHT_BENCH_FRAMES == 0) {
+      setLightCount(lightBenchCounts[frame / LIGHT_BENCH_FRAMES]);
+    }
+    frame++;
+    frameClockTick(&frameClock);
+    if (requestedAaMode != aaMode) {
+      applyAaMode();
+    }
+    if (swapchainDirty && !recreateSwapchain()) {
+      // minimized, nothing to draw into until the window comes back
+      glfwWaitEvents();
+      continue;
+    }
     drawFrame();
+    frameStatsRecord(&frameStats, &frameClock);
   }
+  framePacerWaitIdle(&framePacer, device);
   vkDeviceWaitIdle(device);
+  if (readbackPath != NULL) {
+    writeFrameImage(readbackPath);
+  }
 }
 
 void destroyImageViews() {
@@ -1520,7 +4537,10 @@ void destroyImageViews() {
 }
 
 void destroyFramebuffers() {
-  for (uint32_t i = 0; i < imageCount; i++) {
+  if (framebuffers == NULL) {
+    return;
+  }
+  for (uint32_t i = 0; i < imageCount * scenePassCount(); i++) {
     vkDestroyFramebuffer(device, framebuffers[i], NULL);
   }
 }
@@ -1528,12 +4548,13 @@ void destroyFramebuffers() {
 void destroySyncObjects() {
   for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
     vkDestroySemaphore(device, imageAvailableSemaphores[i], NULL);
+  }
+  for (uint32_t i = 0; i < imageCount; i++) {
     vkDestroySemaphore(device, renderFinishedSemaphores[i], NULL);
-    vkDestroyFence(device, inFlight[i], NULL);
   }
+  framePacerDestroy(&framePacer, device);
   free(imageAvailableSemaphores);
   free(renderFinishedSemaphores);
-  free(inFlight);
 }
 
 void destroyUniformBuffers() {
@@ -1544,17 +4565,89 @@ void destroyUniformBuffers() {
   }
 }
 
+void destroyDrawBuffers() {
+  for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vkDestroyBuffer(device, drawCommandBuffers[i], NULL);
+    vkFreeMemory(device, drawCommandMemoryList[i], NULL);
+    vkDestroyBuffer(device, drawCountBuffers[i], NULL);
+    vkFreeMemory(device, drawCountMemoryList[i], NULL);
+    vkDestroyBuffer(device, cullCandidateBuffers[i], NULL);
+    vkFreeMemory(device, cullCandidateMemoryList[i], NULL);
+    vkDestroyBuffer(device, cullUniformBuffers[i], NULL);
+    vkFreeMemory(device, cullUniformMemoryList[i], NULL);
+  }
+  instanceBufferDestroy(&instances, device);
+  vkDestroyBuffer(device, positionBuffer, NULL);
+  vkFreeMemory(device, positionBufferMemory, NULL);
+  vkDestroyBuffer(device, modelIndiciesBuffer, NULL);
+  vkFreeMemory(device, modelIndicesBufferMemory, NULL);
+  free(modelIndices);
+  free(drawCommandBuffers);
+  free(drawCommandMemoryList);
+  free(drawCountBuffers);
+  free(drawCountMemoryList);
+  free(drawCountMapped);
+  free(cullCandidateBuffers);
+  free(cullCandidateMemoryList);
+  free(cullUniformBuffers);
+  free(cullUniformMemoryList);
+  free(cullUniformsMapped);
+  free(sceneHandles);
+  bvhDestroy(&sceneBvh);
+  free(sceneBoxes);
+}
+
 void cleanUp() {
-  glfwDestroyWindow(window);
-  glfwTerminate();
-  vkDestroySwapchainKHR(device, swapchain, NULL);
-  vkDestroySurfaceKHR(vkInstance, surface, NULL);
+  if (!headless) {
+    presentLatencyReport(&presentLatency);
+    presentLatencyDestroy(&presentLatency);
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    collectRetiredSwapchains();
+    vkDestroySwapchainKHR(device, swapchain, NULL);
+    vkDestroySurfaceKHR(vkInstance, surface, NULL);
+  }
   destroyImageViews();
   destroyFramebuffers();
-  vkDestroyPipelineLayout(device, pipelineLayout, NULL);
-  vkDestroyPipeline(device, pipeline, NULL);
+  if (headless) {
+    destroyOffscreenTargets();
+  }
+  rgDestroy(&frameGraph, device);
+  if (hotReload) {
+    shaderWatchDestroy(&shaderWatcher);
+  }
+  destroyScenePipelines();
+  pipelineStatsDestroy(&pipelineStats, device);
+  if (capturePath != NULL) {
+    readbackDestroy(&readback, device, framePacer.timeline);
+  }
+  gpuTimerDestroy(&gpuTimer, device);
+  gpuTimerDestroy(&lightBinTimer, device);
+  vkDestroyPipelineLayout(device, postPipelineLayout, NULL);
+  vkDestroyPipeline(device, fxaaPipeline, NULL);
+  vkDestroyPipeline(device, upscalePipeline, NULL);
+  vkDestroyPipeline(device, hizReducePipeline, NULL);
+  vkDestroyPipeline(device, hizResolvePipeline, NULL);
+  vkDestroyDescriptorSetLayout(device, postDescriptorLayout, NULL);
+  destroyDepthPyramid();
+  vkDestroySampler(device, postSampler, NULL);
+  vkDestroyPipelineLayout(device, cullPipelineLayout, NULL);
+  pipelineCacheReport(&pipelineCache);
+  pipelineCacheSave(&pipelineCache, device);
+  pipelineCacheDestroy(&pipelineCache, device);
+  vkDestroyPipeline(device, cullPipeline, NULL);
+  vkDestroyDescriptorSetLayout(device, cullDescriptorLayout, NULL);
+  vkDestroyPipeline(device, lightBinPipeline, NULL);
+  vkDestroyPipelineLayout(device, lightBinPipelineLayout, NULL);
+  destroyDrawBuffers();
+  destroyLightBuffers();
   vkDestroyRenderPass(device, renderPass, NULL);
+  vkDestroyRenderPass(device, lateRenderPass, NULL);
+  uploaderDestroy(&uploader, device);
+  barrierBatchDestroy(&frameBarriers);
+  destroyTextures();
   vkDestroyCommandPool(device, commandPool, NULL);
+  destroyComputeObjects();
   vkDestroyBuffer(device, vertexBuffer, NULL);
   destroyUniformBuffers();
   vkFreeMemory(device, vertexBufferMemory, NULL);
@@ -1567,9 +4660,126 @@ void cleanUp() {
   free(framebuffers);
 }
 
-int main() {
+void parseArgs(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+      framesInFlight = (uint32_t)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--objects") == 0 && i + 1 < argc) {
+      objectCount = (uint32_t)atoi(argv[++i]);
+      if (objectCount == 0) {
+        objectCount = 1;
+      }
+    } else if (strcmp(argv[i], "--stress") == 0) {
+      objectCount = 100000;
+      stressScene = true;
+    } else if (strcmp(argv[i], "--aa") == 0 && i + 1 < argc) {
+      i++;
+      uint32_t mode = 0;
+      while (mode < aaModeCount && strcmp(argv[i], aaModes[mode].name) != 0) {
+        mode++;
+      }
+      if (mode == aaModeCount) {
+        printf("unknown anti-aliasing mode: %s\n", argv[i]);
+        exit(1);
+      }
+      aaMode = mode;
+    } else if (strcmp(argv[i], "--dynamic-resolution") == 0 && i + 1 < argc) {
+      dynamicResolution = true;
+      frameBudgetMs = (float)atof(argv[++i]);
+      // also rejects text, which atof reads as 0, and nan
+      if (!(frameBudgetMs > 0.0f) || isinf(frameBudgetMs)) {
+        printf("--dynamic-resolution takes a frame budget in ms above 0\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--upscale") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "sharpen") == 0) {
+        upscaleSharpness = 0.5f;
+      } else if (strcmp(argv[i], "bilinear") == 0) {
+        upscaleSharpness = 0.0f;
+      } else {
+        printf("unknown upscale filter: %s\n", argv[i]);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--dynamic-rendering") == 0) {
+      dynamicRendering = true;
+    } else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+      headless = true;
+      headlessFrames = (uint32_t)atoi(argv[++i]);
+      if (headlessFrames == 0) {
+        headlessFrames = 1;
+      }
+    } else if (strcmp(argv[i], "--readback") == 0 && i + 1 < argc) {
+      readbackPath = argv[++i];
+    } else if (strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc) {
+      i++;
+      uint32_t mode = 0;
+      while (mode < PRESENT_LATENCY_MODES &&
+             strcmp(argv[i], presentModeName(mode)) != 0) {
+        mode++;
+      }
+      if (mode == PRESENT_LATENCY_MODES) {
+        printf("unknown present mode: %s\n", argv[i]);
+        exit(1);
+      }
+      requestedPresentMode = (VkPresentModeKHR)mode;
+    } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+      capturePath = argv[++i];
+    } else if (strcmp(argv[i], "--views") == 0 && i + 1 < argc) {
+      viewCount = (uint32_t)atoi(argv[++i]);
+      if (viewCount == 0 || viewCount > MULTIVIEW_MAX_VIEWS) {
+        printf("--views takes 1 to %d views\n", MULTIVIEW_MAX_VIEWS);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--view-passes") == 0) {
+      viewPasses = true;
+    } else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+      lightCount = (uint32_t)atoi(argv[++i]);
+      if (lightCount > LIGHT_MAX) {
+        printf("--lights takes at most %d lights\n", LIGHT_MAX);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--light-bench") == 0) {
+      lightBench = true;
+      headless = true;
+      headlessFrames = LIGHT_BENCH_FRAMES * (sizeof(lightBenchCounts) /
+                                             sizeof(lightBenchCounts[0]));
+    } else if (strcmp(argv[i], "--hot-reload") == 0) {
+      hotReload = true;
+    } else if (strcmp(argv[i], "--bvh-bench") == 0) {
+      bvhBenchPrims = 1000000;
+    } else if (strcmp(argv[i], "--cull-bench") == 0) {
+      cullBenchBoxes = 1000000;
+    } else if (strcmp(argv[i], "--stats-csv") == 0 && i + 1 < argc) {
+      statsCsvPath = argv[++i];
+    } else {
+      printf("unknown argument: %s\n", argv[i]);
+      exit(1);
+    }
+  }
+  if (readbackPath != NULL && !headless) {
+    printf("--readback needs --headless\n");
+    exit(1);
+  }
+  if (viewCount > 1 && dynamicResolution) {
+    printf("--views cannot be combined with --dynamic-resolution\n");
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  parseArgs(argc, argv);
+  if (cullBenchBoxes > 0) {
+    cullBenchmark(cullBenchBoxes);
+    return 0;
+  }
+  if (bvhBenchPrims > 0) {
+    bvhBenchmark(bvhBenchPrims);
+    return 0;
+  }
   initVulkan();
   mainLoop();
   cleanUp();
+  frameStatsDestroy(&frameStats);
   return 0;
 }
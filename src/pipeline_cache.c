@@ -0,0 +1,195 @@
+#include "pipeline_cache.h"
+#include "timer.h"
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// Returns the file's contents if its header was written by this device and
+// driver, NULL otherwise.
+static void *loadCacheData(const char *path, VkPhysicalDevice physicalDevice,
+                           size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  rewind(file);
+  VkPipelineCacheHeaderVersionOne header;
+  if (length < (long)sizeof(header)) {
+    fclose(file);
+    printf("pipeline cache: %s is truncated, ignoring it\n", path);
+    return NULL;
+  }
+  void *data = malloc(length);
+  if (data == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  size_t read = fread(data, 1, length, file);
+  fclose(file);
+  memcpy(&header, data, sizeof(header));
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physicalDevice, &props);
+  if (read != (size_t)length || header.headerSize < sizeof(header) ||
+      header.headerSize > (uint32_t)length ||
+      header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+      header.vendorID != props.vendorID ||
+      header.deviceID != props.deviceID ||
+      memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID,
+             VK_UUID_SIZE) != 0) {
+    free(data);
+    printf("pipeline cache: %s is from another device or driver, "
+           "ignoring it\n",
+           path);
+    return NULL;
+  }
+  *size = (size_t)length;
+  return data;
+}
+
+void pipelineCacheInit(PipelineCache *cache, VkDevice device,
+                       VkPhysicalDevice physicalDevice, const char *path) {
+  *cache = (PipelineCache){
+      .path = path,
+  };
+  if (mtx_init(&cache->lock, mtx_plain) != thrd_success) {
+    printf("failed to create pipeline cache lock\n");
+    exit(1);
+  }
+  size_t size = 0;
+  void *data = loadCacheData(path, physicalDevice, &size);
+  VkPipelineCacheCreateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+      .initialDataSize = size,
+      .pInitialData = data,
+  };
+  if (vkCreatePipelineCache(device, &info, NULL, &cache->cache) !=
+      VK_SUCCESS) {
+    printf("failed to create pipeline cache\n");
+    exit(1);
+  }
+  cache->warm = data != NULL;
+  if (cache->warm) {
+    printf("pipeline cache: loaded %zu bytes from %s\n", size, path);
+  }
+  free(data);
+}
+
+static void record(PipelineCache *cache, uint64_t start,
+                   const VkPipelineCreationFeedback *feedback) {
+  uint64_t ns = timerNowNs() - start;
+  mtx_lock(&cache->lock);
+  cache->createNs += ns;
+  if (feedback->flags &
+      VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT) {
+    cache->hits++;
+  } else {
+    cache->misses++;
+  }
+  mtx_unlock(&cache->lock);
+}
+
+VkResult pipelineCacheCreateGraphics(PipelineCache *cache, VkDevice device,
+                                     const VkGraphicsPipelineCreateInfo *info,
+                                     VkPipeline *pipeline) {
+  VkPipelineCreationFeedback feedback = {0};
+  VkPipelineCreationFeedbackCreateInfo feedbackInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+      .pNext = info->pNext,
+      .pPipelineCreationFeedback = &feedback,
+  };
+  VkGraphicsPipelineCreateInfo chained = *info;
+  chained.pNext = &feedbackInfo;
+  uint64_t start = timerNowNs();
+  VkResult result = vkCreateGraphicsPipelines(device, cache->cache, 1,
+                                              &chained, NULL, pipeline);
+  record(cache, start, &feedback);
+  return result;
+}
+
+VkResult pipelineCacheCreateCompute(PipelineCache *cache, VkDevice device,
+                                    const VkComputePipelineCreateInfo *info,
+                                    VkPipeline *pipeline) {
+  VkPipelineCreationFeedback feedback = {0};
+  VkPipelineCreationFeedbackCreateInfo feedbackInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+      .pNext = info->pNext,
+      .pPipelineCreationFeedback = &feedback,
+  };
+  VkComputePipelineCreateInfo chained = *info;
+  chained.pNext = &feedbackInfo;
+  uint64_t start = timerNowNs();
+  VkResult result = vkCreateComputePipelines(device, cache->cache, 1, &chained,
+                                             NULL, pipeline);
+  record(cache, start, &feedback);
+  return result;
+}
+
+void pipelineCacheReport(PipelineCache *cache) {
+  // drivers without creation feedback report every pipeline as a miss
+  mtx_lock(&cache->lock);
+  printf("pipeline cache (%s): %u hits, %u misses, %.2f ms creating "
+         "pipelines\n",
+         cache->warm ? "warm" : "cold", cache->hits, cache->misses,
+         cache->createNs / 1e6);
+  mtx_unlock(&cache->lock);
+}
+
+void pipelineCacheSave(PipelineCache *cache, VkDevice device) {
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device, cache->cache, &size, NULL) !=
+          VK_SUCCESS ||
+      size == 0) {
+    return;
+  }
+  void *data = malloc(size);
+  if (data == NULL) {
+    printf("malloc failed\n");
+    exit(1);
+  }
+  if (vkGetPipelineCacheData(device, cache->cache, &size, data) !=
+      VK_SUCCESS) {
+    free(data);
+    return;
+  }
+  char tmpPath[1024];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", cache->path);
+  FILE *file = fopen(tmpPath, "wb");
+  if (file == NULL) {
+    printf("pipeline cache: unable to write %s\n", tmpPath);
+    free(data);
+    return;
+  }
+  bool written = fwrite(data, 1, size, file) == size;
+  written = fclose(file) == 0 && written;
+  free(data);
+  if (!written) {
+    printf("pipeline cache: failed writing %s\n", tmpPath);
+    remove(tmpPath);
+    return;
+  }
+#ifdef _WIN32
+  bool renamed =
+      MoveFileExA(tmpPath, cache->path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  bool renamed = rename(tmpPath, cache->path) == 0;
+#endif
+  if (!renamed) {
+    printf("pipeline cache: unable to replace %s\n", cache->path);
+    remove(tmpPath);
+  }
+}
+
+void pipelineCacheDestroy(PipelineCache *cache, VkDevice device) {
+  vkDestroyPipelineCache(device, cache->cache, NULL);
+  mtx_destroy(&cache->lock);
+}
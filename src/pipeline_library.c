@@ -0,0 +1,214 @@
+#include "pipeline_library.h"
+#include "frame_pacer.h"
+#include "timer.h"
+#include "vulkan/vulkan.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+// Expects the lock to be held.
+static void enqueue(PipelineLibrary *library, uint32_t index) {
+  uint32_t tail = library->queueHead + library->queueCount;
+  library->queue[tail % PIPELINE_LIBRARY_MAX_VARIANTS] = index;
+  library->queueCount++;
+  cnd_signal(&library->queued);
+}
+
+static int compileWorker(void *arg) {
+  PipelineLibrary *library = arg;
+  mtx_lock(&library->lock);
+  for (;;) {
+    while (library->queueCount == 0 && !library->stopping) {
+      cnd_wait(&library->queued, &library->lock);
+    }
+    if (library->queueCount == 0) {
+      mtx_unlock(&library->lock);
+      return 0;
+    }
+    uint32_t index = library->queue[library->queueHead];
+    library->queueHead =
+        (library->queueHead + 1) % PIPELINE_LIBRARY_MAX_VARIANTS;
+    library->queueCount--;
+    PipelineFuture *future = &library->futures[index];
+    bool rebuild = future->rebuilding;
+    mtx_unlock(&library->lock);
+    VkPipeline pipeline = library->build(future->key, library->userData);
+    if (rebuild) {
+      if (pipeline == VK_NULL_HANDLE) {
+        printf("pipeline library: rebuilding variant %#x failed, keeping the "
+               "previous pipeline\n",
+               future->key);
+      }
+      future->replacement = pipeline;
+      atomic_store_explicit(&future->replaced, true, memory_order_release);
+      mtx_lock(&library->lock);
+      continue;
+    }
+    if (pipeline == VK_NULL_HANDLE) {
+      printf("pipeline library: variant %#x failed to compile\n", future->key);
+      exit(1);
+    }
+    future->pipeline = pipeline;
+    atomic_store_explicit(&future->ready, true, memory_order_release);
+    mtx_lock(&library->lock);
+    if (++library->doneCount == library->futureCount) {
+      printf("pipeline library: %u variants compiled in %.2f ms on %d "
+             "threads\n",
+             library->doneCount, (timerNowNs() - library->startNs) / 1e6,
+             PIPELINE_LIBRARY_THREADS);
+    }
+    cnd_broadcast(&library->done);
+  }
+}
+
+void pipelineLibraryInit(PipelineLibrary *library, PipelineBuildFn build,
+                         void *userData) {
+  *library = (PipelineLibrary){
+      .build = build,
+      .userData = userData,
+  };
+  if (mtx_init(&library->lock, mtx_plain) != thrd_success ||
+      cnd_init(&library->queued) != thrd_success ||
+      cnd_init(&library->done) != thrd_success) {
+    printf("failed to create pipeline library locks\n");
+    exit(1);
+  }
+  for (int i = 0; i < PIPELINE_LIBRARY_THREADS; i++) {
+    if (thrd_create(&library->threads[i], compileWorker, library) !=
+        thrd_success) {
+      printf("failed to create pipeline compile thread\n");
+      exit(1);
+    }
+  }
+}
+
+PipelineFuture *pipelineLibraryFind(PipelineLibrary *library, uint32_t key) {
+  mtx_lock(&library->lock);
+  PipelineFuture *found = NULL;
+  for (uint32_t i = 0; i < library->futureCount; i++) {
+    if (library->futures[i].key == key) {
+      found = &library->futures[i];
+      break;
+    }
+  }
+  mtx_unlock(&library->lock);
+  return found;
+}
+
+PipelineFuture *pipelineLibraryRequest(PipelineLibrary *library,
+                                       uint32_t key) {
+  PipelineFuture *future = pipelineLibraryFind(library, key);
+  if (future != NULL) {
+    return future;
+  }
+  mtx_lock(&library->lock);
+  if (library->futureCount == PIPELINE_LIBRARY_MAX_VARIANTS) {
+    printf("pipeline library: too many variants\n");
+    exit(1);
+  }
+  if (library->doneCount == library->futureCount) {
+    library->startNs = timerNowNs();
+  }
+  uint32_t index = library->futureCount++;
+  future = &library->futures[index];
+  future->key = key;
+  future->pipeline = VK_NULL_HANDLE;
+  future->replacement = VK_NULL_HANDLE;
+  future->rebuilding = false;
+  future->stale = false;
+  atomic_init(&future->ready, false);
+  atomic_init(&future->replaced, false);
+  enqueue(library, index);
+  mtx_unlock(&library->lock);
+  return future;
+}
+
+VkPipeline pipelineLibraryGet(const PipelineFuture *future,
+                              VkPipeline fallback) {
+  if (future == NULL ||
+      !atomic_load_explicit(&future->ready, memory_order_acquire)) {
+    return fallback;
+  }
+  return future->pipeline;
+}
+
+VkPipeline pipelineLibraryWait(PipelineLibrary *library,
+                               PipelineFuture *future) {
+  if (!atomic_load_explicit(&future->ready, memory_order_acquire)) {
+    mtx_lock(&library->lock);
+    while (!atomic_load_explicit(&future->ready, memory_order_acquire)) {
+      cnd_wait(&library->done, &library->lock);
+    }
+    mtx_unlock(&library->lock);
+  }
+  return future->pipeline;
+}
+
+uint32_t pipelineLibraryRebuild(PipelineLibrary *library,
+                                PipelineKeyFilterFn filter, void *userData) {
+  uint32_t matched = 0;
+  for (uint32_t i = 0; i < library->futureCount; i++) {
+    if (filter(library->futures[i].key, userData)) {
+      library->futures[i].stale = true;
+      matched++;
+    }
+  }
+  return matched;
+}
+
+void pipelineLibrarySwap(PipelineLibrary *library, uint32_t slot) {
+  for (uint32_t i = 0; i < library->futureCount; i++) {
+    PipelineFuture *future = &library->futures[i];
+    if (future->rebuilding &&
+        atomic_load_explicit(&future->replaced, memory_order_acquire)) {
+      if (future->replacement != VK_NULL_HANDLE) {
+        library->retired[slot][library->retiredCount[slot]++] =
+            future->pipeline;
+        future->pipeline = future->replacement;
+      }
+      future->replacement = VK_NULL_HANDLE;
+      atomic_store_explicit(&future->replaced, false, memory_order_relaxed);
+      future->rebuilding = false;
+    }
+    // a build already running may have read the old source
+    if (future->stale && !future->rebuilding &&
+        atomic_load_explicit(&future->ready, memory_order_acquire)) {
+      future->stale = false;
+      future->rebuilding = true;
+      mtx_lock(&library->lock);
+      enqueue(library, i);
+      mtx_unlock(&library->lock);
+    }
+  }
+}
+
+void pipelineLibraryCollect(PipelineLibrary *library, VkDevice device,
+                            uint32_t slot) {
+  for (uint32_t i = 0; i < library->retiredCount[slot]; i++) {
+    vkDestroyPipeline(device, library->retired[slot][i], NULL);
+  }
+  library->retiredCount[slot] = 0;
+}
+
+void pipelineLibraryDestroy(PipelineLibrary *library, VkDevice device) {
+  mtx_lock(&library->lock);
+  library->stopping = true;
+  cnd_broadcast(&library->queued);
+  mtx_unlock(&library->lock);
+  for (int i = 0; i < PIPELINE_LIBRARY_THREADS; i++) {
+    thrd_join(library->threads[i], NULL);
+  }
+  for (uint32_t i = 0; i < library->futureCount; i++) {
+    vkDestroyPipeline(device, library->futures[i].pipeline, NULL);
+    vkDestroyPipeline(device, library->futures[i].replacement, NULL);
+  }
+  for (uint32_t i = 0; i < FRAME_PACER_MAX_DEPTH; i++) {
+    pipelineLibraryCollect(library, device, i);
+  }
+  cnd_destroy(&library->done);
+  cnd_destroy(&library->queued);
+  mtx_destroy(&library->lock);
+}
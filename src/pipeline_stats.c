@@ -0,0 +1,85 @@
+#include "pipeline_stats.h"
+#include "frame_pacer.h"
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// results come back in bit order: vertex invocations, then fragment
+#define PIPELINE_STATS_FLAGS                                                   \
+  (VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |                 \
+   VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT)
+
+void pipelineStatsInit(PipelineStats *stats, VkDevice device,
+                       const char *names[PIPELINE_STATS_VARIANTS]) {
+  *stats = (PipelineStats){0};
+  for (uint32_t i = 0; i < PIPELINE_STATS_VARIANTS; i++) {
+    stats->names[i] = names[i];
+  }
+  VkQueryPoolCreateInfo info = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+      .queryCount = FRAME_PACER_MAX_DEPTH,
+      .pipelineStatistics = PIPELINE_STATS_FLAGS,
+  };
+  if (vkCreateQueryPool(device, &info, NULL, &stats->pool) != VK_SUCCESS) {
+    printf("failed to create pipeline statistics query pool\n");
+    exit(1);
+  }
+}
+
+static void report(PipelineStats *stats) {
+  printf("pipeline stats per frame:");
+  for (uint32_t i = 0; i < PIPELINE_STATS_VARIANTS; i++) {
+    if (stats->samples[i] == 0) {
+      printf(" %s: n/a", stats->names[i]);
+      continue;
+    }
+    printf(" %s: %.0f vs / %.0f fs", stats->names[i],
+           (double)stats->vertexSum[i] / stats->samples[i],
+           (double)stats->fragmentSum[i] / stats->samples[i]);
+  }
+  printf("\n");
+}
+
+void pipelineStatsCollect(PipelineStats *stats, VkDevice device,
+                          uint32_t slot) {
+  if (!stats->issued[slot]) {
+    return;
+  }
+  stats->issued[slot] = false;
+  uint64_t results[2];
+  if (vkGetQueryPoolResults(device, stats->pool, slot, 1, sizeof(results),
+                            results, sizeof(results),
+                            VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+    return;
+  }
+  uint32_t variant = stats->slotVariant[slot];
+  stats->vertexSum[variant] += results[0];
+  stats->fragmentSum[variant] += results[1];
+  stats->samples[variant]++;
+  if (++stats->frames % PIPELINE_STATS_REPORT_INTERVAL == 0) {
+    report(stats);
+  }
+}
+
+void pipelineStatsReset(PipelineStats *stats, VkCommandBuffer cmd,
+                        uint32_t slot) {
+  vkCmdResetQueryPool(cmd, stats->pool, slot, 1);
+}
+
+void pipelineStatsBegin(PipelineStats *stats, VkCommandBuffer cmd,
+                        uint32_t slot, uint32_t variant) {
+  vkCmdBeginQuery(cmd, stats->pool, slot, 0);
+  stats->slotVariant[slot] = variant;
+}
+
+void pipelineStatsEnd(PipelineStats *stats, VkCommandBuffer cmd,
+                      uint32_t slot) {
+  vkCmdEndQuery(cmd, stats->pool, slot);
+  stats->issued[slot] = true;
+}
+
+void pipelineStatsDestroy(PipelineStats *stats, VkDevice device) {
+  vkDestroyQueryPool(device, stats->pool, NULL);
+}
@@ -0,0 +1,192 @@
+#include "present_latency.h"
+#include "timer.h"
+#include "vulkan/vulkan.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+static const char *modeNames[PRESENT_LATENCY_MODES] = {
+    "immediate",
+    "mailbox",
+    "fifo",
+    "fifo-relaxed",
+};
+
+const char *presentModeName(VkPresentModeKHR mode) {
+  return (uint32_t)mode < PRESENT_LATENCY_MODES ? modeNames[mode] : "other";
+}
+
+static void reportLocked(const PresentLatency *latency) {
+  printf("present latency:");
+  for (uint32_t i = 0; i < PRESENT_LATENCY_MODES; i++) {
+    if (latency->samples[i] == 0) {
+      continue;
+    }
+    printf(" %s %.3f ms avg / %.3f ms max", modeNames[i],
+           latency->sumNs[i] / 1e6 / latency->samples[i],
+           latency->maxNs[i] / 1e6);
+  }
+  printf("\n");
+}
+
+// Waits for the frame at the head of the queue to reach the display. Returns
+// VK_SUCCESS once it has, VK_TIMEOUT to try again, anything else when the
+// frame will never be presented.
+static VkResult waitForFrame(PresentLatency *latency, VkSwapchainKHR swapchain,
+                             uint64_t id, uint32_t generation) {
+  // the GPU finishes the frame before it can be presented, and waiting on the
+  // timeline does not touch the swapchain
+  VkSemaphoreWaitInfo waitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .semaphoreCount = 1,
+      .pSemaphores = &latency->timeline,
+      .pValues = &id,
+  };
+  VkResult result = vkWaitSemaphores(latency->device, &waitInfo,
+                                     PRESENT_LATENCY_WAIT_TIMEOUT_NS);
+  if (result != VK_SUCCESS || latency->waitForPresent == NULL) {
+    return result;
+  }
+  // let a pending present have the swapchain first
+  while (atomic_load(&latency->presenting)) {
+    thrd_yield();
+  }
+  mtx_lock(&latency->swapchainLock);
+  // a reset means the swapchain may already be retired
+  result = VK_ERROR_OUT_OF_DATE_KHR;
+  if (latency->generation == generation) {
+    result = latency->waitForPresent(latency->device, swapchain, id,
+                                     PRESENT_LATENCY_PRESENT_SLICE_NS);
+  }
+  mtx_unlock(&latency->swapchainLock);
+  return result;
+}
+
+static int waitWorker(void *arg) {
+  PresentLatency *latency = arg;
+  mtx_lock(&latency->lock);
+  for (;;) {
+    while (latency->count == 0 && !latency->stopping) {
+      cnd_wait(&latency->work, &latency->lock);
+    }
+    if (latency->stopping) {
+      break;
+    }
+    uint32_t i = latency->head;
+    VkSwapchainKHR swapchain = latency->swapchains[i];
+    uint64_t id = latency->ids[i];
+    uint32_t generation = latency->generation;
+    mtx_unlock(&latency->lock);
+
+    VkResult result = waitForFrame(latency, swapchain, id, generation);
+    uint64_t now = timerNowNs();
+
+    mtx_lock(&latency->lock);
+    if (result == VK_TIMEOUT || latency->generation != generation) {
+      continue;
+    }
+    if (result == VK_SUCCESS) {
+      uint32_t mode = latency->modes[i];
+      uint64_t ns = now - latency->startNs[i];
+      latency->sumNs[mode] += ns;
+      if (ns > latency->maxNs[mode]) {
+        latency->maxNs[mode] = ns;
+      }
+      latency->samples[mode]++;
+      if (++latency->reportSamples % PRESENT_LATENCY_REPORT_INTERVAL == 0) {
+        reportLocked(latency);
+      }
+    }
+    latency->head = (latency->head + 1) % PRESENT_LATENCY_MAX_PENDING;
+    latency->count--;
+  }
+  mtx_unlock(&latency->lock);
+  return 0;
+}
+
+void presentLatencyInit(PresentLatency *latency, VkDevice device,
+                        VkSemaphore timeline, bool presentWait) {
+  *latency = (PresentLatency){0};
+  latency->device = device;
+  latency->timeline = timeline;
+  if (presentWait) {
+    latency->waitForPresent = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(
+        device, "vkWaitForPresentKHR");
+  }
+  atomic_init(&latency->presenting, false);
+  if (mtx_init(&latency->lock, mtx_plain) != thrd_success ||
+      mtx_init(&latency->swapchainLock, mtx_plain) != thrd_success ||
+      cnd_init(&latency->work) != thrd_success) {
+    printf("failed to create present latency locks\n");
+    exit(1);
+  }
+  if (thrd_create(&latency->thread, waitWorker, latency) != thrd_success) {
+    printf("failed to create present latency thread\n");
+    exit(1);
+  }
+  printf("present latency measured to %s\n",
+         latency->waitForPresent != NULL ? "present" : "gpu completion");
+}
+
+VkResult presentLatencyPresent(PresentLatency *latency, VkQueue queue,
+                               const VkPresentInfoKHR *presentInfo) {
+  atomic_store(&latency->presenting, true);
+  mtx_lock(&latency->swapchainLock);
+  VkResult result = vkQueuePresentKHR(queue, presentInfo);
+  mtx_unlock(&latency->swapchainLock);
+  atomic_store(&latency->presenting, false);
+  return result;
+}
+
+void presentLatencyTrack(PresentLatency *latency, VkSwapchainKHR swapchain,
+                         uint64_t id, uint64_t startNs, VkPresentModeKHR mode) {
+  if ((uint32_t)mode >= PRESENT_LATENCY_MODES) {
+    return;
+  }
+  mtx_lock(&latency->lock);
+  if (latency->count == PRESENT_LATENCY_MAX_PENDING) {
+    // drop the newest frame rather than the one being waited for
+    mtx_unlock(&latency->lock);
+    return;
+  }
+  uint32_t tail =
+      (latency->head + latency->count) % PRESENT_LATENCY_MAX_PENDING;
+  latency->swapchains[tail] = swapchain;
+  latency->ids[tail] = id;
+  latency->startNs[tail] = startNs;
+  latency->modes[tail] = mode;
+  latency->count++;
+  cnd_signal(&latency->work);
+  mtx_unlock(&latency->lock);
+}
+
+void presentLatencyReset(PresentLatency *latency) {
+  // waits out a present wait in progress on the old swapchain
+  mtx_lock(&latency->swapchainLock);
+  mtx_lock(&latency->lock);
+  latency->head = 0;
+  latency->count = 0;
+  latency->generation++;
+  mtx_unlock(&latency->lock);
+  mtx_unlock(&latency->swapchainLock);
+}
+
+void presentLatencyDestroy(PresentLatency *latency) {
+  mtx_lock(&latency->lock);
+  latency->stopping = true;
+  cnd_signal(&latency->work);
+  mtx_unlock(&latency->lock);
+  thrd_join(latency->thread, NULL);
+  cnd_destroy(&latency->work);
+  mtx_destroy(&latency->swapchainLock);
+  mtx_destroy(&latency->lock);
+}
+
+void presentLatencyReport(PresentLatency *latency) {
+  mtx_lock(&latency->lock);
+  reportLocked(latency);
+  mtx_unlock(&latency->lock);
+}
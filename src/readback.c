@@ -0,0 +1,465 @@
+#include "readback.h"
+#include "timer.h"
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// Largest stored deflate block.
+#define DEFLATE_BLOCK 65535
+
+static uint32_t crcTable[256];
+
+static void initCrcTable() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    }
+    crcTable[i] = c;
+  }
+}
+
+static uint32_t crc32(const uint8_t *data, size_t size) {
+  uint32_t crc = 0xffffffffu;
+  for (size_t i = 0; i < size; i++) {
+    crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc ^ 0xffffffffu;
+}
+
+static uint32_t adler32(const uint8_t *data, size_t size) {
+  uint32_t a = 1;
+  uint32_t b = 0;
+  while (size > 0) {
+    // the largest run before b can overflow 32 bits
+    size_t run = size < 5552 ? size : 5552;
+    size -= run;
+    for (size_t i = 0; i < run; i++) {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+static void putBe32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+// Writes the chunk's length and type before data, which is already in place
+// at p + 8, and its CRC after. Returns the end of the chunk.
+static uint8_t *closeChunk(uint8_t *p, const char *type, uint32_t size) {
+  putBe32(p, size);
+  memcpy(p + 4, type, 4);
+  putBe32(p + 8 + size, crc32(p + 4, size + 4));
+  return p + 12 + size;
+}
+
+static size_t pngRowsSize(const Readback *rb) {
+  return (size_t)rb->height * (1 + 3 * (size_t)rb->width);
+}
+
+static size_t encodedCapacity(const Readback *rb) {
+  size_t pixels = (size_t)rb->width * rb->height;
+  size_t chroma = (size_t)((rb->width + 1) / 2) * ((rb->height + 1) / 2);
+  size_t rows = pngRowsSize(rb);
+  size_t blocks = (rows + DEFLATE_BLOCK - 1) / DEFLATE_BLOCK;
+  switch (rb->format) {
+  case READBACK_Y4M:
+    return 6 + pixels + 2 * chroma;
+  case READBACK_PNG:
+    // signature, IHDR, a zlib stream of stored blocks in IDAT, IEND
+    return 8 + 25 + 12 + 2 + rows + 5 * blocks + 4 + 12;
+  default:
+    return 3 * pixels;
+  }
+}
+
+// BGRA to RGB, the channel order every output format wants.
+static void toRgb(uint8_t *dst, const uint8_t *src, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+    dst += 3;
+    src += 4;
+  }
+}
+
+// One FRAME of 8-bit BT.601 limited range 4:2:0.
+static size_t encodeY4m(const Readback *rb, const uint8_t *src,
+                        uint8_t *dst) {
+  uint32_t w = rb->width;
+  uint32_t h = rb->height;
+  uint32_t cw = (w + 1) / 2;
+  uint32_t ch = (h + 1) / 2;
+  memcpy(dst, "FRAME\n", 6);
+  uint8_t *y = dst + 6;
+  uint8_t *u = y + (size_t)w * h;
+  uint8_t *v = u + (size_t)cw * ch;
+  const uint8_t *p = src;
+  for (size_t i = 0; i < (size_t)w * h; i++, p += 4) {
+    *y++ = (uint8_t)(16 + ((66 * p[2] + 129 * p[1] + 25 * p[0] + 128) >> 8));
+  }
+  // chroma from the mean of each 2x2 block; the bias keeps the sums
+  // positive so the shift rounds the same way everywhere
+  for (uint32_t cy = 0; cy < ch; cy++) {
+    for (uint32_t cx = 0; cx < cw; cx++) {
+      int r = 0;
+      int g = 0;
+      int b = 0;
+      for (uint32_t i = 0; i < 4; i++) {
+        uint32_t sx = cx * 2 + (i & 1);
+        uint32_t sy = cy * 2 + (i >> 1);
+        sx = sx < w ? sx : w - 1;
+        sy = sy < h ? sy : h - 1;
+        const uint8_t *q = src + ((size_t)sy * w + sx) * 4;
+        b += q[0];
+        g += q[1];
+        r += q[2];
+      }
+      r = (r + 2) / 4;
+      g = (g + 2) / 4;
+      b = (b + 2) / 4;
+      *u++ = (uint8_t)((-38 * r - 74 * g + 112 * b + 32896) >> 8);
+      *v++ = (uint8_t)((112 * r - 94 * g - 18 * b + 32896) >> 8);
+    }
+  }
+  return (size_t)(v - dst);
+}
+
+// RGB8 PNG with stored deflate blocks. Compression would cost more time per
+// frame than the workers have; re-encode the sequence offline instead.
+static size_t encodePng(const Readback *rb, ReadbackEntry *entry) {
+  size_t stride = 1 + 3 * (size_t)rb->width;
+  size_t rowsSize = pngRowsSize(rb);
+  for (uint32_t row = 0; row < rb->height; row++) {
+    uint8_t *dst = entry->rows + row * stride;
+    // filter type none
+    dst[0] = 0;
+    toRgb(dst + 1, entry->mapped + (size_t)row * rb->width * 4, rb->width);
+  }
+  uint8_t *p = entry->encoded;
+  memcpy(p, "\x89PNG\r\n\x1a\n", 8);
+  p += 8;
+  uint8_t *ihdr = p + 8;
+  putBe32(ihdr, rb->width);
+  putBe32(ihdr + 4, rb->height);
+  ihdr[8] = 8;
+  ihdr[9] = 2;
+  ihdr[10] = 0;
+  ihdr[11] = 0;
+  ihdr[12] = 0;
+  p = closeChunk(p, "IHDR", 13);
+  uint8_t *z = p + 8;
+  *z++ = 0x78;
+  *z++ = 0x01;
+  for (size_t offset = 0; offset < rowsSize;) {
+    size_t size = rowsSize - offset;
+    size = size < DEFLATE_BLOCK ? size : DEFLATE_BLOCK;
+    *z++ = offset + size == rowsSize;
+    z[0] = (uint8_t)size;
+    z[1] = (uint8_t)(size >> 8);
+    z[2] = (uint8_t)~size;
+    z[3] = (uint8_t)(~size >> 8);
+    z += 4;
+    memcpy(z, entry->rows + offset, size);
+    z += size;
+    offset += size;
+  }
+  putBe32(z, adler32(entry->rows, rowsSize));
+  z += 4;
+  p = closeChunk(p, "IDAT", (uint32_t)(z - (p + 8)));
+  p = closeChunk(p, "IEND", 0);
+  return (size_t)(p - entry->encoded);
+}
+
+static size_t encode(const Readback *rb, ReadbackEntry *entry) {
+  switch (rb->format) {
+  case READBACK_Y4M:
+    return encodeY4m(rb, entry->mapped, entry->encoded);
+  case READBACK_PNG:
+    return encodePng(rb, entry);
+  default:
+    toRgb(entry->encoded, entry->mapped, rb->width * rb->height);
+    return 3 * (size_t)rb->width * rb->height;
+  }
+}
+
+// PNG frames go to <path without .png>_<frame>.png.
+static void writePng(const Readback *rb, const ReadbackEntry *entry,
+                     size_t size) {
+  char name[512];
+  int stem = (int)strlen(rb->path) - 4;
+  snprintf(name, sizeof(name), "%.*s_%06llu.png", stem, rb->path,
+           (unsigned long long)entry->frame);
+  FILE *file = fopen(name, "wb");
+  if (file == NULL) {
+    printf("capture: failed to open %s\n", name);
+    return;
+  }
+  fwrite(entry->encoded, 1, size, file);
+  fclose(file);
+}
+
+static int encodeWorker(void *arg) {
+  Readback *rb = arg;
+  mtx_lock(&rb->lock);
+  for (;;) {
+    while (rb->queueCount == 0 && !rb->stopping) {
+      cnd_wait(&rb->work, &rb->lock);
+    }
+    if (rb->queueCount == 0) {
+      break;
+    }
+    ReadbackEntry *entry = &rb->ring[rb->queue[rb->queueHead]];
+    rb->queueHead = (rb->queueHead + 1) % READBACK_RING_DEPTH;
+    rb->queueCount--;
+    mtx_unlock(&rb->lock);
+
+    uint64_t start = timerNowNs();
+    size_t size = encode(rb, entry);
+    uint64_t ns = timerNowNs() - start;
+    if (rb->format == READBACK_PNG) {
+      writePng(rb, entry, size);
+      mtx_lock(&rb->lock);
+    } else {
+      // streams are written in frame order, encoding is not
+      mtx_lock(&rb->lock);
+      while (rb->written != entry->frame) {
+        cnd_wait(&rb->turn, &rb->lock);
+      }
+      mtx_unlock(&rb->lock);
+      fwrite(entry->encoded, 1, size, rb->file);
+      mtx_lock(&rb->lock);
+    }
+    rb->written++;
+    rb->encodeNs += ns;
+    entry->state = READBACK_FREE;
+    cnd_broadcast(&rb->turn);
+  }
+  mtx_unlock(&rb->lock);
+  return 0;
+}
+
+static ReadbackFormat formatFor(const char *path) {
+  const char *ext = strrchr(path, '.');
+  if (ext != NULL && strcmp(ext, ".y4m") == 0) {
+    return READBACK_Y4M;
+  }
+  if (ext != NULL && strcmp(ext, ".png") == 0) {
+    return READBACK_PNG;
+  }
+  return READBACK_RAW;
+}
+
+// Prefers cached memory: the workers read every byte, and uncached reads
+// are many times slower.
+static uint32_t findHostMemory(VkPhysicalDevice physicalDevice,
+                               uint32_t typeBits, bool *coherent) {
+  VkPhysicalDeviceMemoryProperties memProps;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProps);
+  VkMemoryPropertyFlags wanted[] = {
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+  };
+  for (uint32_t w = 0; w < 2; w++) {
+    for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
+      VkMemoryPropertyFlags flags = memProps.memoryTypes[i].propertyFlags;
+      if (typeBits & (1 << i) && (flags & wanted[w]) == wanted[w]) {
+        *coherent = flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        return i;
+      }
+    }
+  }
+  printf("capture: unable to find host visible memory\n");
+  exit(1);
+}
+
+void readbackInit(Readback *rb, VkDevice device,
+                  VkPhysicalDevice physicalDevice, VkExtent2D extent,
+                  const char *path) {
+  *rb = (Readback){
+      .width = extent.width,
+      .height = extent.height,
+      .format = formatFor(path),
+      .path = path,
+  };
+  initCrcTable();
+  if (rb->format != READBACK_PNG) {
+    rb->file = fopen(path, "wb");
+    if (rb->file == NULL) {
+      printf("capture: failed to open %s\n", path);
+      exit(1);
+    }
+  }
+  if (rb->format == READBACK_Y4M) {
+    fprintf(rb->file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n",
+            rb->width, rb->height, READBACK_Y4M_FPS);
+  }
+  VkDeviceSize size = (VkDeviceSize)rb->width * rb->height * 4;
+  size_t encodedSize = encodedCapacity(rb);
+  for (uint32_t i = 0; i < READBACK_RING_DEPTH; i++) {
+    ReadbackEntry *entry = &rb->ring[i];
+    VkBufferCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    if (vkCreateBuffer(device, &info, NULL, &entry->buffer) != VK_SUCCESS) {
+      printf("failed to create readback buffer\n");
+      exit(1);
+    }
+    VkMemoryRequirements memReq;
+    vkGetBufferMemoryRequirements(device, entry->buffer, &memReq);
+    VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memReq.size,
+        .memoryTypeIndex = findHostMemory(
+            physicalDevice, memReq.memoryTypeBits, &rb->coherent),
+    };
+    if (vkAllocateMemory(device, &allocInfo, NULL, &entry->memory) !=
+        VK_SUCCESS) {
+      printf("failed to allocate readback memory\n");
+      exit(1);
+    }
+    vkBindBufferMemory(device, entry->buffer, entry->memory, 0);
+    vkMapMemory(device, entry->memory, 0, VK_WHOLE_SIZE, 0,
+                (void **)&entry->mapped);
+    entry->encoded = malloc(encodedSize);
+    if (rb->format == READBACK_PNG) {
+      entry->rows = malloc(pngRowsSize(rb));
+    }
+    if (entry->encoded == NULL ||
+        (rb->format == READBACK_PNG && entry->rows == NULL)) {
+      printf("malloc failed\n");
+      exit(1);
+    }
+  }
+  if (mtx_init(&rb->lock, mtx_plain) != thrd_success ||
+      cnd_init(&rb->work) != thrd_success ||
+      cnd_init(&rb->turn) != thrd_success) {
+    printf("failed to create capture locks\n");
+    exit(1);
+  }
+  for (int i = 0; i < READBACK_WORKERS; i++) {
+    if (thrd_create(&rb->workers[i], encodeWorker, rb) != thrd_success) {
+      printf("failed to create capture thread\n");
+      exit(1);
+    }
+  }
+  static const char *formatNames[] = {"rgb24", "y4m", "png"};
+  printf("capturing %ux%u %s to %s\n", rb->width, rb->height,
+         formatNames[rb->format], path);
+}
+
+bool readbackRecord(Readback *rb, VkCommandBuffer cmd, VkImage image,
+                    uint64_t value) {
+  ReadbackEntry *entry = &rb->ring[rb->next];
+  mtx_lock(&rb->lock);
+  bool available = entry->state == READBACK_FREE;
+  if (available) {
+    entry->state = READBACK_COPYING;
+  }
+  mtx_unlock(&rb->lock);
+  if (!available) {
+    rb->dropped++;
+    return false;
+  }
+  entry->value = value;
+  entry->frame = rb->frames++;
+  rb->next = (rb->next + 1) % READBACK_RING_DEPTH;
+  rb->copying++;
+
+  VkBufferImageCopy region = {
+      .imageSubresource =
+          {
+              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+              .layerCount = 1,
+          },
+      .imageExtent = {rb->width, rb->height, 1},
+  };
+  vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         entry->buffer, 1, &region);
+  // the timeline signal alone does not make the copy visible to the host
+  VkMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+      .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT,
+      .dstAccessMask = VK_ACCESS_2_HOST_READ_BIT,
+  };
+  VkDependencyInfo dependency = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+  };
+  vkCmdPipelineBarrier2(cmd, &dependency);
+  return true;
+}
+
+void readbackPoll(Readback *rb, VkDevice device, VkSemaphore timeline) {
+  if (rb->copying == 0) {
+    return;
+  }
+  uint64_t completed = 0;
+  vkGetSemaphoreCounterValue(device, timeline, &completed);
+  mtx_lock(&rb->lock);
+  // copies finish in the order they were recorded
+  while (rb->copying > 0 && rb->ring[rb->oldest].value <= completed) {
+    ReadbackEntry *entry = &rb->ring[rb->oldest];
+    if (!rb->coherent) {
+      VkMappedMemoryRange range = {
+          .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+          .memory = entry->memory,
+          .size = VK_WHOLE_SIZE,
+      };
+      vkInvalidateMappedMemoryRanges(device, 1, &range);
+    }
+    entry->state = READBACK_ENCODING;
+    uint32_t tail = (rb->queueHead + rb->queueCount) % READBACK_RING_DEPTH;
+    rb->queue[tail] = rb->oldest;
+    rb->queueCount++;
+    rb->oldest = (rb->oldest + 1) % READBACK_RING_DEPTH;
+    rb->copying--;
+  }
+  cnd_broadcast(&rb->work);
+  mtx_unlock(&rb->lock);
+}
+
+void readbackDestroy(Readback *rb, VkDevice device, VkSemaphore timeline) {
+  readbackPoll(rb, device, timeline);
+  mtx_lock(&rb->lock);
+  rb->stopping = true;
+  cnd_broadcast(&rb->work);
+  mtx_unlock(&rb->lock);
+  for (int i = 0; i < READBACK_WORKERS; i++) {
+    thrd_join(rb->workers[i], NULL);
+  }
+  printf("capture: %llu frames, %llu dropped, %.3f ms encode/frame\n",
+         (unsigned long long)rb->written, (unsigned long long)rb->dropped,
+         rb->written > 0 ? rb->encodeNs / 1e6 / rb->written : 0.0);
+  if (rb->file != NULL) {
+    fclose(rb->file);
+  }
+  for (uint32_t i = 0; i < READBACK_RING_DEPTH; i++) {
+    vkDestroyBuffer(device, rb->ring[i].buffer, NULL);
+    vkFreeMemory(device, rb->ring[i].memory, NULL);
+    free(rb->ring[i].encoded);
+    free(rb->ring[i].rows);
+  }
+  cnd_destroy(&rb->turn);
+  cnd_destroy(&rb->work);
+  mtx_destroy(&rb->lock);
+}
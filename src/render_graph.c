@@ -0,0 +1,712 @@
+#include "render_graph.h"
+#include "barrier.h"
+#include "vulkan/vulkan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  VkImageLayout layout;
+  VkPipelineStageFlags2 stage;
+  VkAccessFlags2 access;
+  VkImageUsageFlags usage;
+} UsageInfo;
+
+static UsageInfo usageInfo(RgUsage usage, bool compute) {
+  VkPipelineStageFlags2 shaderStage = compute
+                                          ? VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT
+                                          : VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+  switch (usage) {
+  case RG_USAGE_COLOR_ATTACHMENT:
+    return (UsageInfo){VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT |
+                           VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                       VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT};
+  case RG_USAGE_DEPTH_ATTACHMENT:
+    return (UsageInfo){VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                           VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                       VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                           VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                       VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+  case RG_USAGE_DEPTH_READ:
+    return (UsageInfo){VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT |
+                           VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                       VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+                       VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+  case RG_USAGE_SAMPLED:
+    return (UsageInfo){VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, shaderStage,
+                       VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                       VK_IMAGE_USAGE_SAMPLED_BIT};
+  case RG_USAGE_STORAGE_READ:
+    return (UsageInfo){VK_IMAGE_LAYOUT_GENERAL, shaderStage,
+                       VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+                       VK_IMAGE_USAGE_STORAGE_BIT};
+  case RG_USAGE_STORAGE_WRITE:
+    return (UsageInfo){VK_IMAGE_LAYOUT_GENERAL, shaderStage,
+                       VK_ACCESS_2_SHADER_STORAGE_READ_BIT |
+                           VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                       VK_IMAGE_USAGE_STORAGE_BIT};
+  case RG_USAGE_TRANSFER_SRC:
+    return (UsageInfo){VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                       VK_ACCESS_2_TRANSFER_READ_BIT,
+                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT};
+  case RG_USAGE_TRANSFER_DST:
+    return (UsageInfo){VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                       VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                       VK_IMAGE_USAGE_TRANSFER_DST_BIT};
+  case RG_USAGE_PRESENT:
+    // the present semaphore carries the dependency
+    return (UsageInfo){VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                       VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, 0};
+  }
+  printf("unknown render graph usage %d\n", usage);
+  exit(1);
+}
+
+static const char *usageName(RgUsage usage) {
+  switch (usage) {
+  case RG_USAGE_COLOR_ATTACHMENT:
+    return "color-attachment";
+  case RG_USAGE_DEPTH_ATTACHMENT:
+    return "depth-attachment";
+  case RG_USAGE_DEPTH_READ:
+    return "depth-read";
+  case RG_USAGE_SAMPLED:
+    return "sampled";
+  case RG_USAGE_STORAGE_READ:
+    return "storage-read";
+  case RG_USAGE_STORAGE_WRITE:
+    return "storage-write";
+  case RG_USAGE_TRANSFER_SRC:
+    return "transfer-src";
+  case RG_USAGE_TRANSFER_DST:
+    return "transfer-dst";
+  case RG_USAGE_PRESENT:
+    return "present";
+  }
+  return "?";
+}
+
+static const char *layoutName(VkImageLayout layout) {
+  switch (layout) {
+  case VK_IMAGE_LAYOUT_UNDEFINED:
+    return "UNDEFINED";
+  case VK_IMAGE_LAYOUT_GENERAL:
+    return "GENERAL";
+  case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+    return "COLOR_ATTACHMENT";
+  case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+    return "DEPTH_STENCIL_ATTACHMENT";
+  case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+    return "DEPTH_STENCIL_READ_ONLY";
+  case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+    return "SHADER_READ_ONLY";
+  case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+    return "TRANSFER_SRC";
+  case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+    return "TRANSFER_DST";
+  case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+    return "PRESENT_SRC";
+  default:
+    return "OTHER";
+  }
+}
+
+void rgInit(RenderGraph *graph) { *graph = (RenderGraph){0}; }
+
+static RgResource *addResource(RenderGraph *graph, const char *name,
+                               uint32_t *index) {
+  if (graph->resourceCount == RG_MAX_RESOURCES) {
+    printf("render graph: too many resources\n");
+    exit(1);
+  }
+  *index = graph->resourceCount++;
+  RgResource *res = &graph->resources[*index];
+  *res = (RgResource){
+      .name = name,
+      .layers = 1,
+      .firstPass = -1,
+      .lastPass = -1,
+      .slot = -1,
+      .aliasPrev = -1,
+  };
+  return res;
+}
+
+uint32_t rgCreateImage(RenderGraph *graph, const char *name, VkFormat format,
+                       VkExtent2D extent, VkSampleCountFlagBits samples,
+                       VkImageAspectFlags aspect) {
+  uint32_t index;
+  RgResource *res = addResource(graph, name, &index);
+  res->format = format;
+  res->extent = extent;
+  res->samples = samples;
+  res->aspect = aspect;
+  return index;
+}
+
+uint32_t rgImportImage(RenderGraph *graph, const char *name, VkFormat format,
+                       VkExtent2D extent, VkImageAspectFlags aspect,
+                       VkImageLayout layout, VkPipelineStageFlags2 stage) {
+  uint32_t index;
+  RgResource *res = addResource(graph, name, &index);
+  res->format = format;
+  res->extent = extent;
+  res->samples = VK_SAMPLE_COUNT_1_BIT;
+  res->aspect = aspect;
+  res->imported = true;
+  res->importLayout = layout;
+  res->importStage = stage;
+  return index;
+}
+
+void rgSetLayers(RenderGraph *graph, uint32_t resource, uint32_t layers) {
+  if (layers == 0 || layers > RG_MAX_LAYERS) {
+    printf("render graph: %s cannot have %u layers\n",
+           graph->resources[resource].name, layers);
+    exit(1);
+  }
+  graph->resources[resource].layers = layers;
+}
+
+void rgSetImage(RenderGraph *graph, uint32_t resource, VkImage image,
+                VkImageView view) {
+  graph->resources[resource].image = image;
+  graph->resources[resource].view = view;
+}
+
+void rgSetOutput(RenderGraph *graph, uint32_t resource, RgUsage usage) {
+  graph->resources[resource].output = true;
+  graph->resources[resource].outputUsage = usage;
+}
+
+uint32_t rgAddPass(RenderGraph *graph, const char *name, bool compute,
+                   RgExecuteFn execute, void *userData) {
+  if (graph->passCount == RG_MAX_PASSES) {
+    printf("render graph: too many passes\n");
+    exit(1);
+  }
+  uint32_t index = graph->passCount++;
+  graph->passes[index] = (RgPass){
+      .name = name,
+      .compute = compute,
+      .execute = execute,
+      .userData = userData,
+  };
+  return index;
+}
+
+void rgSetSideEffects(RenderGraph *graph, uint32_t pass) {
+  graph->passes[pass].sideEffects = true;
+}
+
+static RgAccess *findAccess(RenderGraph *graph, uint32_t pass,
+                            uint32_t resource, RgUsage usage) {
+  RgPass *p = &graph->passes[pass];
+  for (uint32_t i = 0; i < p->accessCount; i++) {
+    if (p->accesses[i].resource == resource) {
+      if (p->accesses[i].usage != usage) {
+        printf("render graph: pass %s uses %s in two ways\n", p->name,
+               graph->resources[resource].name);
+        exit(1);
+      }
+      return &p->accesses[i];
+    }
+  }
+  if (p->accessCount == RG_MAX_PASS_ACCESSES) {
+    printf("render graph: too many accesses in pass %s\n", p->name);
+    exit(1);
+  }
+  RgAccess *access = &p->accesses[p->accessCount++];
+  *access = (RgAccess){.resource = resource, .usage = usage};
+  return access;
+}
+
+void rgRead(RenderGraph *graph, uint32_t pass, uint32_t resource,
+            RgUsage usage) {
+  findAccess(graph, pass, resource, usage)->read = true;
+}
+
+void rgWrite(RenderGraph *graph, uint32_t pass, uint32_t resource,
+             RgUsage usage) {
+  findAccess(graph, pass, resource, usage)->write = true;
+}
+
+// Backwards liveness: a pass survives if it has side effects or writes a
+// resource a later surviving pass (or the outside world) reads.
+static void cullPasses(RenderGraph *graph) {
+  bool needed[RG_MAX_RESOURCES];
+  for (uint32_t r = 0; r < graph->resourceCount; r++) {
+    needed[r] = graph->resources[r].output;
+  }
+  for (int32_t p = (int32_t)graph->passCount - 1; p >= 0; p--) {
+    RgPass *pass = &graph->passes[p];
+    bool alive = pass->sideEffects;
+    for (uint32_t a = 0; a < pass->accessCount; a++) {
+      if (pass->accesses[a].write && needed[pass->accesses[a].resource]) {
+        alive = true;
+      }
+    }
+    pass->culled = !alive;
+    if (!alive) {
+      continue;
+    }
+    for (uint32_t a = 0; a < pass->accessCount; a++) {
+      if (pass->accesses[a].write && !pass->accesses[a].read) {
+        needed[pass->accesses[a].resource] = false;
+      }
+    }
+    for (uint32_t a = 0; a < pass->accessCount; a++) {
+      if (pass->accesses[a].read) {
+        needed[pass->accesses[a].resource] = true;
+      }
+    }
+  }
+}
+
+static void computeLifetimes(RenderGraph *graph) {
+  for (uint32_t p = 0; p < graph->passCount; p++) {
+    RgPass *pass = &graph->passes[p];
+    if (pass->culled) {
+      continue;
+    }
+    for (uint32_t a = 0; a < pass->accessCount; a++) {
+      RgResource *res = &graph->resources[pass->accesses[a].resource];
+      if (res->firstPass < 0) {
+        res->firstPass = (int32_t)p;
+      }
+      res->lastPass = (int32_t)p;
+      res->lastUsage = pass->accesses[a].usage;
+      res->lastCompute = pass->compute;
+      res->usage |= usageInfo(pass->accesses[a].usage, pass->compute).usage;
+    }
+  }
+}
+
+static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice,
+                                    uint32_t typeBits,
+                                    VkMemoryPropertyFlags props) {
+  VkPhysicalDeviceMemoryProperties memProps;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProps);
+  for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
+    if (typeBits & (1 << i) &&
+        (memProps.memoryTypes[i].propertyFlags & props) == props) {
+      return i;
+    }
+  }
+  printf("render graph: unable to find suitable memory\n");
+  exit(1);
+}
+
+static void allocateTransients(RenderGraph *graph, VkDevice device,
+                               VkPhysicalDevice physicalDevice) {
+  // greedy interval packing in order of first use
+  uint32_t order[RG_MAX_RESOURCES];
+  uint32_t count = 0;
+  for (uint32_t r = 0; r < graph->resourceCount; r++) {
+    if (!graph->resources[r].imported && graph->resources[r].firstPass >= 0) {
+      order[count++] = r;
+    }
+  }
+  for (uint32_t i = 1; i < count; i++) {
+    uint32_t r = order[i];
+    uint32_t j = i;
+    while (j > 0 && graph->resources[order[j - 1]].firstPass >
+                        graph->resources[r].firstPass) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = r;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    RgResource *res = &graph->resources[order[i]];
+    VkImageUsageFlags usage = res->usage;
+    if (!(usage & ~(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                    VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT))) {
+      usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    }
+    VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .mipLevels = 1,
+        .samples = res->samples,
+        .extent = {res->extent.width, res->extent.height, 1},
+        .arrayLayers = res->layers,
+        .format = res->format,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    if (vkCreateImage(device, &imageInfo, NULL, &res->image) != VK_SUCCESS) {
+      printf("render graph: failed to create %s\n", res->name);
+      exit(1);
+    }
+    VkMemoryRequirements memReq;
+    vkGetImageMemoryRequirements(device, res->image, &memReq);
+    res->size = memReq.size;
+    int32_t slot = -1;
+    for (uint32_t s = 0; s < graph->slotCount; s++) {
+      if (graph->slots[s].lastPass < res->firstPass &&
+          (graph->slots[s].typeBits & memReq.memoryTypeBits)) {
+        slot = (int32_t)s;
+        break;
+      }
+    }
+    if (slot < 0) {
+      slot = (int32_t)graph->slotCount++;
+      graph->slots[slot] = (RgMemorySlot){
+          .typeBits = memReq.memoryTypeBits,
+          .lastResource = -1,
+          .firstResource = (int32_t)order[i],
+      };
+    }
+    RgMemorySlot *s = &graph->slots[slot];
+    s->typeBits &= memReq.memoryTypeBits;
+    if (memReq.size > s->size) {
+      s->size = memReq.size;
+    }
+    s->lastPass = res->lastPass;
+    res->aliasPrev = s->lastResource;
+    res->slot = slot;
+    s->lastResource = (int32_t)order[i];
+  }
+  for (uint32_t s = 0; s < graph->slotCount; s++) {
+    RgMemorySlot *slot = &graph->slots[s];
+    // across frames the first occupant follows the last one
+    graph->resources[slot->firstResource].aliasPrev = slot->lastResource;
+    VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = slot->size,
+        .memoryTypeIndex =
+            findMemoryTypeIndex(physicalDevice, slot->typeBits,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+    };
+    if (vkAllocateMemory(device, &allocInfo, NULL, &slot->memory) !=
+        VK_SUCCESS) {
+      printf("render graph: failed to allocate transient memory\n");
+      exit(1);
+    }
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    RgResource *res = &graph->resources[order[i]];
+    vkBindImageMemory(device, res->image, graph->slots[res->slot].memory, 0);
+    VkImageViewCreateInfo viewInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = res->image,
+        .viewType = res->layers > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY
+                                    : VK_IMAGE_VIEW_TYPE_2D,
+        .format = res->format,
+        .subresourceRange =
+            {
+                .aspectMask = res->aspect,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = res->layers,
+            },
+    };
+    if (vkCreateImageView(device, &viewInfo, NULL, &res->view) != VK_SUCCESS) {
+      printf("render graph: failed to create view for %s\n", res->name);
+      exit(1);
+    }
+    for (uint32_t l = 0; res->layers > 1 && l < res->layers; l++) {
+      viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      viewInfo.subresourceRange.baseArrayLayer = l;
+      viewInfo.subresourceRange.layerCount = 1;
+      if (vkCreateImageView(device, &viewInfo, NULL, &res->layerViews[l]) !=
+          VK_SUCCESS) {
+        printf("render graph: failed to create layer view for %s\n",
+               res->name);
+        exit(1);
+      }
+    }
+  }
+}
+
+// The last writer of a resource, or the last layout transition, and the
+// reads that already have a dependency on it.
+typedef struct {
+  VkImageLayout layout;
+  VkPipelineStageFlags2 writeStage;
+  VkAccessFlags2 writeAccess;
+  VkPipelineStageFlags2 readStage;
+  VkAccessFlags2 readAccess;
+} ResourceState;
+
+// Emits a barrier into out when moving from state to info is a hazard and
+// updates state. Returns whether a barrier was written.
+static bool transition(ResourceState *state, UsageInfo info, bool discard,
+                       uint32_t resource, RgBarrier *out) {
+  bool write = info.access & BARRIER_WRITE_ACCESS_MASK;
+  if (state->layout == info.layout && !write) {
+    // nothing written yet, or a barrier from the last writer covers it
+    if (state->writeStage == VK_PIPELINE_STAGE_2_NONE ||
+        ((info.stage & ~state->readStage) == 0 &&
+         (info.access & ~state->readAccess) == 0)) {
+      state->readStage |= info.stage;
+      state->readAccess |= info.access;
+      return false;
+    }
+  } else if (state->layout == info.layout &&
+             state->writeStage == VK_PIPELINE_STAGE_2_NONE &&
+             state->readStage == VK_PIPELINE_STAGE_2_NONE) {
+    state->writeStage = info.stage;
+    state->writeAccess = info.access & BARRIER_WRITE_ACCESS_MASK;
+    return false;
+  }
+  bool relayout = state->layout != info.layout;
+  // writes and layout transitions also wait for the reads since the write
+  *out = (RgBarrier){
+      .resource = resource,
+      .oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state->layout,
+      .newLayout = info.layout,
+      .srcStage = state->writeStage |
+                  (write || relayout ? state->readStage
+                                     : VK_PIPELINE_STAGE_2_NONE),
+      .srcAccess = state->writeAccess,
+      .dstStage = info.stage,
+      .dstAccess = info.access,
+  };
+  state->layout = info.layout;
+  if (write || relayout) {
+    // later reads chain through this barrier's destination
+    state->writeStage = info.stage;
+    state->writeAccess = info.access & BARRIER_WRITE_ACCESS_MASK;
+    state->readStage = write ? VK_PIPELINE_STAGE_2_NONE : info.stage;
+    state->readAccess = write ? VK_ACCESS_2_NONE : info.access;
+  } else {
+    state->readStage |= info.stage;
+    state->readAccess |= info.access;
+  }
+  return true;
+}
+
+static void planBarriers(RenderGraph *graph) {
+  ResourceState states[RG_MAX_RESOURCES];
+  for (uint32_t r = 0; r < graph->resourceCount; r++) {
+    RgResource *res = &graph->resources[r];
+    if (res->imported) {
+      states[r] = (ResourceState){res->importLayout, res->importStage,
+                                  VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_NONE,
+                                  VK_ACCESS_2_NONE};
+    } else if (res->aliasPrev >= 0) {
+      // wait for whoever used the memory last, possibly last frame
+      RgResource *prev = &graph->resources[res->aliasPrev];
+      UsageInfo last = usageInfo(prev->lastUsage, prev->lastCompute);
+      states[r] = (ResourceState){VK_IMAGE_LAYOUT_UNDEFINED, last.stage,
+                                  last.access & BARRIER_WRITE_ACCESS_MASK,
+                                  VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE};
+    } else {
+      states[r] = (ResourceState){VK_IMAGE_LAYOUT_UNDEFINED,
+                                  VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+                                  VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE};
+    }
+  }
+  for (uint32_t p = 0; p < graph->passCount; p++) {
+    RgPass *pass = &graph->passes[p];
+    pass->barrierCount = 0;
+    if (pass->culled) {
+      continue;
+    }
+    for (uint32_t a = 0; a < pass->accessCount; a++) {
+      RgAccess *access = &pass->accesses[a];
+      UsageInfo info = usageInfo(access->usage, pass->compute);
+      // previous contents are dead when the pass only writes
+      bool discard = access->write && !access->read;
+      if (transition(&states[access->resource], info, discard,
+                     access->resource,
+                     &pass->barriers[pass->barrierCount])) {
+        pass->barrierCount++;
+      }
+    }
+  }
+  graph->finalBarrierCount = 0;
+  for (uint32_t r = 0; r < graph->resourceCount; r++) {
+    RgResource *res = &graph->resources[r];
+    if (!res->output) {
+      continue;
+    }
+    UsageInfo info = usageInfo(res->outputUsage, false);
+    if (transition(&states[r], info, false, r,
+                   &graph->finalBarriers[graph->finalBarrierCount])) {
+      graph->finalBarrierCount++;
+    }
+  }
+}
+
+void rgCompile(RenderGraph *graph, VkDevice device,
+               VkPhysicalDevice physicalDevice) {
+  cullPasses(graph);
+  computeLifetimes(graph);
+  allocateTransients(graph, device, physicalDevice);
+  planBarriers(graph);
+  graph->compiled = true;
+}
+
+static void addBarriers(const RenderGraph *graph, const RgBarrier *barriers,
+                        uint32_t count, BarrierBatch *batch) {
+  for (uint32_t i = 0; i < count; i++) {
+    const RgBarrier *b = &barriers[i];
+    const RgResource *res = &graph->resources[b->resource];
+    VkImageMemoryBarrier2 barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = b->srcStage,
+        .srcAccessMask = b->srcAccess,
+        .dstStageMask = b->dstStage,
+        .dstAccessMask = b->dstAccess,
+        .oldLayout = b->oldLayout,
+        .newLayout = b->newLayout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = res->image,
+        .subresourceRange =
+            {
+                .aspectMask = res->aspect,
+                .baseMipLevel = 0,
+                .levelCount = 1,
+                .baseArrayLayer = 0,
+                .layerCount = res->layers,
+            },
+    };
+    barrierAdd(batch, &barrier);
+  }
+}
+
+void rgExecute(const RenderGraph *graph, VkCommandBuffer cmd,
+               BarrierBatch *barriers) {
+  for (uint32_t p = 0; p < graph->passCount; p++) {
+    const RgPass *pass = &graph->passes[p];
+    if (pass->culled) {
+      continue;
+    }
+    addBarriers(graph, pass->barriers, pass->barrierCount, barriers);
+    barrierFlush(barriers, cmd);
+    pass->execute(cmd, graph, pass->userData);
+  }
+  addBarriers(graph, graph->finalBarriers, graph->finalBarrierCount, barriers);
+  barrierFlush(barriers, cmd);
+}
+
+VkImageView rgView(const RenderGraph *graph, uint32_t resource) {
+  return graph->resources[resource].view;
+}
+
+VkImageView rgLayerView(const RenderGraph *graph, uint32_t resource,
+                        uint32_t layer) {
+  const RgResource *res = &graph->resources[resource];
+  return res->layers > 1 ? res->layerViews[layer] : res->view;
+}
+
+VkImage rgImage(const RenderGraph *graph, uint32_t resource) {
+  return graph->resources[resource].image;
+}
+
+VkDeviceSize rgMemorySize(const RenderGraph *graph) {
+  VkDeviceSize size = 0;
+  for (uint32_t s = 0; s < graph->slotCount; s++) {
+    size += graph->slots[s].size;
+  }
+  return size;
+}
+
+static void dumpBarrier(const RenderGraph *graph, const RgBarrier *b,
+                        FILE *out) {
+  fprintf(out, "      barrier %-12s %s -> %s, stages 0x%llx -> 0x%llx\n",
+          graph->resources[b->resource].name, layoutName(b->oldLayout),
+          layoutName(b->newLayout), (unsigned long long)b->srcStage,
+          (unsigned long long)b->dstStage);
+}
+
+void rgDump(const RenderGraph *graph, FILE *out) {
+  uint32_t alive = 0;
+  uint32_t barrierCount = graph->finalBarrierCount;
+  for (uint32_t p = 0; p < graph->passCount; p++) {
+    if (!graph->passes[p].culled) {
+      alive++;
+      barrierCount += graph->passes[p].barrierCount;
+    }
+  }
+  VkDeviceSize transientBytes = 0;
+  VkDeviceSize unaliasedBytes = 0;
+  for (uint32_t s = 0; s < graph->slotCount; s++) {
+    transientBytes += graph->slots[s].size;
+  }
+  for (uint32_t r = 0; r < graph->resourceCount; r++) {
+    unaliasedBytes += graph->resources[r].size;
+  }
+  fprintf(out,
+          "render graph: %u/%u passes, %u resources, %u barriers/frame, "
+          "transient memory %.2f MiB (%.2f MiB without aliasing)\n",
+          alive, graph->passCount, graph->resourceCount, barrierCount,
+          transientBytes / (1024.0 * 1024.0),
+          unaliasedBytes / (1024.0 * 1024.0));
+  fprintf(out, "  resources:\n");
+  for (uint32_t r = 0; r < graph->resourceCount; r++) {
+    const RgResource *res = &graph->resources[r];
+    fprintf(out, "    [%u] %-12s %ux%u %ux %s", r, res->name,
+            res->extent.width, res->extent.height, res->samples,
+            res->imported ? "imported" : "transient");
+    if (res->firstPass < 0) {
+      fprintf(out, ", unused\n");
+      continue;
+    }
+    fprintf(out, ", passes %d..%d", res->firstPass, res->lastPass);
+    if (res->slot >= 0) {
+      fprintf(out, ", slot %d, %.2f MiB", res->slot,
+              res->size / (1024.0 * 1024.0));
+    }
+    if (res->layers > 1) {
+      fprintf(out, ", %u layers", res->layers);
+    }
+    if (res->output) {
+      fprintf(out, ", output as %s", usageName(res->outputUsage));
+    }
+    fprintf(out, "\n");
+  }
+  fprintf(out, "  passes:\n");
+  for (uint32_t p = 0; p < graph->passCount; p++) {
+    const RgPass *pass = &graph->passes[p];
+    fprintf(out, "    [%u] %s (%s)%s\n", p, pass->name,
+            pass->compute ? "compute" : "graphics",
+            pass->culled ? " culled" : "");
+    for (uint32_t a = 0; a < pass->accessCount; a++) {
+      const RgAccess *access = &pass->accesses[a];
+      fprintf(out, "      %s%s %-12s as %s\n", access->read ? "r" : "-",
+              access->write ? "w" : "-",
+              graph->resources[access->resource].name,
+              usageName(access->usage));
+    }
+    for (uint32_t b = 0; b < pass->barrierCount; b++) {
+      dumpBarrier(graph, &pass->barriers[b], out);
+    }
+  }
+  fprintf(out, "  end of frame:\n");
+  for (uint32_t b = 0; b < graph->finalBarrierCount; b++) {
+    dumpBarrier(graph, &graph->finalBarriers[b], out);
+  }
+}
+
+void rgDestroy(RenderGraph *graph, VkDevice device) {
+  for (uint32_t r = 0; r < graph->resourceCount; r++) {
+    RgResource *res = &graph->resources[r];
+    if (res->imported || res->image == VK_NULL_HANDLE) {
+      continue;
+    }
+    for (uint32_t l = 0; res->layers > 1 && l < res->layers; l++) {
+      vkDestroyImageView(device, res->layerViews[l], NULL);
+    }
+    vkDestroyImageView(device, res->view, NULL);
+    vkDestroyImage(device, res->image, NULL);
+  }
+  for (uint32_t s = 0; s < graph->slotCount; s++) {
+    vkFreeMemory(device, graph->slots[s].memory, NULL);
+  }
+  rgInit(graph);
+}
@@ -0,0 +1,201 @@
+#include "shader_watch.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Names come from whatever lands in the watched directory and end up in
+// paths and compiler arguments, so anything beyond [A-Za-z0-9_.-] is ignored.
+static bool isPlainName(const char *name) {
+  for (const char *c = name; *c != '\0'; c++) {
+    bool plain = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+                 (*c >= '0' && *c <= '9') || *c == '_' || *c == '.' ||
+                 *c == '-';
+    if (!plain) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool isShaderSource(const char *name) {
+  if (!isPlainName(name)) {
+    return false;
+  }
+  const char *ext = strrchr(name, '.');
+  return ext != NULL && (strcmp(ext, ".vert") == 0 ||
+                         strcmp(ext, ".frag") == 0 ||
+                         strcmp(ext, ".comp") == 0);
+}
+
+// Runs the compiler directly, without a shell, and waits for it.
+static bool runCompiler(char *const argv[]) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid) {
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool compileShader(ShaderWatcher *watcher, const char *name) {
+  char source[512];
+  char output[512];
+  char tmpOutput[520];
+  snprintf(source, sizeof(source), "%s/%s", watcher->sourceDir, name);
+  snprintf(output, sizeof(output), "%s/%s.spv", watcher->outputDir, name);
+  snprintf(tmpOutput, sizeof(tmpOutput), "%s.tmp", output);
+  char *argv[] = {(char *)watcher->compiler, source, "-o", tmpOutput, NULL};
+  printf("shader watch: compiling %s\n", name);
+  if (!runCompiler(argv)) {
+    printf("shader watch: %s failed to compile, keeping the old SPIR-V\n",
+           name);
+    remove(tmpOutput);
+    return false;
+  }
+  if (rename(tmpOutput, output) != 0) {
+    printf("shader watch: unable to replace %s\n", output);
+    remove(tmpOutput);
+    return false;
+  }
+  return true;
+}
+
+// Adds name to list unless it is already there.
+static void addName(char list[][SHADER_WATCH_NAME_SIZE], uint32_t *count,
+                    const char *name) {
+  for (uint32_t i = 0; i < *count; i++) {
+    if (strcmp(list[i], name) == 0) {
+      return;
+    }
+  }
+  if (*count == SHADER_WATCH_MAX_PENDING ||
+      strlen(name) >= SHADER_WATCH_NAME_SIZE) {
+    return;
+  }
+  strcpy(list[(*count)++], name);
+}
+
+// Appends shader sources named by the inotify events in buffer to changed.
+static void readEvents(ShaderWatcher *watcher,
+                       char changed[][SHADER_WATCH_NAME_SIZE],
+                       uint32_t *changedCount) {
+  _Alignas(struct inotify_event) char buffer[4096];
+  ssize_t length;
+  while ((length = read(watcher->fd, buffer, sizeof(buffer))) > 0) {
+    for (char *p = buffer; p < buffer + length;) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      if (event->len > 0 && isShaderSource(event->name)) {
+        addName(changed, changedCount, event->name);
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+static int watchWorker(void *arg) {
+  ShaderWatcher *watcher = arg;
+  char changed[SHADER_WATCH_MAX_PENDING][SHADER_WATCH_NAME_SIZE];
+  uint32_t changedCount = 0;
+  for (;;) {
+    mtx_lock(&watcher->lock);
+    bool stopping = watcher->stopping;
+    mtx_unlock(&watcher->lock);
+    if (stopping) {
+      return 0;
+    }
+    // wake periodically to notice stopping
+    struct pollfd pfd = {.fd = watcher->fd, .events = POLLIN};
+    int ready = poll(&pfd, 1, SHADER_WATCH_SETTLE_MS);
+    if (ready > 0) {
+      readEvents(watcher, changed, &changedCount);
+      continue;
+    }
+    // quiet for a settle period: compile what changed
+    for (uint32_t i = 0; i < changedCount; i++) {
+      if (compileShader(watcher, changed[i])) {
+        mtx_lock(&watcher->lock);
+        addName(watcher->compiled, &watcher->compiledCount, changed[i]);
+        mtx_unlock(&watcher->lock);
+      }
+    }
+    changedCount = 0;
+  }
+}
+
+bool shaderWatchInit(ShaderWatcher *watcher, const char *sourceDir,
+                     const char *outputDir) {
+  const char *compiler = getenv("GLSLC");
+  *watcher = (ShaderWatcher){
+      .sourceDir = sourceDir,
+      .outputDir = outputDir,
+      .compiler = compiler != NULL ? compiler : "glslc",
+  };
+  watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watcher->fd < 0) {
+    printf("shader watch: inotify unavailable\n");
+    return false;
+  }
+  // editors either rewrite the file in place or rename a new one over it
+  if (inotify_add_watch(watcher->fd, sourceDir,
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    printf("shader watch: unable to watch %s\n", sourceDir);
+    close(watcher->fd);
+    return false;
+  }
+  if (mtx_init(&watcher->lock, mtx_plain) != thrd_success ||
+      thrd_create(&watcher->thread, watchWorker, watcher) != thrd_success) {
+    printf("failed to create shader watch thread\n");
+    exit(1);
+  }
+  printf("shader watch: watching %s, compiling with %s\n", sourceDir,
+         watcher->compiler);
+  return true;
+}
+
+bool shaderWatchPoll(ShaderWatcher *watcher, char *name, size_t size) {
+  mtx_lock(&watcher->lock);
+  bool found = watcher->compiledCount > 0;
+  if (found) {
+    snprintf(name, size, "%s", watcher->compiled[--watcher->compiledCount]);
+  }
+  mtx_unlock(&watcher->lock);
+  return found;
+}
+
+void shaderWatchDestroy(ShaderWatcher *watcher) {
+  mtx_lock(&watcher->lock);
+  watcher->stopping = true;
+  mtx_unlock(&watcher->lock);
+  thrd_join(watcher->thread, NULL);
+  mtx_destroy(&watcher->lock);
+  close(watcher->fd);
+}
+#else
+bool shaderWatchInit(ShaderWatcher *watcher, const char *sourceDir,
+                     const char *outputDir) {
+  printf("shader watch: hot reload needs inotify\n");
+  return false;
+}
+
+bool shaderWatchPoll(ShaderWatcher *watcher, char *name, size_t size) {
+  return false;
+}
+
+void shaderWatchDestroy(ShaderWatcher *watcher) {}
+#endif
@@ -0,0 +1,27 @@
+#include "timer.h"
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+
+uint64_t timerNowNs() {
+  static LARGE_INTEGER freq = {0};
+  if (freq.QuadPart == 0) {
+    QueryPerformanceFrequency(&freq);
+  }
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  uint64_t ticks = (uint64_t)counter.QuadPart;
+  uint64_t f = (uint64_t)freq.QuadPart;
+  // split to avoid overflowing ticks * 1e9
+  return (ticks / f) * 1000000000ull + (ticks % f) * 1000000000ull / f;
+}
+#else
+#include <time.h>
+
+uint64_t timerNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+#endif
@@ -0,0 +1,210 @@
+#include "upload.h"
+#include "device.h"
+#include "vulkan/vulkan.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void *grow(void *items, uint32_t *cap, uint32_t count, size_t size) {
+  if (count < *cap) {
+    return items;
+  }
+  *cap = *cap == 0 ? 8 : *cap * 2;
+  void *resized = realloc(items, size * *cap);
+  if (resized == NULL) {
+    printf("realloc failed\n");
+    exit(1);
+  }
+  return resized;
+}
+
+void uploaderInit(Uploader *uploader, VkDevice device,
+                  const QueueFamilies *families, VkQueue transferQueue) {
+  *uploader = (Uploader){
+      .families = *families,
+      .queue = transferQueue,
+  };
+  VkCommandPoolCreateInfo poolInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+      .queueFamilyIndex = families->transfer,
+  };
+  if (vkCreateCommandPool(device, &poolInfo, NULL, &uploader->pool) !=
+      VK_SUCCESS) {
+    printf("failed to create transfer command pool\n");
+    exit(1);
+  }
+  VkSemaphoreTypeCreateInfo typeInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+      .initialValue = 0,
+  };
+  VkSemaphoreCreateInfo semaphoreInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &typeInfo,
+  };
+  if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &uploader->timeline) !=
+      VK_SUCCESS) {
+    printf("failed to create upload timeline\n");
+    exit(1);
+  }
+}
+
+VkCommandBuffer uploaderBegin(Uploader *uploader, VkDevice device) {
+  VkCommandBufferAllocateInfo allocInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandPool = uploader->pool,
+      .commandBufferCount = 1,
+  };
+  VkCommandBuffer cmd;
+  if (vkAllocateCommandBuffers(device, &allocInfo, &cmd) != VK_SUCCESS) {
+    printf("failed to allocate upload command buffer\n");
+    exit(1);
+  }
+  VkCommandBufferBeginInfo beginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  vkBeginCommandBuffer(cmd, &beginInfo);
+  return cmd;
+}
+
+void uploaderReleaseBuffer(Uploader *uploader, VkCommandBuffer cmd,
+                           VkBuffer buffer, VkAccessFlags2 dstAccess,
+                           VkPipelineStageFlags2 dstStage) {
+  uint32_t src = uploader->families.transfer;
+  uint32_t dst = uploader->families.graphics;
+  uploader->acquireStages |= dstStage;
+  if (src == dst) {
+    // the semaphore wait alone makes the copy visible
+    return;
+  }
+  cmdReleaseBuffer(cmd, buffer, src, dst, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_2_COPY_BIT);
+  uploader->bufferAcquires =
+      grow(uploader->bufferAcquires, &uploader->bufferAcquireCap,
+           uploader->bufferAcquireCount, sizeof(VkBufferMemoryBarrier2));
+  uploader->bufferAcquires[uploader->bufferAcquireCount++] =
+      bufferAcquireBarrier(buffer, src, dst, dstAccess, dstStage);
+}
+
+void uploaderReleaseImage(Uploader *uploader, VkCommandBuffer cmd,
+                          VkImage image, VkImageSubresourceRange range,
+                          VkImageLayout layout, VkAccessFlags2 dstAccess,
+                          VkPipelineStageFlags2 dstStage) {
+  uint32_t src = uploader->families.transfer;
+  uint32_t dst = uploader->families.graphics;
+  uploader->acquireStages |= dstStage;
+  if (src == dst) {
+    return;
+  }
+  cmdReleaseImage(cmd, image, range, layout, src, dst,
+                  VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_COPY_BIT);
+  uploader->imageAcquires =
+      grow(uploader->imageAcquires, &uploader->imageAcquireCap,
+           uploader->imageAcquireCount, sizeof(VkImageMemoryBarrier2));
+  uploader->imageAcquires[uploader->imageAcquireCount++] =
+      imageAcquireBarrier(image, range, layout, src, dst, dstAccess, dstStage);
+}
+
+void uploaderSubmit(Uploader *uploader, VkCommandBuffer cmd, VkBuffer staging,
+                    VkDeviceMemory stagingMemory) {
+  vkEndCommandBuffer(cmd);
+  uint64_t value = ++uploader->submitted;
+  VkCommandBufferSubmitInfo cmdInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+      .commandBuffer = cmd,
+  };
+  VkSemaphoreSubmitInfo signalInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+      .semaphore = uploader->timeline,
+      .value = value,
+      .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+  };
+  VkSubmitInfo2 submitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+      .commandBufferInfoCount = 1,
+      .pCommandBufferInfos = &cmdInfo,
+      .signalSemaphoreInfoCount = 1,
+      .pSignalSemaphoreInfos = &signalInfo,
+  };
+  if (vkQueueSubmit2(uploader->queue, 1, &submitInfo, VK_NULL_HANDLE) !=
+      VK_SUCCESS) {
+    printf("upload submit failed\n");
+    exit(1);
+  }
+  uploader->acquireValue = value;
+  uploader->pending = grow(uploader->pending, &uploader->pendingCap,
+                           uploader->pendingCount, sizeof(PendingUpload));
+  uploader->pending[uploader->pendingCount++] = (PendingUpload){
+      .cmd = cmd,
+      .staging = staging,
+      .stagingMemory = stagingMemory,
+      .value = value,
+  };
+}
+
+uint64_t uploaderFlushAcquires(Uploader *uploader, VkCommandBuffer cmd,
+                               VkPipelineStageFlags2 *waitStages) {
+  uint64_t value = uploader->acquireValue;
+  if (value == 0) {
+    return 0;
+  }
+  VkPipelineStageFlags2 stages = uploader->acquireStages;
+  if (uploader->bufferAcquireCount > 0 || uploader->imageAcquireCount > 0) {
+    // the semaphore wait covers the acquire's first scope
+    VkDependencyInfo dependency = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = uploader->bufferAcquireCount,
+        .pBufferMemoryBarriers = uploader->bufferAcquires,
+        .imageMemoryBarrierCount = uploader->imageAcquireCount,
+        .pImageMemoryBarriers = uploader->imageAcquires,
+    };
+    vkCmdPipelineBarrier2(cmd, &dependency);
+  }
+  uploader->bufferAcquireCount = 0;
+  uploader->imageAcquireCount = 0;
+  uploader->acquireValue = 0;
+  uploader->acquireStages = 0;
+  *waitStages = stages;
+  return value;
+}
+
+void uploaderCollect(Uploader *uploader, VkDevice device) {
+  if (uploader->pendingCount == 0) {
+    return;
+  }
+  uint64_t completed = 0;
+  vkGetSemaphoreCounterValue(device, uploader->timeline, &completed);
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < uploader->pendingCount; i++) {
+    PendingUpload *upload = &uploader->pending[i];
+    if (upload->value > completed) {
+      uploader->pending[kept++] = *upload;
+      continue;
+    }
+    vkFreeCommandBuffers(device, uploader->pool, 1, &upload->cmd);
+    vkDestroyBuffer(device, upload->staging, NULL);
+    vkFreeMemory(device, upload->stagingMemory, NULL);
+  }
+  uploader->pendingCount = kept;
+}
+
+void uploaderDestroy(Uploader *uploader, VkDevice device) {
+  if (uploader->submitted > 0) {
+    VkSemaphoreWaitInfo waitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &uploader->timeline,
+        .pValues = &uploader->submitted,
+    };
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+  }
+  uploaderCollect(uploader, device);
+  vkDestroySemaphore(device, uploader->timeline, NULL);
+  vkDestroyCommandPool(device, uploader->pool, NULL);
+  free(uploader->bufferAcquires);
+  free(uploader->imageAcquires);
+  free(uploader->pending);
+}